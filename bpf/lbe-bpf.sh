@@ -0,0 +1,252 @@
+#!/bin/bash
+#
+# Control of the BPF struct_ops ports of the LBE congestion controls
+#
+# usage: lbe-bpf.sh COMMAND ALGO [ARGS]
+#   register ALGO		load bpf/tcp_ALGO.bpf.o and register bpf_ALGO
+#   unregister ALGO		unregister bpf_ALGO
+#   reload ALGO			unregister bpf_ALGO and register it again from a
+#				freshly built object with its current parameters
+#   show ALGO			print the parameters, one "name value" per line
+#   set ALGO NAME VALUE	change one parameter
+#   apply ALGO FILE		set the parameters of FILE, "name value" lines
+#				as show prints them, # starts a comment
+#   hist ALGO [clear]		print or clear the queuing delay histogram
+#
+# ALGO is ledbat, nice or westwoodlp. Parameters are read when a socket
+# is initialised, so a change applies to the sockets that start (or
+# restart after idle) afterwards, as with the sysctls of the modules.
+# Keeping one apply FILE per cluster gives each its own tuning without a
+# rebuild. On reload, sockets already using bpf_ALGO keep the old code to
+# the end, and new sockets get the new one.
+# Needs root and bpftool, and llvm-objcopy to reload; BPFTOOL and OBJCOPY
+# override the ones on the PATH.
+
+set -eu
+
+BPFDIR=$(cd "$(dirname "$0")" && pwd)
+BPFTOOL=${BPFTOOL:-bpftool}
+OBJCOPY=${OBJCOPY:-llvm-objcopy}
+
+die() {
+	echo "$(basename "$0"): $*" >&2
+	exit 1
+}
+
+# params ALGO: the fields of the parameter map, all ints, in order
+params() {
+	case $1 in
+	ledbat)
+		echo "target target_us current_filter base_history usec_delay base_epoch"
+		;;
+	nice)
+		echo "alpha beta gamma fraction threshold max_fwnd base_rtt_win pacing"
+		;;
+	westwoodlp)
+		echo "beta"
+		;;
+	*)
+		die "unknown algorithm $1"
+		;;
+	esac
+}
+
+# short ALGO: the prefix of the map names
+short() {
+	case $1 in
+	westwoodlp)
+		echo westwood
+		;;
+	*)
+		echo $1
+		;;
+	esac
+}
+
+# map_id NAME: the id of the newest map called NAME
+map_id() {
+	local id
+
+	id=$($BPFTOOL map show | awk -v n="$1" '
+		$1 ~ /^[0-9]+:$/ {
+			for (i = 2; i < NF; i++)
+				if ($i == "name" && $(i + 1) == n) id = $1
+		}
+		END { sub(":", "", id); print id }')
+	[ -n "$id" ] || die "no map $1, is bpf_$ALGO registered?"
+	echo $id
+}
+
+# read_params ALGO: the parameter values, space separated
+read_params() {
+	local id bytes i v out=""
+
+	id=$(map_id .data.$(short $1))
+	bytes=($($BPFTOOL -j map lookup id $id key 0 0 0 0 |
+		sed -e 's/.*"value":\[\([^]]*\)\].*/\1/' -e 's/[",]/ /g'))
+	for ((i = 0; i + 3 < ${#bytes[@]}; i += 4)); do
+		v=$(( bytes[i] | bytes[i + 1] << 8 | bytes[i + 2] << 16 |
+		      bytes[i + 3] << 24 ))
+		[ $v -lt 2147483648 ] || v=$((v - 4294967296))
+		out="$out $v"
+	done
+	echo $out
+}
+
+# le32 VALUE...: the bytes of the values as little-endian ints
+le32() {
+	local v
+
+	for v in "$@"; do
+		awk -v v=$v 'BEGIN {
+			if (v < 0) v += 4294967296
+			for (i = 0; i < 4; i++) { printf "%d ", v % 256; v = int(v / 256) } }'
+	done
+}
+
+# write_params ALGO VALUE...: store all parameter values
+write_params() {
+	local algo=$1 id
+
+	shift
+	id=$(map_id .data.$(short $algo))
+	$BPFTOOL map update id $id key 0 0 0 0 value $(le32 "$@")
+}
+
+# set_param ALGO NAME VALUE
+set_param() {
+	local names values i found=""
+
+	case $3 in
+	-[0-9]*|[0-9]*) ;;
+	*) die "bad value $3 for $2" ;;
+	esac
+
+	names=($(params $1))
+	values=($(read_params $1))
+	for i in "${!names[@]}"; do
+		if [ "${names[$i]}" = "$2" ]; then
+			values[$i]=$3
+			found=1
+		fi
+	done
+	[ -n "$found" ] || die "$1 has no parameter $2"
+	write_params $1 "${values[@]}"
+}
+
+show() {
+	local names values i
+
+	names=($(params $1))
+	values=($(read_params $1))
+	for i in "${!names[@]}"; do
+		echo "${names[$i]} ${values[$i]}"
+	done
+}
+
+apply() {
+	local name value rest
+
+	[ -r "$2" ] || die "cannot read $2"
+	while read -r name value rest; do
+		case $name in
+		""|\#*) continue ;;
+		esac
+		set_param $1 $name "$value"
+	done < "$2"
+}
+
+# object ALGO: the built object of ALGO
+object() {
+	local obj=$BPFDIR/tcp_$1.bpf.o
+
+	[ -r "$obj" ] || die "$obj not found, run make -C bpf"
+	echo "$obj"
+}
+
+register() {
+	$BPFTOOL struct_ops register "$(object $1)"
+}
+
+unregister() {
+	$BPFTOOL struct_ops unregister name bpf_$1
+}
+
+# The kept parameters are written into a copy of the object before it is
+# loaded, so that no socket of the new program sees the defaults. Between
+# unregister and register bpf_ALGO does not exist, and sockets cannot
+# select it: bpftool has no way to swap the program of a registered
+# struct_ops in place.
+reload() {
+	local obj values b tmp
+
+	obj=$(object $1)
+	command -v $OBJCOPY >/dev/null || die "$OBJCOPY not found"
+	values=($(read_params $1))
+	tmp=$(mktemp -d)
+	trap 'rm -rf "$tmp"' EXIT
+	for b in $(le32 "${values[@]}"); do
+		printf "\\$(printf %03o $b)"
+	done > "$tmp/params"
+	$OBJCOPY --update-section .data.$(short $1)="$tmp/params" "$obj" "$tmp/obj.o"
+	unregister $1
+	$BPFTOOL struct_ops register "$tmp/obj.o"
+}
+
+# hist ALGO: the log2 histogram of the queuing delay, summed over CPUs
+hist() {
+	local id
+
+	id=$(map_id $(short $1)_qdelay)
+	$BPFTOOL map dump id $id | awk '
+		/"key":/ { k = $2 + 0 }
+		/"value":/ { sum[k] += $2; if ($2 + 0 && k > last) last = k }
+		END {
+			for (k = 0; k <= last; k++) {
+				if (k == 0) range = "0"
+				else range = sprintf("[%d, %d)", 2 ^ (k - 1), 2 ^ k)
+				printf "%-26s %d\n", range " us", sum[k]
+			}
+		}'
+}
+
+# hist_clear ALGO
+hist_clear() {
+	local id k
+
+	id=$(map_id $(short $1)_qdelay)
+	for k in $(seq 0 31); do
+		$BPFTOOL map update id $id key $k 0 0 0 value 0 0 0 0 0 0 0 0
+	done
+}
+
+[ $# -ge 2 ] || die "usage: $(basename "$0") COMMAND ALGO [ARGS]"
+command -v $BPFTOOL >/dev/null || die "$BPFTOOL not found"
+ALGO=$2
+params $ALGO >/dev/null
+
+case $1 in
+register|unregister|reload|show)
+	[ $# -eq 2 ] || die "usage: $(basename "$0") $1 ALGO"
+	$1 $ALGO
+	;;
+set)
+	[ $# -eq 4 ] || die "usage: $(basename "$0") set ALGO NAME VALUE"
+	set_param $ALGO $3 $4
+	;;
+apply)
+	[ $# -eq 3 ] || die "usage: $(basename "$0") apply ALGO FILE"
+	apply $ALGO $3
+	;;
+hist)
+	if [ $# -eq 3 ] && [ "$3" = clear ]; then
+		hist_clear $ALGO
+	else
+		[ $# -eq 2 ] || die "usage: $(basename "$0") hist ALGO [clear]"
+		hist $ALGO
+	fi
+	;;
+*)
+	die "unknown command $1"
+	;;
+esac
@@ -0,0 +1,176 @@
+/*
+ * Helpers shared by the BPF struct_ops ports of the LBE congestion
+ * controls
+ *
+ * The kernel's static inline TCP helpers are not available to BPF, so
+ * the ones the modules use are recreated here on top of vmlinux.h, as in
+ * the kernel's BPF selftests. Writes from a struct_ops program are only
+ * allowed to a few tcp_sock fields (snd_cwnd, snd_cwnd_cnt, snd_ssthresh,
+ * sk_pacing_rate, ...) and to the private congestion control area, and
+ * only at constant offsets, so arrays in the private area are indexed
+ * through unrolled loops.
+ */
+
+#ifndef _LBE_BPF_H
+#define _LBE_BPF_H
+
+#include "vmlinux.h"
+#include <bpf/bpf_helpers.h>
+#include <bpf/bpf_tracing.h>
+#include <bpf/bpf_core_read.h>
+
+#define USEC_PER_MSEC	1000U
+#define USEC_PER_SEC	1000000U
+#define NSEC_PER_USEC	1000U
+#define MSEC_PER_SEC	1000U
+#define TCP_TS_HZ	1000U
+#define U8_MAX		0xffU
+#define UINT_MAX	0xffffffffU
+#define S32_MAX		0x7fffffff
+#define S32_MIN		(-S32_MAX - 1)
+
+#define min(a, b)	((a) < (b) ? (a) : (b))
+#define max(a, b)	((a) > (b) ? (a) : (b))
+#define clamp(v, lo, hi) min(max(v, lo), hi)
+#define ARRAY_SIZE(a)	(sizeof(a) / sizeof((a)[0]))
+#define before(seq1, seq2) ((s32)((seq1) - (seq2)) < 0)
+#define after(seq2, seq1) before(seq1, seq2)
+
+extern const int CONFIG_HZ __kconfig;
+#define HZ		CONFIG_HZ
+
+/* Exported to struct_ops programs as kfuncs */
+extern u32 tcp_slow_start(struct tcp_sock *tp, u32 acked) __ksym;
+extern void tcp_cong_avoid_ai(struct tcp_sock *tp, u32 w, u32 acked) __ksym;
+extern void tcp_reno_cong_avoid(struct sock *sk, u32 ack, u32 acked) __ksym;
+extern u32 tcp_reno_ssthresh(struct sock *sk) __ksym;
+extern u32 tcp_reno_undo_cwnd(struct sock *sk) __ksym;
+
+static __always_inline struct tcp_sock *tcp_sk(const struct sock *sk)
+{
+	return (struct tcp_sock *)sk;
+}
+
+static __always_inline struct inet_connection_sock *inet_csk(const struct sock *sk)
+{
+	return (struct inet_connection_sock *)sk;
+}
+
+static __always_inline void *inet_csk_ca(const struct sock *sk)
+{
+	return (void *)inet_csk(sk)->icsk_ca_priv;
+}
+
+static __always_inline u32 lbe_jiffies(void)
+{
+	return bpf_jiffies64();
+}
+
+static __always_inline u32 lbe_clock_us(void)
+{
+	return bpf_ktime_get_ns() / NSEC_PER_USEC;
+}
+
+static __always_inline bool tcp_in_slow_start(const struct tcp_sock *tp)
+{
+	return tp->snd_cwnd < tp->snd_ssthresh;
+}
+
+static __always_inline bool tcp_is_cwnd_limited(const struct sock *sk)
+{
+	const struct tcp_sock *tp = tcp_sk(sk);
+
+	/* If in slow start, ensure cwnd grows to twice what was ACKed. */
+	if (tcp_in_slow_start(tp))
+		return tp->snd_cwnd < 2 * tp->max_packets_out;
+	return BPF_CORE_READ_BITFIELD(tp, is_cwnd_limited);
+}
+
+static __always_inline bool tcp_in_cwnd_reduction(const struct sock *sk)
+{
+	u8 state = BPF_CORE_READ_BITFIELD(inet_csk(sk), icsk_ca_state);
+
+	return (1 << state) & (TCPF_CA_CWR | TCPF_CA_Recovery);
+}
+
+static __always_inline u32 tcp_current_ssthresh(const struct sock *sk)
+{
+	const struct tcp_sock *tp = tcp_sk(sk);
+
+	if (tcp_in_cwnd_reduction(sk))
+		return tp->snd_ssthresh;
+	return max(tp->snd_ssthresh,
+		   (tp->snd_cwnd >> 1) + (tp->snd_cwnd >> 2));
+}
+
+/* As lbe_tcp_ts_hz() in tcp_lbe_compat.h, for kernels that have struct_ops */
+static __always_inline u32 lbe_tcp_ts_hz(const struct tcp_sock *tp)
+{
+	if (bpf_core_field_exists(tp->tcp_usec_ts) &&
+	    BPF_CORE_READ_BITFIELD(tp, tcp_usec_ts))
+		return USEC_PER_SEC;
+	return TCP_TS_HZ;
+}
+
+/* BPF has no signed 64-bit division before cpu v4; this one truncates
+ * towards zero like div64_s64(), for b > 0.
+ */
+static __always_inline s64 lbe_div_s64(s64 a, s64 b)
+{
+	if (a < 0)
+		return -(s64)((u64)-a / (u64)b);
+	return (u64)a / (u64)b;
+}
+
+/* mul_u64_u32_shr() for shift <= 32, without 128-bit arithmetic */
+static __always_inline u64 lbe_mul_u64_u32_shr(u64 a, u32 mul, u32 shift)
+{
+	u64 lo = (a & 0xffffffffULL) * mul;
+	u64 hi = (a >> 32) * mul;
+
+	return (hi << (32 - shift)) + (lo >> shift);
+}
+
+/* Log2 histograms, one per-CPU array per algorithm. Slot 0 counts zero
+ * values and slot n values in [2^(n-1), 2^n), as bpftrace's hist().
+ * lbe-bpf.sh hist sums and prints them.
+ */
+#define LBE_HIST_SLOTS	32
+
+#define LBE_HIST(name)						\
+struct {							\
+	__uint(type, BPF_MAP_TYPE_PERCPU_ARRAY);		\
+	__uint(max_entries, LBE_HIST_SLOTS);			\
+	__type(key, u32);					\
+	__type(value, u64);					\
+} name SEC(".maps")
+
+static __always_inline u32 lbe_log2(u32 v)
+{
+	u32 r, shift;
+
+	r = (v > 0xffff) << 4;
+	v >>= r;
+	shift = (v > 0xff) << 3;
+	v >>= shift;
+	r |= shift;
+	shift = (v > 0xf) << 2;
+	v >>= shift;
+	r |= shift;
+	shift = (v > 0x3) << 1;
+	v >>= shift;
+	r |= shift;
+	r |= (v >> 1);
+	return r;
+}
+
+static __always_inline void lbe_hist_add(void *map, u32 v)
+{
+	u32 slot = v ? min(lbe_log2(v) + 1, LBE_HIST_SLOTS - 1) : 0;
+	u64 *count = bpf_map_lookup_elem(map, &slot);
+
+	if (count)
+		(*count)++;
+}
+
+#endif /* _LBE_BPF_H */
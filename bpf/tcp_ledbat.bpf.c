@@ -0,0 +1,379 @@
+/*
+ * LEDBAT (RFC6817) as a BPF struct_ops congestion control, "bpf_ledbat"
+ *
+ * Mirrors tcp_ledbat.c and the delay estimation of tcp_ledbat_core.c:
+ * one-way delays from TCP timestamps, with the peer's timestamp clock
+ * rate estimated over the connection lifetime, a running-minimum current
+ * filter and a base delay history rolled over every base_epoch seconds.
+ * The host-wide counters of /proc/net/tcp_ledbat_stat and get_info are
+ * not available to BPF; the queuing delay of every sample goes to the
+ * ledbat_qdelay histogram instead.
+ */
+
+#include "lbe_bpf.h"
+
+char _license[] SEC("license") = "GPL";
+
+#define GAIN 1			/* GAIN MUST be set to 1 or less. */
+#define ALLOWED_INCREASE 1	/* ALLOWED_INCREASE SHOULD be 1 */
+#define MIN_CWND 2U
+
+#define LEDBAT_MAX_CURRENT_FILTER 1024
+#define LEDBAT_MAX_BASE_HISTORY 10
+#define LEDBAT_HZ_MAX_STEP 16
+#define LEDBAT_TS_REBASE (1U << 30)
+#define LEDBAT_MIN_REMOTE_HZ 16
+
+/* ledbat->flags, as in tcp_ledbat.h */
+#define LEDBAT_F_USEC	0x1
+
+/* Tunables, in the order of the net.ipv4.tcp_ledbat sysctls and with the
+ * defaults of the module parameters. They live in the .data.ledbat map,
+ * where lbe-bpf.sh set changes them for the sockets initialised after.
+ */
+struct ledbat_params {
+	int target;
+	int target_us;
+	int current_filter;
+	int base_history;
+	int usec_delay;
+	int base_epoch;
+};
+
+struct ledbat_params ledbat_params SEC(".data.ledbat") = {
+	.target		= 100,
+	.target_us	= 100000,
+	.current_filter	= 2,
+	.base_history	= 2,
+	.usec_delay	= 0,
+	.base_epoch	= 60,
+};
+
+/* Queuing delay of every sample, in usec */
+LBE_HIST(ledbat_qdelay);
+
+/* Timestamp clock rates in common use, in Hz */
+static const u32 ledbat_ts_hz[] = { 100, 250, 300, 1000, 1024, USEC_PER_SEC };
+
+struct ledbat_minmax {
+	u32 v[3];
+	u16 t[3];
+	u16 win;
+};
+
+/* struct ledbat_rfc of tcp_ledbat.c, with the core state inline */
+struct ledbat {
+	struct ledbat_minmax current_delays;
+	u16 current_seq;
+	u8 base_next;
+	u8 base_len;
+	u32 base_min;
+	u32 next_rollover;	/* jiffies */
+	u32 target;
+	u32 remote_scale;	/* usec per remote timestamp tick, << 16 */
+	u32 hz_start;
+	u8 hz_step;
+	u8 flags;
+	u16 base_epoch;
+	u32 local_time_offset;
+	u32 remote_time_offset;
+	s32 cwnd_cnt;
+	u32 base_buffer[LEDBAT_MAX_BASE_HISTORY];
+};
+
+static __always_inline void ledbat_minmax_reset(struct ledbat_minmax *m,
+						u16 t, u32 meas)
+{
+	m->t[0] = m->t[1] = m->t[2] = t;
+	m->v[0] = m->v[1] = m->v[2] = meas;
+}
+
+static __always_inline void ledbat_minmax_shift(struct ledbat_minmax *m,
+						u16 t, u32 meas)
+{
+	m->t[0] = m->t[1];
+	m->v[0] = m->v[1];
+	m->t[1] = m->t[2];
+	m->v[1] = m->v[2];
+	m->t[2] = t;
+	m->v[2] = meas;
+}
+
+/* Add sample meas taken at time t and return the minimum of the window */
+static __always_inline u32 ledbat_minmax_running_min(struct ledbat_minmax *m,
+						     u16 t, u32 meas)
+{
+	u16 dt;
+
+	if (meas <= m->v[0] || (u16)(t - m->t[2]) > m->win) {
+		ledbat_minmax_reset(m, t, meas);
+		return meas;
+	}
+
+	if (meas <= m->v[1]) {
+		m->t[2] = m->t[1] = t;
+		m->v[2] = m->v[1] = meas;
+	} else if (meas <= m->v[2]) {
+		m->t[2] = t;
+		m->v[2] = meas;
+	}
+
+	dt = t - m->t[0];
+	if (dt > m->win) {
+		ledbat_minmax_shift(m, t, meas);
+		if ((u16)(t - m->t[0]) > m->win)
+			ledbat_minmax_shift(m, t, meas);
+	} else if (m->t[1] == m->t[0] && dt > m->win / 4) {
+		m->t[2] = m->t[1] = t;
+		m->v[2] = m->v[1] = meas;
+	} else if (m->t[2] == m->t[1] && dt > m->win / 2) {
+		m->t[2] = t;
+		m->v[2] = meas;
+	}
+
+	return m->v[0];
+}
+
+SEC("struct_ops/bpf_ledbat_init")
+void BPF_PROG(bpf_ledbat_init, struct sock *sk)
+{
+	struct ledbat *ledbat = inet_csk_ca(sk);
+	const struct ledbat_params *p = &ledbat_params;
+	int i;
+
+	ledbat->current_seq = 0;
+	ledbat->current_delays.win =
+		clamp(p->current_filter, 1, LEDBAT_MAX_CURRENT_FILTER) - 1;
+	ledbat_minmax_reset(&ledbat->current_delays, 0, UINT_MAX);
+
+	#pragma unroll
+	for (i = 0; i < LEDBAT_MAX_BASE_HISTORY; i++)
+		ledbat->base_buffer[i] = UINT_MAX;
+	ledbat->base_len = clamp(p->base_history, 2, LEDBAT_MAX_BASE_HISTORY);
+	ledbat->base_next = 0;
+	ledbat->base_min = UINT_MAX;
+
+	ledbat->base_epoch = clamp(p->base_epoch, 1, 3600);
+	ledbat->next_rollover = lbe_jiffies() + ledbat->base_epoch * HZ;
+
+	ledbat->local_time_offset = 0;
+	ledbat->remote_time_offset = 0;
+	ledbat->hz_start = 0;
+	ledbat->hz_step = 0;
+	/* until it is estimated, the peer's clock is assumed to run as ours */
+	ledbat->remote_scale = ((u64)USEC_PER_SEC << 16) /
+			       lbe_tcp_ts_hz(tcp_sk(sk));
+	if (p->usec_delay) {
+		ledbat->flags = LEDBAT_F_USEC;
+		ledbat->target = max(p->target_us, 1);
+	} else {
+		ledbat->flags = 0;
+		ledbat->target = max(p->target, 1);
+	}
+	ledbat->cwnd_cnt = 0;
+}
+
+/* Returns the minimum of the base delay history after adding delay. The
+ * history is a ring of base_len entries, each covering base_epoch s.
+ */
+static __always_inline u32 ledbat_update_base_delay(struct ledbat *ledbat,
+						    u32 delay)
+{
+	u32 now = lbe_jiffies();
+	u32 base_min = UINT_MAX;
+	int i;
+
+	if ((s32)(now - ledbat->next_rollover) < 0) {
+		/* stored only when lower, as in tcp_ledbat_core.c */
+		#pragma unroll
+		for (i = 0; i < LEDBAT_MAX_BASE_HISTORY; i++) {
+			if (i == ledbat->base_next &&
+			    delay < ledbat->base_buffer[i])
+				ledbat->base_buffer[i] = delay;
+		}
+		if (delay < ledbat->base_min)
+			ledbat->base_min = delay;
+		return ledbat->base_min;
+	}
+
+	ledbat->next_rollover = now + ledbat->base_epoch * HZ;
+	ledbat->base_next++;
+	if (ledbat->base_next >= ledbat->base_len)
+		ledbat->base_next = 0;
+	/* the forgotten epoch may have held the minimum: rescan */
+	#pragma unroll
+	for (i = 0; i < LEDBAT_MAX_BASE_HISTORY; i++) {
+		if (i == ledbat->base_next)
+			ledbat->base_buffer[i] = delay;
+		if (i < ledbat->base_len)
+			base_min = min(base_min, ledbat->base_buffer[i]);
+	}
+	ledbat->base_min = base_min;
+	return base_min;
+}
+
+/* As ledbat_estimate_remote_hz() in tcp_ledbat_core.c */
+static __always_inline void ledbat_estimate_remote_hz(struct ledbat *ledbat,
+						      u32 tsval)
+{
+	u32 elapsed = lbe_jiffies() - ledbat->hz_start;
+	u32 remote_hz;
+	int i;
+
+	if (ledbat->hz_step > LEDBAT_HZ_MAX_STEP ||
+	    elapsed < ((u32)HZ << ledbat->hz_step))
+		return;
+	ledbat->hz_step++;
+
+	remote_hz = (u64)(tsval - ledbat->remote_time_offset) * HZ / elapsed;
+	for (i = 0; i < ARRAY_SIZE(ledbat_ts_hz); i++) {
+		s32 err = remote_hz - ledbat_ts_hz[i];
+
+		if (err < 0)
+			err = -err;
+		if (err <= ledbat_ts_hz[i] >> 5) {
+			remote_hz = ledbat_ts_hz[i];
+			break;
+		}
+	}
+
+	if (remote_hz >= LEDBAT_MIN_REMOTE_HZ)
+		ledbat->remote_scale = ((u64)USEC_PER_SEC << 16) / remote_hz;
+}
+
+/* As tcp_ledbat_core_update(): take a one-way delay sample from the
+ * timestamps of the current ACK and return the queuing delay.
+ */
+static __always_inline u32 ledbat_update(struct sock *sk, struct ledbat *ledbat)
+{
+	const struct tcp_sock *tp = tcp_sk(sk);
+	u32 tsval = tp->rx_opt.rcv_tsval;
+	u32 tsecr = tp->rx_opt.rcv_tsecr;
+	u32 delay = 0, base_delay, queuing_delay, ticks;
+	u64 remote_us;
+
+	if (ledbat->remote_time_offset == 0) {
+		ledbat->remote_time_offset = tsval;
+		ledbat->hz_start = lbe_jiffies();
+	}
+	if (ledbat->local_time_offset == 0) {
+		if (ledbat->flags & LEDBAT_F_USEC)
+			ledbat->local_time_offset = lbe_clock_us();
+		else
+			ledbat->local_time_offset = tsecr *
+				(USEC_PER_SEC / lbe_tcp_ts_hz(tp));
+	}
+
+	ledbat_estimate_remote_hz(ledbat, tsval);
+
+	/* move the offsets before the tick difference wraps, as there */
+	ticks = tsval - ledbat->remote_time_offset;
+	if (ticks >= LEDBAT_TS_REBASE && ticks < LEDBAT_TS_REBASE << 1) {
+		ledbat->remote_time_offset += LEDBAT_TS_REBASE >> 1;
+		ledbat->local_time_offset += (u32)((u64)ledbat->remote_scale << 13);
+		ledbat->hz_step = LEDBAT_HZ_MAX_STEP + 1;
+	}
+
+	remote_us = ((u64)(tsval - ledbat->remote_time_offset) *
+		     ledbat->remote_scale) >> 16;
+	if (ledbat->flags & LEDBAT_F_USEC) {
+		/* u32 modular difference, so the usec clocks may wrap */
+		s32 owd = lbe_clock_us() - ledbat->local_time_offset - (u32)remote_us;
+
+		if (owd > 0)
+			delay = owd;
+	} else {
+		/* echoed ticks of our timestamp clock -> [us], modular as above */
+		u32 local_us = tsecr * (USEC_PER_SEC / lbe_tcp_ts_hz(tp));
+		s32 owd = (u32)remote_us - (local_us - ledbat->local_time_offset);
+
+		if (owd > 0)
+			delay = owd / USEC_PER_MSEC;
+	}
+
+	base_delay = ledbat_update_base_delay(ledbat, delay);
+	ledbat->current_seq++;
+	queuing_delay = ledbat_minmax_running_min(&ledbat->current_delays,
+						  ledbat->current_seq, delay) -
+			base_delay;
+
+	lbe_hist_add(&ledbat_qdelay, ledbat->flags & LEDBAT_F_USEC ?
+		     queuing_delay : queuing_delay * USEC_PER_MSEC);
+	return queuing_delay;
+}
+
+SEC("struct_ops/bpf_ledbat_cong_avoid")
+void BPF_PROG(bpf_ledbat_cong_avoid, struct sock *sk, u32 ack, u32 acked)
+{
+	struct tcp_sock *tp = tcp_sk(sk);
+	struct ledbat *ledbat = inet_csk_ca(sk);
+	u32 queuing_delay, cwnd, max_allowed_cwnd;
+	s64 cwnd_cnt, thresh;
+	int tgt, off_target;
+
+	queuing_delay = ledbat_update(sk, ledbat);
+	tgt = ledbat->target;
+
+	/* don't change cwnd is not cwnd-limited */
+	if (!tcp_is_cwnd_limited(sk))
+		return;
+
+	/* In "safe" area, increase exponentially. */
+	if (tp->snd_cwnd <= tp->snd_ssthresh) {
+		acked = tcp_slow_start(tp, acked);
+		if (!acked)
+			return;
+	}
+
+	cwnd = tp->snd_cwnd;
+	off_target = tgt - queuing_delay;
+	thresh = (s64)tp->snd_cwnd * tgt;
+	if (off_target >= 0) {
+		cwnd_cnt = ledbat->cwnd_cnt + (s64)GAIN * off_target * acked;
+	} else {
+		/* a decrease counts at most one window of a stretch ACK, at
+		 * most half a packet each, as in tcp_ledbat.c
+		 */
+		s64 dec = max((s64)GAIN * off_target, -(s64)((u64)thresh >> 1));
+
+		cwnd_cnt = ledbat->cwnd_cnt + dec * min(acked, tp->snd_cwnd);
+	}
+	if (cwnd_cnt >= thresh || cwnd_cnt <= -thresh) {
+		s64 inc = lbe_div_s64(cwnd_cnt, thresh);
+
+		cwnd += inc;
+		cwnd_cnt -= inc * thresh;
+	}
+	ledbat->cwnd_cnt = clamp(cwnd_cnt, (s64)S32_MIN, (s64)S32_MAX);
+
+	/* From RFC6817: max_allowed_cwnd = flightsize + ALLOWED_INCREASE * MSS */
+	max_allowed_cwnd = tp->packets_out + acked + ALLOWED_INCREASE;
+	cwnd = min(cwnd, max_allowed_cwnd);
+
+	tp->snd_cwnd = max(MIN_CWND, cwnd);
+
+	/* also adapt ssthreash if the cwnd is reduced! */
+	if (tp->snd_cwnd <= tp->snd_ssthresh)
+		tp->snd_ssthresh = tp->snd_cwnd - 1;
+}
+
+SEC("struct_ops/bpf_ledbat_ssthresh")
+u32 BPF_PROG(bpf_ledbat_ssthresh, struct sock *sk)
+{
+	return tcp_reno_ssthresh(sk);
+}
+
+SEC("struct_ops/bpf_ledbat_undo_cwnd")
+u32 BPF_PROG(bpf_ledbat_undo_cwnd, struct sock *sk)
+{
+	return tcp_reno_undo_cwnd(sk);
+}
+
+SEC(".struct_ops")
+struct tcp_congestion_ops bpf_ledbat = {
+	.init		= (void *)bpf_ledbat_init,
+	.ssthresh	= (void *)bpf_ledbat_ssthresh,
+	.cong_avoid	= (void *)bpf_ledbat_cong_avoid,
+	.undo_cwnd	= (void *)bpf_ledbat_undo_cwnd,
+	.name		= "bpf_ledbat",
+};
@@ -0,0 +1,381 @@
+/*
+ * TCP Nice as a BPF struct_ops congestion control, "bpf_nice"
+ *
+ * Mirrors tcp_nice.c: Vegas' per-RTT window adjustment, the count of
+ * RTT samples above the threshold between baseRTT and maxRTT that forces
+ * a multiplicative decrease, fractional windows below 2 packets, and the
+ * periodic re-probing of baseRTT. The pacing mode is left out: it sets
+ * sk_pacing_rate from cong_control(), which the port does not have. RTT
+ * above baseRTT at every per-RTT update goes to the nice_qdelay histogram.
+ */
+
+#include "lbe_bpf.h"
+
+char _license[] SEC("license") = "GPL";
+
+/* Tunables, in the order of the net.ipv4.tcp_nice sysctls and with the
+ * defaults of the module parameters. They live in the .data.nice map,
+ * where lbe-bpf.sh set changes them for the sockets initialised after.
+ * pacing is kept for the layout but ignored.
+ */
+struct nice_params {
+	int alpha;
+	int beta;
+	int gamma;
+	int fraction;
+	int threshold;
+	int max_fwnd;
+	int base_rtt_win;
+	int pacing;
+};
+
+struct nice_params nice_params SEC(".data.nice") = {
+	.alpha		= 1,
+	.beta		= 3,
+	.gamma		= 1,
+	.fraction	= 50,
+	.threshold	= 20,
+	.max_fwnd	= 96,
+	.base_rtt_win	= 10,
+	.pacing		= 0,
+};
+
+/* RTT above baseRTT at every per-RTT update, in usec */
+LBE_HIST(nice_qdelay);
+
+/* Minimum time cwnd is held down when probing baseRTT, as in BBR */
+#define NICE_PROBE_RTT_TIME	(HZ / 5)
+
+/* struct nice of tcp_nice.c, without the pacing state */
+struct nice {
+	u32	beg_snd_nxt;	/* right edge during last RTT */
+	u32	beg_snd_cwnd;	/* saves the size of the cwnd (while probing baseRTT) */
+	u8	doing_nice_now;	/* if true, do nice for this RTT */
+	u16	cntRTT;		/* # of RTTs measured within last RTT */
+	u32	minRTT;		/* min of RTTs measured within last RTT (in usec) */
+	u32	maxRTT;		/* max of RTTs measured within last RTT (in usec) */
+	u32	congRTT;	/* RTTs above are congestion events */
+	u32	baseRTT;	/* the min of nice RTT measurements over base_rtt_win (in usec) */
+	u32	baseRTT_stamp;	/* jiffies when baseRTT was last reached, or probing began */
+	u32	probeRTT;	/* min RTT while probing baseRTT (in usec) */
+	u8	numCong;	/* number of congestion events detected by nice */
+	u8	fractional_cwnd; /* denominator of the cwnd */
+	u8	nice_timer;	/* keeps time for the fractional cwnd */
+	u8	probing;	/* if true, cwnd is held down to re-measure baseRTT */
+
+	/* per-socket copy of the tunables */
+	u8	alpha;
+	u8	beta;
+	u8	gamma;
+	u8	threshold;
+	u8	max_fwnd;
+	u8	fraction_divisor;
+	u32	base_rtt_win;	/* in jiffies */
+};
+
+static __always_inline void nice_enable(struct sock *sk)
+{
+	const struct tcp_sock *tp = tcp_sk(sk);
+	struct nice *nice = inet_csk_ca(sk);
+
+	/* Begin taking Vegas samples next time we send something. */
+	nice->doing_nice_now = 1;
+
+	/* Set the beginning of the next send window. */
+	nice->beg_snd_nxt = tp->snd_nxt;
+
+	nice->cntRTT = 0;
+	nice->minRTT = 0x7fffffff;
+}
+
+static __always_inline void nice_init(struct sock *sk)
+{
+	struct nice *nice = inet_csk_ca(sk);
+	const struct nice_params *p = &nice_params;
+
+	nice->alpha = clamp(p->alpha, 0, U8_MAX);
+	nice->beta = clamp(p->beta, 0, U8_MAX);
+	nice->gamma = clamp(p->gamma, 0, U8_MAX);
+	nice->threshold = clamp(p->threshold, 0, 100);
+	nice->max_fwnd = clamp(p->max_fwnd, 2, U8_MAX);
+	nice->fraction_divisor = 100 / clamp(p->fraction, 1, 100);
+	nice->base_rtt_win = clamp(p->base_rtt_win, 0, 3600) * HZ;
+
+	/* Initialise the CWND denominator */
+	nice->fractional_cwnd = 2;
+	nice->nice_timer = 0;
+
+	nice->baseRTT = 0x7fffffff;
+	nice->congRTT = 0x7fffffff;
+	nice->baseRTT_stamp = lbe_jiffies();
+	nice->probing = 0;
+	nice_enable(sk);
+}
+
+SEC("struct_ops/bpf_nice_init")
+void BPF_PROG(bpf_nice_init, struct sock *sk)
+{
+	nice_init(sk);
+}
+
+/* Do RTT sampling needed for Vegas, as tcp_nice_pkts_acked() */
+SEC("struct_ops/bpf_nice_pkts_acked")
+void BPF_PROG(bpf_nice_pkts_acked, struct sock *sk,
+	      const struct ack_sample *sample)
+{
+	struct nice *nice = inet_csk_ca(sk);
+	bool moved = false;
+	u32 vrtt;
+
+	if (sample->rtt_us < 0)
+		return;
+
+	/* Never allow zero rtt or baseRTT */
+	vrtt = sample->rtt_us + 1;
+
+	/* Filter to find propagation delay: */
+	if (vrtt <= nice->baseRTT) {
+		moved = vrtt < nice->baseRTT;
+		nice->baseRTT = vrtt;
+		if (!nice->probing)
+			nice->baseRTT_stamp = lbe_jiffies();
+	}
+	if (nice->probing)
+		nice->probeRTT = min(nice->probeRTT, vrtt);
+
+	/* Initialise maxRTT to 2*minRTT */
+	if (nice->cntRTT == 0) {
+		nice->maxRTT = nice->baseRTT * 2;
+		moved = true;
+	}
+
+	if (vrtt < nice->minRTT)
+		nice->minRTT = vrtt;
+	if (vrtt > nice->maxRTT) {
+		nice->maxRTT = vrtt;
+		moved = true;
+	}
+	nice->cntRTT++;
+
+	/* the threshold only moves with baseRTT and maxRTT, as in tcp_nice.c */
+	if (moved)
+		nice->congRTT = ((100ULL - nice->threshold) * nice->baseRTT +
+				 (u64)nice->threshold * nice->maxRTT) / 100;
+	if (vrtt > nice->congRTT)
+		nice->numCong++;
+}
+
+SEC("struct_ops/bpf_nice_state")
+void BPF_PROG(bpf_nice_state, struct sock *sk, u8 ca_state)
+{
+	struct nice *nice = inet_csk_ca(sk);
+
+	if (ca_state == TCP_CA_Open)
+		nice_enable(sk);
+	else
+		nice->doing_nice_now = 0;
+}
+
+SEC("struct_ops/bpf_nice_cwnd_event")
+void BPF_PROG(bpf_nice_cwnd_event, struct sock *sk, enum tcp_ca_event event)
+{
+	if (event == CA_EVENT_CWND_RESTART || event == CA_EVENT_TX_START)
+		nice_init(sk);
+}
+
+static __always_inline u32 nice_ssthresh(const struct tcp_sock *tp)
+{
+	return min(tp->snd_ssthresh, tp->snd_cwnd - 1);
+}
+
+/* Determine what change Reno would apply and use it on the fractional CWND */
+static __always_inline void nice_reno_fractional_ca(struct sock *sk, u32 ack,
+						    u32 acked)
+{
+	struct tcp_sock *tp = tcp_sk(sk);
+	struct nice *nice = inet_csk_ca(sk);
+	u32 cur_cwnd = tp->snd_cwnd;
+	u32 cur_cwnd_cnt = tp->snd_cwnd_cnt;
+	s16 cwnd_change;
+
+	tcp_reno_cong_avoid(sk, ack, acked);
+
+	cwnd_change = 2 * (tp->snd_cwnd - cur_cwnd);
+	nice->fractional_cwnd -= cwnd_change;
+
+	/* Restore previous CWND and let Nice continue */
+	if (nice->fractional_cwnd > 2) {
+		tp->snd_cwnd = cur_cwnd;
+		tp->snd_cwnd_cnt = cur_cwnd_cnt;
+	} else {
+		nice->fractional_cwnd = 2;
+	}
+}
+
+static __always_inline void nice_reno(struct sock *sk, struct nice *nice,
+				      u32 ack, u32 acked)
+{
+	if (tcp_sk(sk)->snd_cwnd <= 2 && nice->fractional_cwnd >= 2 &&
+	    nice->fractional_cwnd <= nice->max_fwnd)
+		nice_reno_fractional_ca(sk, ack, acked);
+	else
+		tcp_reno_cong_avoid(sk, ack, acked);
+}
+
+/* As nice_probe_base_rtt() in tcp_nice.c. Returns true while probing. */
+static __always_inline bool nice_probe_base_rtt(struct sock *sk, u32 ack)
+{
+	struct tcp_sock *tp = tcp_sk(sk);
+	struct nice *nice = inet_csk_ca(sk);
+	u32 elapsed = lbe_jiffies() - nice->baseRTT_stamp;
+
+	if (!nice->probing) {
+		if (!nice->base_rtt_win || elapsed <= nice->base_rtt_win)
+			return false;
+
+		nice->probing = 1;
+		nice->probeRTT = 0x7fffffff;
+		nice->baseRTT_stamp = lbe_jiffies();
+		nice->beg_snd_cwnd = tp->snd_cwnd;
+		nice->beg_snd_nxt = tp->snd_nxt;
+		tp->snd_cwnd = 2;
+		return true;
+	}
+
+	if (!after(ack, nice->beg_snd_nxt) || elapsed < NICE_PROBE_RTT_TIME)
+		return true;
+
+	nice->probing = 0;
+	if (nice->probeRTT != 0x7fffffff)
+		nice->baseRTT = nice->probeRTT;
+	nice->baseRTT_stamp = lbe_jiffies();
+	tp->snd_cwnd = max(tp->snd_cwnd, nice->beg_snd_cwnd);
+
+	/* The samples of the probe say nothing about the restored cwnd */
+	nice->beg_snd_nxt = tp->snd_nxt;
+	nice->cntRTT = 0;
+	nice->minRTT = 0x7fffffff;
+	nice->maxRTT = 0;
+	nice->numCong = 0;
+	return true;
+}
+
+/* The once-per-RTT Vegas update with Nice's multiplicative decrease */
+static __always_inline void nice_update(struct sock *sk, struct nice *nice,
+					u32 ack, u32 acked)
+{
+	struct tcp_sock *tp = tcp_sk(sk);
+	u32 rtt = nice->minRTT;
+	u64 target_cwnd;
+	u32 diff;
+
+	lbe_hist_add(&nice_qdelay, rtt - nice->baseRTT);
+
+	target_cwnd = (u64)tp->snd_cwnd * nice->baseRTT / rtt;
+	diff = tp->snd_cwnd * (rtt - nice->baseRTT) / nice->baseRTT;
+
+	if (diff > nice->gamma && tcp_in_slow_start(tp)) {
+		/* Going too fast: match the actual rate and leave slow start */
+		tp->snd_cwnd = min(tp->snd_cwnd, (u32)target_cwnd + 1);
+		tp->snd_ssthresh = nice_ssthresh(tp);
+		nice->numCong = 0;
+	} else if (tcp_in_slow_start(tp)) {
+		tcp_slow_start(tp, acked);
+	} else if (tp->snd_cwnd < nice->numCong * nice->fraction_divisor) {
+		/* numCong > snd_cwnd / fraction_divisor: multiplicative decrease */
+		if (tp->snd_cwnd > 2 && nice->fractional_cwnd == 2)
+			tp->snd_cwnd = tp->snd_cwnd / 2;
+		else if (nice->fractional_cwnd <= nice->max_fwnd)
+			nice->fractional_cwnd *= 4;
+		nice->numCong = 0;
+	} else if (diff > nice->beta) {
+		if (tp->snd_cwnd > 2 && nice->fractional_cwnd == 2)
+			tp->snd_cwnd--;
+		else if (nice->fractional_cwnd <= nice->max_fwnd)
+			nice->fractional_cwnd += 2;
+		tp->snd_ssthresh = nice_ssthresh(tp);
+	} else if (diff < nice->alpha) {
+		if (tp->snd_cwnd >= 2 && nice->fractional_cwnd == 2)
+			tp->snd_cwnd++;
+		else if (nice->fractional_cwnd <= nice->max_fwnd)
+			nice->fractional_cwnd -= 2;
+	}
+
+	if (tp->snd_cwnd < 2 && nice->fractional_cwnd == 2)
+		tp->snd_cwnd = 2;
+	else if (tp->snd_cwnd > tp->snd_cwnd_clamp)
+		tp->snd_cwnd = tp->snd_cwnd_clamp;
+
+	tp->snd_ssthresh = tcp_current_ssthresh(sk);
+}
+
+SEC("struct_ops/bpf_nice_cong_avoid")
+void BPF_PROG(bpf_nice_cong_avoid, struct sock *sk, u32 ack, u32 acked)
+{
+	struct tcp_sock *tp = tcp_sk(sk);
+	struct nice *nice = inet_csk_ca(sk);
+
+	if (nice_probe_base_rtt(sk, ack))
+		return;
+
+	if (nice->fractional_cwnd > 2 &&
+	    nice->nice_timer == nice->fractional_cwnd) {
+		/* Send two packets in this RTT then reset the timer */
+		tp->snd_cwnd = 2;
+		nice->nice_timer = 1;
+	} else if (nice->fractional_cwnd > 2) {
+		/* Waiting to send packets */
+		tp->snd_cwnd = 0;
+		nice->nice_timer++;
+	}
+
+	if (!nice->doing_nice_now) {
+		nice_reno(sk, nice, ack, acked);
+		return;
+	}
+
+	if (after(ack, nice->beg_snd_nxt)) {
+		nice->beg_snd_nxt = tp->snd_nxt;
+
+		/* With 2 samples or less, they are most likely from delayed
+		 * ACKs: behave like Reno
+		 */
+		if (nice->cntRTT <= 2)
+			nice_reno(sk, nice, ack, acked);
+		else
+			nice_update(sk, nice, ack, acked);
+
+		/* Wipe the slate clean for the next RTT. */
+		nice->cntRTT = 0;
+		nice->minRTT = 0x7fffffff;
+		nice->maxRTT = 0;
+		nice->numCong = 0;
+	} else if (tcp_in_slow_start(tp)) {
+		/* Use normal slow start */
+		tcp_slow_start(tp, acked);
+	}
+}
+
+SEC("struct_ops/bpf_nice_ssthresh")
+u32 BPF_PROG(bpf_nice_ssthresh, struct sock *sk)
+{
+	return tcp_reno_ssthresh(sk);
+}
+
+SEC("struct_ops/bpf_nice_undo_cwnd")
+u32 BPF_PROG(bpf_nice_undo_cwnd, struct sock *sk)
+{
+	return tcp_reno_undo_cwnd(sk);
+}
+
+SEC(".struct_ops")
+struct tcp_congestion_ops bpf_nice = {
+	.init		= (void *)bpf_nice_init,
+	.ssthresh	= (void *)bpf_nice_ssthresh,
+	.cong_avoid	= (void *)bpf_nice_cong_avoid,
+	.pkts_acked	= (void *)bpf_nice_pkts_acked,
+	.set_state	= (void *)bpf_nice_state,
+	.cwnd_event	= (void *)bpf_nice_cwnd_event,
+	.undo_cwnd	= (void *)bpf_nice_undo_cwnd,
+	.name		= "bpf_nice",
+};
@@ -0,0 +1,416 @@
+/*
+ * TCP Westwood+LP as a BPF struct_ops congestion control, "bpf_westwoodlp"
+ *
+ * Mirrors tcp_westwoodlp.c with its ACK-counting bandwidth estimator
+ * (rate_sample=0): the low-pass filtered bandwidth, the BDP as ssthresh
+ * after a loss, and the early window reduction against the delay range.
+ * The rate sample path is left out, as it needs cong_control() and the
+ * stack's pacing update, whose interfaces differ between the kernels
+ * that have struct_ops. RTT above rtt_min at every RTT sample goes to the
+ * westwood_qdelay histogram.
+ */
+
+#include "lbe_bpf.h"
+
+char _license[] SEC("license") = "GPL";
+
+/* The beta module parameter, in the .data.westwood map */
+struct westwood_params {
+	int beta;
+};
+
+struct westwood_params westwood_params SEC(".data.westwood") = {
+	.beta	= 3,
+};
+
+/* RTT above rtt_min at every RTT sample, in usec */
+LBE_HIST(westwood_qdelay);
+
+#define WESTWOOD_BW_SCALE	24
+
+/* struct westwood of tcp_westwoodlp.c, with the beta of init */
+struct westwood {
+	u64	bw_ns_est;	/* first bandwidth estimation..not too smoothed 8) */
+	u64	bw_est;		/* bandwidth estimate */
+	u64	bk;		/* bytes acked in the current RTT window */
+	u32	rtt_win_sx;	/* here starts a new evaluation... */
+	u32	snd_una;	/* used for evaluating the number of acked bytes */
+	u32	accounted;
+	u32	rtt;
+	u32	rtt_min;	/* minimum observed RTT */
+	u8	first_ack;	/* flag which infers that this is the first ack */
+	u8	reset_rtt_min;	/* Reset RTT min to next RTT sample*/
+	u8	ewr_mode;	/* which delays ewr_base was taken from */
+	u8	beta;		/* beta when the socket was initialised */
+	u32	delay_min;	/* minimum RTT observed within an EWR window */
+	u32	delay_max;	/* maximum RTT observed within an EWR window */
+	u32	dmin_avg;	/* weighted average of minimum RTT observed during a connection */
+	u32	dmax_avg;	/* weighted average of maximum RTT observed during a connection */
+	u32	delay_loss;	/* weighted average of RTT observed when packet loss occurs */
+	u32	bdp;		/* bw_est * rtt_min in advmss packets */
+	u32	ewr_base;	/* beta * (100 - 100 * dmin / dmax) */
+};
+
+/* w->ewr_mode */
+enum {
+	WESTWOOD_EWR_OFF,	/* no delay range yet, EWR disabled */
+	WESTWOOD_EWR_AVG,	/* from dmin_avg and dmax_avg */
+	WESTWOOD_EWR_WINDOW,	/* from delay_min and delay_max, outside slow start */
+};
+
+#define TCP_WESTWOOD_RTT_MIN	(50 * USEC_PER_MSEC)	/* 50ms */
+#define TCP_WESTWOOD_INIT_RTT	(20 * USEC_PER_SEC)
+#define WESTWOOD_EWR_MIN_QUEUE	3
+
+SEC("struct_ops/bpf_westwood_init")
+void BPF_PROG(bpf_westwood_init, struct sock *sk)
+{
+	struct westwood *w = inet_csk_ca(sk);
+
+	w->bk = 0;
+	w->bw_ns_est = 0;
+	w->bw_est = 0;
+	w->accounted = 0;
+	w->reset_rtt_min = 1;
+	w->rtt_min = w->rtt = TCP_WESTWOOD_INIT_RTT;
+	w->rtt_win_sx = lbe_clock_us();
+	w->snd_una = tcp_sk(sk)->snd_una;
+	w->first_ack = 1;
+	w->delay_max = w->delay_min = 0;
+	w->dmin_avg = w->dmax_avg = 0;
+	w->delay_loss = 1;
+	w->bdp = 0;
+	w->ewr_base = 0;
+	w->ewr_mode = WESTWOOD_EWR_OFF;
+	w->beta = clamp(westwood_params.beta, 0, U8_MAX);
+}
+
+static __always_inline u64 westwood_do_filter(u64 a, u64 b)
+{
+	return ((7 * a) + b) >> 3;
+}
+
+static __always_inline void westwood_filter(struct westwood *w, u64 sample)
+{
+	/* If the filter is empty fill it with the first sample of bandwidth  */
+	if (w->bw_ns_est == 0 && w->bw_est == 0) {
+		w->bw_ns_est = sample;
+		w->bw_est = w->bw_ns_est;
+	} else {
+		w->bw_ns_est = westwood_do_filter(w->bw_ns_est, sample);
+		w->bw_est = westwood_do_filter(w->bw_est, w->bw_ns_est);
+	}
+}
+
+/* Bandwidth-delay product Bw estimation*RTTmin in packets of mss bytes */
+static __always_inline u32 westwood_bdp(const struct westwood *w, u32 mss)
+{
+	u64 bytes = lbe_mul_u64_u32_shr(w->bw_est, w->rtt_min,
+					WESTWOOD_BW_SCALE);
+
+	if (!mss)
+		return 0;
+	return min(bytes / mss, (u64)UINT_MAX);
+}
+
+static __always_inline void westwood_update_bdp(struct sock *sk)
+{
+	struct westwood *w = inet_csk_ca(sk);
+
+	w->bdp = westwood_bdp(w, tcp_sk(sk)->advmss);
+}
+
+SEC("struct_ops/bpf_westwood_pkts_acked")
+void BPF_PROG(bpf_westwood_pkts_acked, struct sock *sk,
+	      const struct ack_sample *sample)
+{
+	struct westwood *w = inet_csk_ca(sk);
+
+	if (sample->rtt_us > 0) {
+		w->rtt = sample->rtt_us;
+		if (w->rtt >= w->rtt_min && !w->reset_rtt_min)
+			lbe_hist_add(&westwood_qdelay, w->rtt - w->rtt_min);
+	}
+}
+
+/* Updates the RTT evaluation window and filters the bandwidth when an
+ * RTT has passed, as westwood_update_window().
+ */
+static __always_inline void westwood_update_window(struct sock *sk)
+{
+	struct westwood *w = inet_csk_ca(sk);
+	u32 now = lbe_clock_us();
+	u32 delta = now - w->rtt_win_sx;
+
+	if (w->first_ack) {
+		w->snd_una = tcp_sk(sk)->snd_una;
+		w->first_ack = 0;
+	}
+
+	if (w->rtt && delta > max(w->rtt, TCP_WESTWOOD_RTT_MIN)) {
+		westwood_filter(w, (w->bk << WESTWOOD_BW_SCALE) / delta);
+		westwood_update_bdp(sk);
+
+		w->bk = 0;
+		w->rtt_win_sx = now;
+	}
+}
+
+static __always_inline u32 westwood_update_delay(u32 rtt, u32 rtt_avg)
+{
+	if (rtt_avg != 0 && rtt_avg != 1) {
+		rtt -= rtt_avg >> 2; /* rtt is now the error in the average */
+		rtt_avg += rtt; /* Add rtt to average as 3/4 old + 1/4 new */
+	} else {
+		rtt_avg = rtt << 2; /* Give rtt_avg an initial value */
+	}
+
+	return rtt_avg;
+}
+
+static __always_inline void update_rtt_min(struct sock *sk)
+{
+	struct westwood *w = inet_csk_ca(sk);
+
+	if (w->reset_rtt_min) {
+		w->rtt_min = w->rtt;
+		w->reset_rtt_min = 0;
+	} else if (w->rtt < w->rtt_min) {
+		w->rtt_min = w->rtt;
+	} else {
+		return;
+	}
+	westwood_update_bdp(sk);
+}
+
+static __always_inline void westwood_fast_bw(struct sock *sk)
+{
+	const struct tcp_sock *tp = tcp_sk(sk);
+	struct westwood *w = inet_csk_ca(sk);
+
+	westwood_update_window(sk);
+
+	w->bk += tp->snd_una - w->snd_una;
+	w->snd_una = tp->snd_una;
+	update_rtt_min(sk);
+}
+
+/* cumul_ack for bk in case of delayed or partial acks */
+static __always_inline u32 westwood_acked_count(struct sock *sk)
+{
+	const struct tcp_sock *tp = tcp_sk(sk);
+	struct westwood *w = inet_csk_ca(sk);
+	u32 cumul_ack = tp->snd_una - w->snd_una;
+
+	/* If cumul_ack is 0 this is a dupack since it's not moving
+	 * tp->snd_una.
+	 */
+	if (!cumul_ack) {
+		w->accounted += tp->mss_cache;
+		return tp->mss_cache;
+	}
+
+	if (cumul_ack > tp->mss_cache && w->accounted) {
+		/* Partial or delayed ack */
+		if (w->accounted >= cumul_ack) {
+			w->accounted -= cumul_ack;
+			cumul_ack = tp->mss_cache;
+		} else {
+			cumul_ack -= w->accounted;
+			w->accounted = 0;
+		}
+	}
+
+	w->snd_una = tp->snd_una;
+
+	return cumul_ack;
+}
+
+static __always_inline u32 westwood_bw_rttmin(const struct sock *sk)
+{
+	const struct tcp_sock *tp = tcp_sk(sk);
+	const struct westwood *w = inet_csk_ca(sk);
+
+	return max(westwood_bdp(w, tp->mss_cache), 2U);
+}
+
+static __always_inline void westwood_update_ewr(struct westwood *w)
+{
+	u32 dmin, dmax;
+
+	if (w->dmin_avg != w->dmax_avg && w->dmax_avg != 0) {
+		w->ewr_mode = WESTWOOD_EWR_AVG;
+		dmin = w->dmin_avg;
+		dmax = w->dmax_avg;
+	} else if (w->delay_min != w->delay_max && w->delay_max != 0) {
+		w->ewr_mode = WESTWOOD_EWR_WINDOW;
+		dmin = w->delay_min;
+		dmax = w->delay_max;
+	} else {
+		w->ewr_mode = WESTWOOD_EWR_OFF;
+		return;
+	}
+
+	/* The averages are not ordered for sure, so dmin may exceed dmax */
+	if (dmin > dmax) {
+		w->ewr_mode = WESTWOOD_EWR_OFF;
+		return;
+	}
+
+	w->ewr_base = w->beta * (100 - (u32)((u64)100 * dmin / dmax));
+}
+
+/* As in tcp_westwoodlp.c, on every ACK at the cost of one compare */
+static __always_inline void westwood_update_delay_range(struct westwood *w)
+{
+	u32 rtt = w->rtt;
+
+	/* delay_min <= rtt <= delay_max, as delay_min <= delay_max */
+	if (rtt - w->delay_min <= w->delay_max - w->delay_min)
+		return;
+
+	/* No RTT sample yet */
+	if (rtt == TCP_WESTWOOD_INIT_RTT)
+		return;
+
+	/* Initialise delay_min and delay_max to rtt on first estimate */
+	if (w->delay_max == 0) {
+		w->delay_min = w->delay_max = rtt;
+		return;
+	}
+
+	if (rtt > w->delay_max)
+		w->delay_max = rtt;
+	else
+		w->delay_min = rtt;
+
+	if (w->ewr_mode != WESTWOOD_EWR_AVG)
+		westwood_update_ewr(w);
+}
+
+SEC("struct_ops/bpf_westwood_ack")
+void BPF_PROG(bpf_westwood_ack, struct sock *sk, u32 ack_flags)
+{
+	struct westwood *w = inet_csk_ca(sk);
+
+	if (ack_flags & CA_ACK_SLOWPATH) {
+		westwood_update_window(sk);
+		w->bk += westwood_acked_count(sk);
+
+		update_rtt_min(sk);
+	} else {
+		westwood_fast_bw(sk);
+	}
+	westwood_update_delay_range(w);
+}
+
+static __always_inline u32 westwood_rtt4(const struct westwood *w)
+{
+	/* Negate RTT as a factor if delay_loss has no value */
+	return w->delay_loss > 1 ? w->rtt << 2 : 0;
+}
+
+/* As westwood_ewr_exceeded(): queue * 100 * delay_loss >
+ * ewr_base * (delay_loss - rtt4), without dividing per ACK
+ */
+static __always_inline bool westwood_ewr_exceeded(const struct westwood *w,
+						  u32 cwnd, u32 acked)
+{
+	u32 queue_length, rtt4;
+
+	if (cwnd <= w->bdp)
+		return false;
+	/* As there, the RTT must show a queue beyond the ACK's delay too */
+	if (w->rtt <= w->rtt_min ||
+	    (u64)cwnd * (w->rtt - w->rtt_min) <
+	    (u64)(WESTWOOD_EWR_MIN_QUEUE + acked) * w->rtt)
+		return false;
+	queue_length = cwnd - w->bdp;
+
+	if ((u64)queue_length * 100 > w->ewr_base)
+		return true;
+
+	rtt4 = westwood_rtt4(w);
+	if (rtt4 >= w->delay_loss)
+		return true;
+
+	return (u64)queue_length * 100 * w->delay_loss >
+	       (u64)w->ewr_base * (w->delay_loss - rtt4);
+}
+
+SEC("struct_ops/bpf_westwood_cong_avoid")
+void BPF_PROG(bpf_westwood_cong_avoid, struct sock *sk, u32 ack, u32 acked)
+{
+	struct tcp_sock *tp = tcp_sk(sk);
+	struct westwood *w = inet_csk_ca(sk);
+	bool ewr = false;
+
+	/* Use delay_min and delay_max until the first EWR event */
+	if (w->ewr_mode == WESTWOOD_EWR_AVG ||
+	    (w->ewr_mode == WESTWOOD_EWR_WINDOW && !tcp_in_slow_start(tp)))
+		ewr = westwood_ewr_exceeded(w, tp->snd_cwnd, acked);
+
+	if (ewr) {
+		u32 cwnd = westwood_bw_rttmin(sk);
+
+		tp->snd_ssthresh = cwnd;
+		tp->snd_cwnd = cwnd;
+
+		/* Update min and max delay averages with values from this EWR window */
+		w->dmin_avg = westwood_update_delay(w->delay_min, w->dmin_avg);
+		w->dmax_avg = westwood_update_delay(w->delay_max, w->dmax_avg);
+
+		/* Current RTT becomes lowest and highest RTT observed */
+		w->delay_max = w->delay_min = w->rtt;
+		westwood_update_ewr(w);
+	} else {
+		tcp_reno_cong_avoid(sk, ack, acked);
+	}
+}
+
+SEC("struct_ops/bpf_westwood_event")
+void BPF_PROG(bpf_westwood_event, struct sock *sk, enum tcp_ca_event event)
+{
+	struct tcp_sock *tp = tcp_sk(sk);
+	struct westwood *w = inet_csk_ca(sk);
+
+	switch (event) {
+	case CA_EVENT_COMPLETE_CWR:
+		tp->snd_ssthresh = westwood_bw_rttmin(sk);
+		tp->snd_cwnd = tp->snd_ssthresh;
+		break;
+	case CA_EVENT_LOSS:
+		tp->snd_ssthresh = westwood_bw_rttmin(sk);
+		w->delay_loss = westwood_update_delay(w->rtt, w->delay_loss);
+		/* Update RTT_min when next ack arrives */
+		w->reset_rtt_min = 1;
+		break;
+	default:
+		/* don't care */
+		break;
+	}
+}
+
+SEC("struct_ops/bpf_westwood_ssthresh")
+u32 BPF_PROG(bpf_westwood_ssthresh, struct sock *sk)
+{
+	return tcp_reno_ssthresh(sk);
+}
+
+SEC("struct_ops/bpf_westwood_undo_cwnd")
+u32 BPF_PROG(bpf_westwood_undo_cwnd, struct sock *sk)
+{
+	return tcp_reno_undo_cwnd(sk);
+}
+
+SEC(".struct_ops")
+struct tcp_congestion_ops bpf_westwoodlp = {
+	.init		= (void *)bpf_westwood_init,
+	.ssthresh	= (void *)bpf_westwood_ssthresh,
+	.undo_cwnd	= (void *)bpf_westwood_undo_cwnd,
+	.cong_avoid	= (void *)bpf_westwood_cong_avoid,
+	.cwnd_event	= (void *)bpf_westwood_event,
+	.in_ack_event	= (void *)bpf_westwood_ack,
+	.pkts_acked	= (void *)bpf_westwood_pkts_acked,
+	.name		= "bpf_westwoodlp",
+};
@@ -0,0 +1,526 @@
+/*
+ * Userspace stand-in for the kernel API used by the congestion control
+ * modules, so that they build unmodified into the replay harness.
+ *
+ * Only what the modules use is provided, as kernels from 4.4 to 5.7 have
+ * it; LINUX_VERSION_CODE picks the version, 5.4 by default. Time is virtual and set by the
+ * driver (lbe_now_ns); jiffies, get_seconds() and ktime_get_ns() derive
+ * from it. The Reno helpers follow net/ipv4/tcp_cong.c.
+ */
+
+#ifndef _LBE_SHIM_H
+#define _LBE_SHIM_H
+
+#include <limits.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+typedef uint8_t u8;
+typedef uint16_t u16;
+typedef uint32_t u32;
+typedef uint64_t u64;
+typedef int8_t s8;
+typedef int16_t s16;
+typedef int32_t s32;
+typedef int64_t s64;
+typedef u8 __u8;
+typedef u16 __u16;
+typedef u32 __u32;
+typedef u64 __u64;
+typedef s32 __s32;
+
+/* As the kernel, so that module_param(x, bool, ...) finds param_ops_bool */
+typedef _Bool bool;
+enum { false = 0, true = 1 };
+#include <sys/types.h>	/* loff_t */
+
+#ifndef HZ
+#define HZ 1000
+#endif
+
+#ifndef KBUILD_MODNAME
+#define KBUILD_MODNAME "lbe"
+#endif
+
+#define KERNEL_VERSION(a, b, c) (((a) << 16) + ((b) << 8) + (c))
+#ifndef LINUX_VERSION_CODE
+#define LINUX_VERSION_CODE KERNEL_VERSION(5, 4, 0)
+#endif
+#if LINUX_VERSION_CODE < KERNEL_VERSION(4, 4, 0) || \
+    LINUX_VERSION_CODE >= KERNEL_VERSION(5, 8, 0)
+#error "the shim models the kernel API of 4.4 to 5.7"
+#endif
+
+/* The size of the congestion control area follows the version, as in
+ * include/net/inet_connection_sock.h: 64 bytes, 88 from 4.9, 104 from 5.1
+ */
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(5, 1, 0)
+#define ICSK_CA_PRIV_SIZE (13 * sizeof(u64))
+#elif LINUX_VERSION_CODE >= KERNEL_VERSION(4, 9, 0)
+#define ICSK_CA_PRIV_SIZE (11 * sizeof(u64))
+#else
+#define ICSK_CA_PRIV_SIZE (16 * sizeof(u32))
+#endif
+
+/* Annotations */
+#define __user
+#define __percpu
+#define __read_mostly
+#define __init
+#define __exit
+#define __net_init
+#define __net_exit
+#define likely(x)	__builtin_expect(!!(x), 1)
+#define unlikely(x)	__builtin_expect(!!(x), 0)
+#define READ_ONCE(x)	(x)
+#define WRITE_ONCE(x, v) ((x) = (v))
+
+#define BUILD_BUG_ON(c) _Static_assert(!(c), #c)
+#define ARRAY_SIZE(a) (sizeof(a) / sizeof((a)[0]))
+#define container_of(ptr, type, member) \
+	((type *)((char *)(ptr) - offsetof(type, member)))
+
+/* Module glue: init functions and parameters register themselves with
+ * constructors so the driver can run and tune them.
+ */
+#define THIS_MODULE NULL
+#define EXPORT_SYMBOL(x)
+#define EXPORT_SYMBOL_GPL(x)
+#define MODULE_AUTHOR(x)
+#define MODULE_LICENSE(x)
+#define MODULE_DESCRIPTION(x)
+#define MODULE_VERSION(x)
+#define MODULE_PARM_DESC(name, desc)
+
+void lbe_register_init(int (*fn)(void));
+
+#define module_init(fn)							\
+	static void __attribute__((constructor)) __lbe_init_##fn(void)	\
+	{ lbe_register_init(fn); }
+#define module_exit(fn)
+
+struct kernel_param {
+	const char *name;
+	void *arg;
+};
+
+struct kernel_param_ops {
+	int (*set)(const char *val, const struct kernel_param *kp);
+	int (*get)(char *buffer, const struct kernel_param *kp);
+};
+
+extern const struct kernel_param_ops param_ops_int;
+extern const struct kernel_param_ops param_ops_uint;
+extern const struct kernel_param_ops param_ops_bool;
+
+int param_set_int(const char *val, const struct kernel_param *kp);
+int param_get_int(char *buffer, const struct kernel_param *kp);
+int param_get_uint(char *buffer, const struct kernel_param *kp);
+
+void lbe_register_param(const char *mod, const char *name,
+			const struct kernel_param_ops *ops, void *arg);
+
+#define module_param_cb(name, ops, arg, perm)				\
+	static void __attribute__((constructor)) __lbe_param_##name(void) \
+	{ lbe_register_param(KBUILD_MODNAME, #name, ops, arg); }
+#define module_param_named(name, var, type, perm) \
+	module_param_cb(name, &param_ops_##type, &(var), perm)
+#define module_param(name, type, perm) module_param_named(name, name, type, perm)
+
+/* Arithmetic */
+#define min(a, b) ((a) < (b) ? (a) : (b))
+#define max(a, b) ((a) > (b) ? (a) : (b))
+#define min_t(t, a, b) min((t)(a), (t)(b))
+#define max_t(t, a, b) max((t)(a), (t)(b))
+#define clamp(v, l, h) min(max(v, l), h)
+#define clamp_t(t, v, l, h) clamp((t)(v), (t)(l), (t)(h))
+#define clamp_val(v, l, h) clamp_t(__typeof__(v), v, l, h)
+#define abs(x) ({ __typeof__(x) __x = (x); __x < 0 ? -__x : __x; })
+#define DIV_ROUND_UP(n, d) (((n) + (d) - 1) / (d))
+#define ilog2(n) (63 - __builtin_clzll(n))
+
+#define U8_MAX	0xff
+#define U16_MAX	0xffff
+#define U32_MAX	0xffffffffU
+#define S32_MAX	INT_MAX
+#define S32_MIN	INT_MIN
+
+#define do_div(n, base) ({				\
+	u32 __base = (base);				\
+	u32 __rem = (u64)(n) % __base;			\
+	(n) = (u64)(n) / __base;			\
+	__rem;						\
+})
+
+static inline u64 div_u64(u64 a, u32 b) { return a / b; }
+static inline s64 div_s64(s64 a, s32 b) { return a / b; }
+static inline u64 div64_u64(u64 a, u64 b) { return a / b; }
+static inline s64 div64_s64(s64 a, s64 b) { return a / b; }
+
+static inline u64 mul_u64_u32_shr(u64 a, u32 mul, unsigned int shift)
+{
+	return (u64)(((unsigned __int128)a * mul) >> shift);
+}
+
+#define cmpxchg(ptr, old, new) ({				\
+	__typeof__(*(ptr)) __old = (old);			\
+	__typeof__(*(ptr)) __cur = *(ptr);			\
+	if (__cur == __old)					\
+		*(ptr) = (new);					\
+	__cur;							\
+})
+
+/* Errors and allocation */
+#define EINVAL	22
+#define ENOMEM	12
+#define EEXIST	17
+#define GFP_KERNEL 0
+
+static inline void *kmalloc(size_t size, int flags) { return malloc(size); }
+static inline void *kzalloc(size_t size, int flags) { return calloc(1, size); }
+static inline void kfree(const void *p) { free((void *)p); }
+static inline void *kmemdup(const void *src, size_t len, int flags)
+{
+	void *p = malloc(len);
+
+	if (p)
+		memcpy(p, src, len);
+	return p;
+}
+
+int kstrtoint(const char *s, unsigned int base, int *res);
+
+#define pr_info(...)	do { } while (0)
+#define pr_warn(...)	do { } while (0)
+#define pr_debug(...)	do { } while (0)
+
+/* Time */
+#define NSEC_PER_USEC	1000L
+#define NSEC_PER_MSEC	1000000L
+#define NSEC_PER_SEC	1000000000L
+#define USEC_PER_MSEC	1000L
+#define USEC_PER_SEC	1000000L
+#define MSEC_PER_SEC	1000L
+
+extern u64 lbe_now_ns;
+
+#define jiffies ((unsigned long)(lbe_now_ns / (NSEC_PER_SEC / HZ)))
+
+static inline unsigned long get_seconds(void) { return lbe_now_ns / NSEC_PER_SEC; }
+static inline u64 ktime_get_ns(void) { return lbe_now_ns; }
+static inline unsigned int jiffies_to_usecs(unsigned long j) { return j * (USEC_PER_SEC / HZ); }
+static inline unsigned int jiffies_to_msecs(unsigned long j) { return j * (MSEC_PER_SEC / HZ); }
+static inline unsigned long usecs_to_jiffies(unsigned int u) { return (u + USEC_PER_SEC / HZ - 1) / (USEC_PER_SEC / HZ); }
+
+#define tcp_time_stamp ((u32)jiffies)
+
+/* Per-CPU data: a single CPU */
+#define DEFINE_PER_CPU(type, name) __typeof__(type) name
+#define this_cpu_inc(pcp) ((pcp)++)
+#define this_cpu_add(pcp, val) ((pcp) += (val))
+#define per_cpu(var, cpu) (*((void)(cpu), &(var)))
+#define for_each_possible_cpu(cpu) for ((cpu) = 0; (cpu) < 1; (cpu)++)
+
+/* Network namespaces: only init_net */
+struct proc_dir_entry;
+
+struct netns_ipv4 {
+	int sysctl_tcp_reordering;
+};
+
+struct net {
+	struct proc_dir_entry *proc_net;
+	struct netns_ipv4 ipv4;
+};
+
+extern struct net init_net;
+
+#define net_eq(a, b) ((a) == (b))
+
+struct pernet_operations {
+	int (*init)(struct net *net);
+	void (*exit)(struct net *net);
+	unsigned int *id;
+	size_t size;
+};
+
+int register_pernet_subsys(struct pernet_operations *ops);
+void unregister_pernet_subsys(struct pernet_operations *ops);
+void *net_generic(const struct net *net, unsigned int id);
+
+/* Sysctls, kept in a table the driver can write to */
+struct ctl_table;
+
+typedef int proc_handler(struct ctl_table *ctl, int write,
+			 void __user *buffer, size_t *lenp, loff_t *ppos);
+
+struct ctl_table {
+	const char *procname;
+	void *data;
+	int maxlen;
+	unsigned short mode;
+	proc_handler *proc_handler;
+	void *extra1;
+	void *extra2;
+};
+
+struct ctl_table_header {
+	struct ctl_table *ctl_table_arg;
+	const char *path;
+	struct ctl_table_header *next;
+};
+
+struct ctl_table_header *register_net_sysctl(struct net *net, const char *path,
+					     struct ctl_table *table);
+void unregister_net_sysctl_table(struct ctl_table_header *header);
+int proc_dointvec_minmax(struct ctl_table *table, int write,
+			 void __user *buffer, size_t *lenp, loff_t *ppos);
+
+/* /proc/net files, printed by the driver on request */
+struct seq_file;
+struct inode;
+struct file;
+
+struct file_operations {
+	void *owner;
+	int (*open)(struct inode *inode, struct file *file);
+	long (*read)(struct file *file, char *buf, size_t len, loff_t *ppos);
+	loff_t (*llseek)(struct file *file, loff_t off, int whence);
+	int (*release)(struct inode *inode, struct file *file);
+};
+
+int seq_printf(struct seq_file *seq, const char *fmt, ...)
+	__attribute__((format(printf, 2, 3)));
+int single_open(struct file *file, int (*show)(struct seq_file *, void *),
+		void *data);
+int single_release(struct inode *inode, struct file *file);
+long seq_read(struct file *file, char *buf, size_t len, loff_t *ppos);
+loff_t seq_lseek(struct file *file, loff_t off, int whence);
+
+struct proc_dir_entry *proc_create_data(const char *name, unsigned short mode,
+					struct proc_dir_entry *parent,
+					const struct file_operations *fops,
+					void *data);
+void *PDE_DATA(const struct inode *inode);
+void remove_proc_entry(const char *name, struct proc_dir_entry *parent);
+
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(4, 18, 0)
+struct proc_dir_entry *proc_create_single(const char *name, unsigned short mode,
+					  struct proc_dir_entry *parent,
+					  int (*show)(struct seq_file *, void *));
+#endif
+
+/* Tracepoints compile away */
+#define TP_PROTO(...)	__VA_ARGS__
+#define TP_ARGS(...)	__VA_ARGS__
+#define TRACE_EVENT(name, proto, args, tstruct, assign, print)		\
+	static inline void trace_##name(proto) { }			\
+	static inline bool trace_##name##_enabled(void) { return false; }
+#define DECLARE_EVENT_CLASS(name, proto, args, tstruct, assign, print)
+#define DEFINE_EVENT(template, name, proto, args)			\
+	static inline void trace_##name(proto) { }			\
+	static inline bool trace_##name##_enabled(void) { return false; }
+#define EXPORT_TRACEPOINT_SYMBOL_GPL(name)
+
+/* TCP */
+#define before(seq1, seq2)	((s32)((seq1) - (seq2)) < 0)
+#define after(seq2, seq1)	before(seq1, seq2)
+
+enum {
+	TCP_CA_Open,
+	TCP_CA_Disorder,
+	TCP_CA_CWR,
+	TCP_CA_Recovery,
+	TCP_CA_Loss,
+};
+
+enum tcp_ca_event {
+	CA_EVENT_TX_START,
+	CA_EVENT_CWND_RESTART,
+	CA_EVENT_COMPLETE_CWR,
+	CA_EVENT_LOSS,
+	CA_EVENT_ECN_NO_CE,
+	CA_EVENT_ECN_IS_CE,
+};
+
+enum tcp_ca_ack_event_flags {
+	CA_ACK_SLOWPATH		= (1 << 0),
+	CA_ACK_WIN_UPDATE	= (1 << 1),
+	CA_ACK_ECE		= (1 << 2),
+};
+
+enum sk_pacing {
+	SK_PACING_NONE,
+	SK_PACING_NEEDED,
+	SK_PACING_FQ,
+};
+
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(4, 13, 0)
+#define TCP_TS_HZ	1000
+#endif
+
+struct tcp_options_received {
+	u32 rcv_tsval;
+	u32 rcv_tsecr;
+};
+
+struct tcp_sock {
+	u32 snd_una;
+	u32 snd_nxt;
+	u32 snd_cwnd;
+	u32 snd_cwnd_cnt;
+	u32 snd_cwnd_clamp;
+	u32 snd_ssthresh;
+	u32 packets_out;
+	u32 max_packets_out;
+	u32 mss_cache;
+	u32 advmss;
+	u32 srtt_us;		/* smoothed RTT << 3, in usec */
+	u32 rtt_min;		/* minimum RTT in usec, ~0U before the first */
+	u32 reordering;
+	u32 prior_cwnd;		/* PRR, not modelled: always 0 */
+	u32 prr_delivered;
+	u32 prr_out;
+	u8 is_cwnd_limited;
+	struct tcp_options_received rx_opt;
+};
+
+struct inet_sock {
+	u16 inet_sport;
+	u16 inet_dport;
+};
+
+struct tcpvegas_info {
+	u32 tcpv_enabled;
+	u32 tcpv_rttcnt;
+	u32 tcpv_rtt;
+	u32 tcpv_minrtt;
+};
+
+union tcp_cc_info {
+	struct tcpvegas_info vegas;
+};
+
+#define INET_DIAG_VEGASINFO 3
+
+struct sock;
+
+#define TCP_CONG_NEEDS_ECN	0x2
+
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(4, 7, 0)
+struct ack_sample {
+	u32 pkts_acked;
+	s32 rtt_us;
+	u32 in_flight;
+};
+#endif
+
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(4, 9, 0)
+/* What the modules read of the stack's rate sample (tcp_rate.c) */
+struct rate_sample {
+	s32 delivered;		/* packets delivered over interval_us */
+	long interval_us;	/* -1 when there is no sample */
+	long rtt_us;
+	u32 acked_sacked;	/* packets newly ACKed or SACKed */
+	bool is_app_limited;
+};
+#endif
+
+struct tcp_congestion_ops {
+	u32 (*ssthresh)(struct sock *sk);
+	void (*cong_avoid)(struct sock *sk, u32 ack, u32 acked);
+	void (*set_state)(struct sock *sk, u8 new_state);
+	void (*cwnd_event)(struct sock *sk, enum tcp_ca_event ev);
+	void (*in_ack_event)(struct sock *sk, u32 flags);
+	u32 (*undo_cwnd)(struct sock *sk);
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(4, 7, 0)
+	void (*pkts_acked)(struct sock *sk, const struct ack_sample *sample);
+#else
+	void (*pkts_acked)(struct sock *sk, u32 num_acked, s32 rtt_us);
+#endif
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(4, 9, 0)
+	void (*cong_control)(struct sock *sk, const struct rate_sample *rs);
+#endif
+	size_t (*get_info)(struct sock *sk, u32 ext, int *attr,
+			   union tcp_cc_info *info);
+	void (*init)(struct sock *sk);
+	void (*release)(struct sock *sk);
+	u32 flags;
+	const char *name;
+	void *owner;
+	struct tcp_congestion_ops *next;
+};
+
+struct sock {
+	struct tcp_sock tp;
+	struct inet_sock inet;
+	struct net *net;
+	const struct tcp_congestion_ops *icsk_ca_ops;
+	u8 icsk_ca_state;
+	unsigned long sk_pacing_rate;
+	unsigned long sk_max_pacing_rate;
+	u32 sk_pacing_status;
+	u64 icsk_ca_priv[ICSK_CA_PRIV_SIZE / sizeof(u64)];
+};
+
+static inline struct tcp_sock *tcp_sk(const struct sock *sk)
+{
+	return (struct tcp_sock *)&sk->tp;
+}
+
+static inline struct inet_sock *inet_sk(const struct sock *sk)
+{
+	return (struct inet_sock *)&sk->inet;
+}
+
+static inline void *inet_csk_ca(const struct sock *sk)
+{
+	return (void *)sk->icsk_ca_priv;
+}
+
+static inline struct net *sock_net(const struct sock *sk)
+{
+	return sk->net;
+}
+
+static inline bool tcp_in_slow_start(const struct tcp_sock *tp)
+{
+	return tp->snd_cwnd < tp->snd_ssthresh;
+}
+
+static inline bool tcp_in_cwnd_reduction(const struct sock *sk)
+{
+	return sk->icsk_ca_state == TCP_CA_CWR ||
+	       sk->icsk_ca_state == TCP_CA_Recovery;
+}
+
+/* Nothing is SACKed, lost or retransmitted in a replay */
+static inline u32 tcp_packets_in_flight(const struct tcp_sock *tp)
+{
+	return tp->packets_out;
+}
+
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(4, 6, 0)
+static inline u32 tcp_min_rtt(const struct tcp_sock *tp)
+{
+	return tp->rtt_min;
+}
+#endif
+
+bool tcp_is_cwnd_limited(const struct sock *sk);
+u32 tcp_slow_start(struct tcp_sock *tp, u32 acked);
+void tcp_cong_avoid_ai(struct tcp_sock *tp, u32 w, u32 acked);
+void tcp_reno_cong_avoid(struct sock *sk, u32 ack, u32 acked);
+u32 tcp_reno_ssthresh(struct sock *sk);
+u32 tcp_current_ssthresh(const struct sock *sk);
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(4, 13, 0)
+u32 tcp_reno_undo_cwnd(struct sock *sk);
+#endif
+
+int tcp_register_congestion_control(struct tcp_congestion_ops *ca);
+void tcp_unregister_congestion_control(struct tcp_congestion_ops *ca);
+struct tcp_congestion_ops *lbe_find_congestion_control(const char *name);
+
+#endif /* _LBE_SHIM_H */
@@ -0,0 +1,2 @@
+/* replay harness stand-in, see lbe_shim.h */
+#include "lbe_shim.h"
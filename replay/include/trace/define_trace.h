@@ -0,0 +1 @@
+/* replay harness stand-in: tracepoints compile away, see lbe_shim.h */
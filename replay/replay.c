@@ -0,0 +1,847 @@
+/*
+ * Replay driver and microbenchmark for the congestion control modules
+ *
+ * Feeds a sequence of ACK, loss and restart events to one congestion
+ * control, through the same hooks and in the same order as tcp_ack()
+ * and the loss recovery code, and reports the resulting window and the
+ * CPU cost per ACK. The events come from a trace file, or from a
+ * closed-loop model of a single bottleneck link.
+ *
+ * Trace files hold one event per line, '#' starts a comment:
+ *   a <t_us> <acked> <rtt_us> <tsval> <tsecr> [s][e]	ACK of <acked> packets
+ *	(0 for a duplicate ACK), RTT sample or -1, TCP timestamps, and
+ *	optionally the slow path and ECE flags
+ *   r <t_us>	fast retransmit, entering recovery
+ *   l <t_us>	retransmission timeout
+ *   i <t_us>	transmission restarting after idle
+ * Time is relative to the start of the trace. The local timestamp clock
+ * (tsecr) runs at the HZ the harness is built with.
+ *
+ * Congestion controls with cong_control() get a rate sample on every
+ * ACK, the packets delivered between the last ACK before the acked data
+ * was sent, now less its RTT, and now, as tcp_rate.c measures it without
+ * the send-side interval.
+ */
+
+#include <errno.h>
+#include <getopt.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "lbe_shim.h"
+#include "replay.h"
+
+#define TCP_INFINITE_SSTHRESH	0x7fffffff
+#define LBE_INIT_CWND		10
+#define LBE_REMOTE_HZ		1000
+
+/* The virtual clock starts well after the epoch, as on a real host */
+#define LBE_EPOCH_NS		(1000000ULL * NSEC_PER_SEC)
+
+enum {
+	EV_ACK		= 'a',
+	EV_RECOVERY	= 'r',
+	EV_LOSS		= 'l',
+	EV_RESTART	= 'i',
+};
+
+struct lbe_event {
+	u64 t_us;
+	u32 acked;
+	s32 rtt_us;
+	u32 tsval;
+	u32 tsecr;
+	u8 type;
+	u8 flags;
+};
+
+struct lbe_trace {
+	struct lbe_event *ev;
+	size_t n;
+	size_t size;
+};
+
+/* Packets delivered as of an ACK, for the rate samples */
+struct lbe_delivery {
+	u64 t_us;
+	u64 delivered;
+};
+
+struct lbe_conn {
+	struct sock sk;
+	const struct tcp_congestion_ops *ca;
+	u32 high_seq;		/* snd_nxt when CWR, recovery or loss began */
+	u64 delivered;
+	struct lbe_delivery *dh;	/* ACKs of the last RTT, oldest at dh_head */
+	size_t dh_size;
+	size_t dh_head;
+	size_t dh_len;
+	u64 acks;
+	u64 cwnd_sum;
+	u32 recoveries;
+	u32 cwrs;
+	u32 rtos;
+	u64 hash;		/* FNV-1a of the cwnd/ssthresh sequence */
+	FILE *log;
+};
+
+static u32 lbe_mss = 1448;
+
+static void trace_add(struct lbe_trace *tr, const struct lbe_event *ev)
+{
+	if (tr->n == tr->size) {
+		tr->size = tr->size ? 2 * tr->size : 4096;
+		tr->ev = realloc(tr->ev, tr->size * sizeof(*tr->ev));
+		if (!tr->ev) {
+			perror("realloc");
+			exit(1);
+		}
+	}
+	tr->ev[tr->n++] = *ev;
+}
+
+static int trace_read(struct lbe_trace *tr, const char *path)
+{
+	FILE *f = strcmp(path, "-") ? fopen(path, "r") : stdin;
+	char line[256];
+	int lineno = 0;
+
+	if (!f) {
+		perror(path);
+		return -1;
+	}
+
+	while (fgets(line, sizeof(line), f)) {
+		struct lbe_event ev = { .rtt_us = -1 };
+		unsigned long long t;
+		char type, fl[4] = "";
+		int n;
+
+		lineno++;
+		if (line[0] == '#' || line[0] == '\n')
+			continue;
+
+		n = sscanf(line, "%c %llu %u %d %u %u %3s", &type, &t,
+			   &ev.acked, &ev.rtt_us, &ev.tsval, &ev.tsecr, fl);
+		if (n < 2 || (type == EV_ACK && n < 6) ||
+		    !strchr("arli", type)) {
+			fprintf(stderr, "%s:%d: bad event\n", path, lineno);
+			return -1;
+		}
+		ev.type = type;
+		ev.t_us = t;
+		if (strchr(fl, 's'))
+			ev.flags |= CA_ACK_SLOWPATH;
+		if (strchr(fl, 'e'))
+			ev.flags |= CA_ACK_ECE;
+		trace_add(tr, &ev);
+	}
+
+	if (f != stdin)
+		fclose(f);
+	return 0;
+}
+
+static void trace_write_event(FILE *f, const struct lbe_event *ev)
+{
+	if (ev->type != EV_ACK) {
+		fprintf(f, "%c %llu\n", ev->type, (unsigned long long)ev->t_us);
+		return;
+	}
+	fprintf(f, "a %llu %u %d %u %u%s%s%s\n", (unsigned long long)ev->t_us,
+		ev->acked, ev->rtt_us, ev->tsval, ev->tsecr,
+		ev->flags ? " " : "",
+		ev->flags & CA_ACK_SLOWPATH ? "s" : "",
+		ev->flags & CA_ACK_ECE ? "e" : "");
+}
+
+static void conn_set_state(struct lbe_conn *c, u8 state)
+{
+	if (c->ca->set_state)
+		c->ca->set_state(&c->sk, state);
+	c->sk.icsk_ca_state = state;
+}
+
+static void conn_event(struct lbe_conn *c, enum tcp_ca_event ev)
+{
+	if (c->ca->cwnd_event)
+		c->ca->cwnd_event(&c->sk, ev);
+}
+
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(4, 9, 0)
+static void conn_delivered(struct lbe_conn *c, u64 t_us)
+{
+	if (c->dh_len == c->dh_size) {
+		size_t i, nsize = c->dh_size ? 2 * c->dh_size : 1024;
+		struct lbe_delivery *n = malloc(nsize * sizeof(*n));
+
+		if (!n) {
+			perror("malloc");
+			exit(1);
+		}
+		for (i = 0; i < c->dh_len; i++)
+			n[i] = c->dh[(c->dh_head + i) % c->dh_size];
+		free(c->dh);
+		c->dh = n;
+		c->dh_size = nsize;
+		c->dh_head = 0;
+	}
+	c->dh[(c->dh_head + c->dh_len++) % c->dh_size] =
+		(struct lbe_delivery){ .t_us = t_us, .delivered = c->delivered };
+}
+
+/* The rate sample of an ACK, see the top of the file. The history starts
+ * with the connection, as tp->delivered_mstamp does with the first send.
+ */
+static void conn_rate_sample(struct lbe_conn *c, const struct lbe_event *ev,
+			     struct rate_sample *rs)
+{
+	const struct lbe_delivery *prior;
+	u64 sent;
+
+	memset(rs, 0, sizeof(*rs));
+	rs->acked_sacked = ev->acked;
+	rs->rtt_us = ev->rtt_us;
+	rs->delivered = -1;
+	rs->interval_us = -1;
+	if (ev->rtt_us < 0 || !c->dh_len)
+		return;
+
+	sent = ev->t_us > (u64)ev->rtt_us ? ev->t_us - ev->rtt_us : 0;
+	while (c->dh_len > 1 &&
+	       c->dh[(c->dh_head + 1) % c->dh_size].t_us <= sent) {
+		c->dh_head = (c->dh_head + 1) % c->dh_size;
+		c->dh_len--;
+	}
+	prior = &c->dh[c->dh_head];
+	if (prior->t_us > sent)
+		return;
+	rs->delivered = c->delivered - prior->delivered;
+	rs->interval_us = ev->t_us - prior->t_us;
+}
+#endif
+
+static void conn_init(struct lbe_conn *c, const struct tcp_congestion_ops *ca,
+		      FILE *log)
+{
+	struct tcp_sock *tp = tcp_sk(&c->sk);
+
+	memset(c, 0, sizeof(*c));
+	c->ca = ca;
+	c->log = log;
+	c->hash = 0xcbf29ce484222325ULL;
+
+	c->sk.net = &init_net;
+	c->sk.icsk_ca_ops = ca;
+	c->sk.icsk_ca_state = TCP_CA_Open;
+	c->sk.sk_pacing_rate = ~0UL;
+	c->sk.sk_max_pacing_rate = ~0UL;
+
+	tp->snd_cwnd = LBE_INIT_CWND;
+	tp->snd_ssthresh = TCP_INFINITE_SSTHRESH;
+	tp->snd_cwnd_clamp = ~0U;
+	tp->reordering = init_net.ipv4.sysctl_tcp_reordering;
+	tp->mss_cache = lbe_mss;
+	tp->advmss = lbe_mss;
+	tp->snd_una = tp->snd_nxt = 1;
+	tp->is_cwnd_limited = 1;
+	tp->rtt_min = ~0U;
+
+	lbe_now_ns = LBE_EPOCH_NS;
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(4, 9, 0)
+	if (ca->cong_control)
+		conn_delivered(c, 0);
+#endif
+	if (ca->init)
+		ca->init(&c->sk);
+}
+
+static void conn_release(struct lbe_conn *c)
+{
+	if (c->ca->release)
+		c->ca->release(&c->sk);
+	free(c->dh);
+	c->dh = NULL;
+}
+
+static void conn_sent(struct lbe_conn *c, u32 pkts)
+{
+	struct tcp_sock *tp = tcp_sk(&c->sk);
+
+	/* As __tcp_transmit_skb(), when nothing is in flight. Lost segments
+	 * are not retransmitted here and leave snd_una behind, so once there
+	 * was a loss only the idle restarts of a trace raise it.
+	 */
+	if (pkts && !tp->packets_out && tp->snd_una == tp->snd_nxt)
+		conn_event(c, CA_EVENT_TX_START);
+	tp->packets_out += pkts;
+	tp->snd_nxt += pkts * tp->mss_cache;
+	tp->max_packets_out = tp->packets_out;
+	tp->is_cwnd_limited = tp->packets_out >= tp->snd_cwnd;
+}
+
+static void conn_log(struct lbe_conn *c, u64 t_us)
+{
+	const struct tcp_sock *tp = tcp_sk(&c->sk);
+	u32 v[2] = { tp->snd_cwnd, tp->snd_ssthresh };
+	const u8 *p = (const u8 *)v;
+	size_t i;
+
+	for (i = 0; i < sizeof(v); i++) {
+		c->hash ^= p[i];
+		c->hash *= 0x100000001b3ULL;
+	}
+
+	if (c->log)
+		fprintf(c->log, "%llu %u %u %u %u\n", (unsigned long long)t_us,
+			tp->snd_cwnd, tp->snd_ssthresh, tp->packets_out,
+			c->sk.icsk_ca_state);
+}
+
+static void conn_cwr(struct lbe_conn *c);
+
+/* As tcp_ack(): in_ack_event, RTT and pkts_acked, the end of CWR or
+ * recovery, CWR on ECE if the congestion control negotiates ECN, and
+ * finally cong_avoid, if the window may grow.
+ */
+static void conn_ack(struct lbe_conn *c, const struct lbe_event *ev)
+{
+	struct sock *sk = &c->sk;
+	struct tcp_sock *tp = tcp_sk(sk);
+	u32 flags = ev->flags;
+
+	tp->rx_opt.rcv_tsval = ev->tsval;
+	tp->rx_opt.rcv_tsecr = ev->tsecr;
+
+	if (!ev->acked)
+		flags |= CA_ACK_SLOWPATH;
+	if (c->ca->in_ack_event)
+		c->ca->in_ack_event(sk, flags);
+
+	tp->snd_una += ev->acked * tp->mss_cache;
+	if (after(tp->snd_una, tp->snd_nxt))
+		tp->snd_nxt = tp->snd_una;
+	tp->packets_out -= min(ev->acked, tp->packets_out);
+
+	if (ev->rtt_us >= 0) {
+		if (!tp->srtt_us)
+			tp->srtt_us = ev->rtt_us << 3;
+		else
+			tp->srtt_us += ev->rtt_us - (tp->srtt_us >> 3);
+		tp->rtt_min = min(tp->rtt_min, (u32)ev->rtt_us);
+	}
+	if (ev->acked && c->ca->pkts_acked) {
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(4, 7, 0)
+		const struct ack_sample sample = {
+			.pkts_acked	= ev->acked,
+			.rtt_us		= ev->rtt_us,
+			.in_flight	= tp->packets_out,
+		};
+
+		c->ca->pkts_acked(sk, &sample);
+#else
+		c->ca->pkts_acked(sk, ev->acked, ev->rtt_us);
+#endif
+	}
+	c->delivered += ev->acked;
+
+	if (sk->icsk_ca_state != TCP_CA_Open && !before(tp->snd_una, c->high_seq)) {
+		if (sk->icsk_ca_state == TCP_CA_CWR ||
+		    sk->icsk_ca_state == TCP_CA_Recovery) {
+			tp->snd_cwnd = tp->snd_ssthresh;
+			conn_event(c, CA_EVENT_COMPLETE_CWR);
+		}
+		conn_set_state(c, TCP_CA_Open);
+	}
+
+	if ((flags & CA_ACK_ECE) && (c->ca->flags & TCP_CONG_NEEDS_ECN))
+		conn_cwr(c);
+
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(4, 9, 0)
+	if (c->ca->cong_control) {
+		struct rate_sample rs;
+
+		conn_rate_sample(c, ev, &rs);
+		c->ca->cong_control(sk, &rs);
+		if (ev->acked)
+			conn_delivered(c, ev->t_us);
+	} else
+#endif
+	/* No growth while the window is being reduced */
+	if (ev->acked && !tcp_in_cwnd_reduction(sk))
+		c->ca->cong_avoid(sk, tp->snd_una, ev->acked);
+
+	c->acks++;
+	c->cwnd_sum += tp->snd_cwnd;
+	conn_log(c, ev->t_us);
+}
+
+/* As tcp_enter_cwr(), once per window; as for recovery, PRR is not
+ * modelled and cwnd drops at once
+ */
+static void conn_cwr(struct lbe_conn *c)
+{
+	struct tcp_sock *tp = tcp_sk(&c->sk);
+
+	if (c->sk.icsk_ca_state != TCP_CA_Open)
+		return;
+
+	tp->snd_ssthresh = c->ca->ssthresh(&c->sk);
+	c->high_seq = tp->snd_nxt;
+	conn_set_state(c, TCP_CA_CWR);
+	tp->snd_cwnd = min(tp->snd_cwnd, tp->snd_ssthresh);
+	c->cwrs++;
+}
+
+/* As tcp_enter_recovery(); PRR is not modelled, cwnd drops at once */
+static void conn_recovery(struct lbe_conn *c, const struct lbe_event *ev)
+{
+	struct tcp_sock *tp = tcp_sk(&c->sk);
+
+	if (c->sk.icsk_ca_state == TCP_CA_Recovery ||
+	    c->sk.icsk_ca_state == TCP_CA_Loss)
+		return;
+
+	tp->snd_ssthresh = c->ca->ssthresh(&c->sk);
+	c->high_seq = tp->snd_nxt;
+	conn_set_state(c, TCP_CA_Recovery);
+	tp->snd_cwnd = min(tp->snd_cwnd, tp->snd_ssthresh);
+	c->recoveries++;
+	conn_log(c, ev->t_us);
+}
+
+/* As tcp_enter_loss() */
+static void conn_loss(struct lbe_conn *c, const struct lbe_event *ev)
+{
+	struct tcp_sock *tp = tcp_sk(&c->sk);
+
+	tp->snd_ssthresh = c->ca->ssthresh(&c->sk);
+	conn_event(c, CA_EVENT_LOSS);
+	tp->snd_cwnd = 1;
+	tp->snd_cwnd_cnt = 0;
+	tp->packets_out = 0;
+	c->high_seq = tp->snd_nxt;
+	conn_set_state(c, TCP_CA_Loss);
+	c->rtos++;
+	conn_log(c, ev->t_us);
+}
+
+static void conn_process(struct lbe_conn *c, const struct lbe_event *ev)
+{
+	lbe_now_ns = LBE_EPOCH_NS + ev->t_us * NSEC_PER_USEC;
+
+	switch (ev->type) {
+	case EV_ACK:
+		conn_ack(c, ev);
+		break;
+	case EV_RECOVERY:
+		conn_recovery(c, ev);
+		break;
+	case EV_LOSS:
+		conn_loss(c, ev);
+		break;
+	case EV_RESTART:
+		conn_event(c, CA_EVENT_TX_START);
+		break;
+	}
+}
+
+/* Open loop: the sender always fills the window */
+static void replay(struct lbe_conn *c, const struct lbe_trace *tr)
+{
+	struct tcp_sock *tp = tcp_sk(&c->sk);
+	size_t i;
+
+	for (i = 0; i < tr->n; i++) {
+		conn_process(c, &tr->ev[i]);
+		if (tp->packets_out < tp->snd_cwnd)
+			conn_sent(c, tp->snd_cwnd - tp->packets_out);
+	}
+}
+
+/*
+ * Closed-loop model of one flow through a FIFO bottleneck of rate Mbit/s
+ * with a buffer of that many packets and a base RTT split evenly either
+ * side of it. The receiver sits right after the bottleneck and ACKs every
+ * packet, or every ACK_EVERY packets that arrive back to back, as with GRO
+ * or delayed ACKs; a packet arriving to a full buffer is dropped, and the drop is
+ * detected by duplicate ACKs once the next packet is through. Sending
+ * honours cwnd, and sk_pacing_rate once the congestion control asks for
+ * pacing through sk_pacing_status. With nothing in flight and the
+ * window closed, the connection waits for a retransmission timeout.
+ *
+ * With MARK_PKTS, packets of a flow that negotiates ECN are CE marked when
+ * they arrive to a backlog of at least that many packets, as with DCTCP's
+ * step marking. The receiver echoes the marks exactly, as DCTCP receivers
+ * do: an ACK has ECE if the packets it covers were marked, and a change of
+ * mark ends it.
+ */
+struct lbe_link {
+	u64 tx_ns;		/* serialisation time of one packet */
+	u64 owd_ns;		/* propagation delay each way */
+	u32 buffer;
+	u32 ack_every;		/* packets per ACK at most */
+	u32 mark;		/* ECN marking threshold in packets, 0 for none */
+	u64 duration_ns;
+};
+
+struct lbe_pkt {
+	u64 send_ns;
+	u64 depart_ns;
+	u32 tsecr;
+	bool ce;
+};
+
+struct lbe_link_stats {
+	u64 delivered;
+	u64 dropped;
+	u64 queue_delay_sum_ns;
+	u64 queue_delay_max_ns;
+};
+
+static int parse_link(struct lbe_link *l, const char *spec)
+{
+	double mbps, rtt_ms, secs;
+	unsigned int buffer, ack_every = 1, mark = 0;
+
+	if (sscanf(spec, "%lf,%lf,%u,%lf,%u,%u", &mbps, &rtt_ms, &buffer, &secs,
+		   &ack_every, &mark) < 4 ||
+	    mbps <= 0 || rtt_ms <= 0 || !buffer || secs <= 0 || !ack_every)
+		return -1;
+
+	l->tx_ns = lbe_mss * 8 * 1000.0 / mbps;
+	if (!l->tx_ns)
+		l->tx_ns = 1;
+	l->owd_ns = rtt_ms * NSEC_PER_MSEC / 2;
+	l->buffer = buffer;
+	l->ack_every = ack_every;
+	l->mark = mark;
+	l->duration_ns = secs * NSEC_PER_SEC;
+	return 0;
+}
+
+static void simulate(struct lbe_conn *c, const struct lbe_link *l,
+		     struct lbe_trace *rec, struct lbe_link_stats *st)
+{
+	struct tcp_sock *tp = tcp_sk(&c->sk);
+	struct lbe_pkt *q = NULL;
+	size_t qsize = 0, head = 0, len = 0;
+	u64 now = 0, last_depart = 0, next_send = 0, loss_at = 0;
+	u32 lost_unseen = 0, unacked = 0;
+	struct lbe_pkt first = { 0 };
+	u32 mark = c->ca->flags & TCP_CONG_NEEDS_ECN ? l->mark : 0;
+
+	memset(st, 0, sizeof(*st));
+
+	while (now < l->duration_ns) {
+		struct lbe_event ev = { .rtt_us = -1 };
+		u64 next = ~0ULL;
+		bool pacing;
+
+		/* Send what the window and pacing allow */
+		lbe_now_ns = LBE_EPOCH_NS + now;
+		pacing = c->sk.sk_pacing_status != SK_PACING_NONE;
+		while (tp->packets_out < tp->snd_cwnd &&
+		       (!pacing || next_send <= now)) {
+			u64 arrive = now + l->owd_ns;
+			u64 backlog = last_depart > arrive ?
+				      (last_depart - arrive) / l->tx_ns : 0;
+
+			if (backlog >= l->buffer) {
+				st->dropped++;
+				lost_unseen++;
+				if (!loss_at)
+					loss_at = last_depart + l->tx_ns + l->owd_ns;
+			} else {
+				struct lbe_pkt *p;
+
+				if (len == qsize) {
+					size_t i, nsize = qsize ? 2 * qsize : 1024;
+					struct lbe_pkt *nq = malloc(nsize * sizeof(*nq));
+
+					if (!nq) {
+						perror("malloc");
+						exit(1);
+					}
+					for (i = 0; i < len; i++)
+						nq[i] = q[(head + i) % qsize];
+					free(q);
+					q = nq;
+					qsize = nsize;
+					head = 0;
+				}
+				p = &q[(head + len++) % qsize];
+				p->send_ns = now;
+				p->depart_ns = max(arrive, last_depart) + l->tx_ns;
+				p->tsecr = tcp_time_stamp;
+				p->ce = mark && backlog >= mark;
+				last_depart = p->depart_ns;
+			}
+			conn_sent(c, 1);
+
+			if (pacing) {
+				u64 rate = max(c->sk.sk_pacing_rate, 1UL);
+
+				next_send = max(next_send, now) +
+					    tp->mss_cache * NSEC_PER_SEC / rate;
+			}
+		}
+
+		/* Next event: ACK, loss detection, pacing timer or RTO */
+		if (len)
+			next = q[head].depart_ns + l->owd_ns;
+		if (loss_at && loss_at < next)
+			next = loss_at;
+		if (pacing && tp->packets_out < tp->snd_cwnd && next_send < next)
+			next = next_send;
+		if (next == ~0ULL) {
+			u64 rto = max((u64)(tp->srtt_us >> 3) * 2 * NSEC_PER_USEC,
+				      200 * NSEC_PER_MSEC);
+
+			now += rto;
+			ev.type = EV_LOSS;
+			ev.t_us = now / NSEC_PER_USEC;
+			lost_unseen = 0;
+			conn_process(c, &ev);
+			if (rec)
+				trace_add(rec, &ev);
+			continue;
+		}
+		now = next;
+		if (len && q[head].depart_ns + l->owd_ns == now) {
+			const struct lbe_pkt *p = &q[head];
+			u64 qd = p->depart_ns - p->send_ns - l->owd_ns - l->tx_ns;
+
+			head = (head + 1) % qsize;
+			len--;
+			st->delivered++;
+			st->queue_delay_sum_ns += qd;
+			st->queue_delay_max_ns = max(st->queue_delay_max_ns, qd);
+
+			/* The RTT and echoed timestamp are the oldest
+			 * segment's, the peer's timestamp the newest's
+			 */
+			if (!unacked++)
+				first = *p;
+			if (unacked < l->ack_every && len &&
+			    q[head].depart_ns == p->depart_ns + l->tx_ns &&
+			    q[head].ce == p->ce)
+				continue;
+
+			ev.type = EV_ACK;
+			if (p->ce)
+				ev.flags |= CA_ACK_ECE;
+			ev.acked = unacked;
+			ev.rtt_us = (now - first.send_ns) / NSEC_PER_USEC;
+			ev.tsval = p->depart_ns / (NSEC_PER_SEC / LBE_REMOTE_HZ) + 1;
+			ev.tsecr = first.tsecr;
+			unacked = 0;
+		} else if (loss_at == now) {
+			ev.type = EV_RECOVERY;
+			tp->packets_out -= min(lost_unseen, tp->packets_out);
+			lost_unseen = 0;
+			loss_at = 0;
+		} else {
+			continue;	/* pacing timer */
+		}
+		ev.t_us = now / NSEC_PER_USEC;
+		conn_process(c, &ev);
+		if (rec)
+			trace_add(rec, &ev);
+	}
+
+	free(q);
+}
+
+static double elapsed_ns(const struct timespec *a, const struct timespec *b)
+{
+	return (b->tv_sec - a->tv_sec) * 1e9 + (b->tv_nsec - a->tv_nsec);
+}
+
+static void usage(const char *prog)
+{
+	fprintf(stderr,
+		"usage: %s -a ALGO (-t TRACE | -g MBPS,RTT_MS,BUFFER_PKTS,SECONDS) [options]\n"
+		"  -a ALGO        congestion control: ledbat, apledbat, ledbatpp, nice, westwoodlp, reno\n"
+		"  -t TRACE       replay the events of TRACE ('-' for stdin)\n"
+		"  -g LINK        generate events from a bottleneck link model,\n"
+		"                 MBPS,RTT_MS,BUFFER_PKTS,SECONDS[,ACK_EVERY[,MARK_PKTS]]\n"
+		"  -w FILE        write the events replayed or generated to FILE\n"
+		"  -l FILE        log time, cwnd, ssthresh, packets_out and state per event\n"
+		"  -b N           replay the events N times and report ns per ACK\n"
+		"  -m MSS         segment size (default %u)\n"
+		"  -p MOD.PARAM=V set a module parameter before the modules load\n"
+		"  -s SYSCTL=V    set a sysctl once loaded, e.g. net/ipv4/tcp_nice/pacing=1\n"
+		"  -P             print the /proc/net statistics of the modules at the end\n",
+		prog, lbe_mss);
+	exit(2);
+}
+
+#define LBE_MAX_SETTINGS 32
+
+int main(int argc, char **argv)
+{
+	const char *algo = NULL, *trace_path = NULL, *link_spec = NULL;
+	const char *write_path = NULL, *log_path = NULL;
+	const char *sysctls[LBE_MAX_SETTINGS];
+	int nr_sysctls = 0, bench = 0, print_proc = 0;
+	struct tcp_congestion_ops *ca;
+	struct lbe_trace tr = { 0 };
+	struct lbe_link_stats st;
+	struct lbe_link link = { 0 };
+	struct lbe_conn c;
+	FILE *log = NULL;
+	int opt, i, ret;
+
+	while ((opt = getopt(argc, argv, "a:t:g:w:l:b:m:p:s:P")) != -1) {
+		switch (opt) {
+		case 'a':
+			algo = optarg;
+			break;
+		case 't':
+			trace_path = optarg;
+			break;
+		case 'g':
+			link_spec = optarg;
+			break;
+		case 'w':
+			write_path = optarg;
+			break;
+		case 'l':
+			log_path = optarg;
+			break;
+		case 'b':
+			bench = atoi(optarg);
+			break;
+		case 'm':
+			lbe_mss = atoi(optarg);
+			if (!lbe_mss)
+				usage(argv[0]);
+			break;
+		case 'p': {
+			char *dot = strchr(optarg, '.'), *eq = strchr(optarg, '=');
+
+			if (!dot || !eq || eq < dot)
+				usage(argv[0]);
+			*dot = *eq = '\0';
+			ret = lbe_set_param(optarg, dot + 1, eq + 1);
+			if (ret) {
+				fprintf(stderr, "%s.%s: %s\n", optarg, dot + 1, strerror(-ret));
+				return 1;
+			}
+			break;
+		}
+		case 's':
+			if (nr_sysctls == LBE_MAX_SETTINGS || !strchr(optarg, '='))
+				usage(argv[0]);
+			sysctls[nr_sysctls++] = optarg;
+			break;
+		case 'P':
+			print_proc = 1;
+			break;
+		default:
+			usage(argv[0]);
+		}
+	}
+	if (!algo || !trace_path == !link_spec)
+		usage(argv[0]);
+	if (link_spec && parse_link(&link, link_spec)) {
+		fprintf(stderr, "bad link %s\n", link_spec);
+		return 2;
+	}
+
+	ret = lbe_modules_init();
+	if (ret) {
+		fprintf(stderr, "module init: %s\n", strerror(-ret));
+		return 1;
+	}
+	for (i = 0; i < nr_sysctls; i++) {
+		char *eq = strchr(sysctls[i], '=');
+
+		*eq = '\0';
+		ret = lbe_set_sysctl(sysctls[i], eq + 1);
+		if (ret) {
+			fprintf(stderr, "%s: %s\n", sysctls[i], strerror(-ret));
+			return 1;
+		}
+	}
+
+	ca = lbe_find_congestion_control(algo);
+	if (!ca) {
+		fprintf(stderr, "%s: no such congestion control\n", algo);
+		return 1;
+	}
+
+	if (log_path) {
+		log = fopen(log_path, "w");
+		if (!log) {
+			perror(log_path);
+			return 1;
+		}
+	}
+
+	if (trace_path) {
+		if (trace_read(&tr, trace_path))
+			return 1;
+		conn_init(&c, ca, log);
+		replay(&c, &tr);
+	} else {
+		conn_init(&c, ca, log);
+		simulate(&c, &link, &tr, &st);
+	}
+	conn_release(&c);
+
+	printf("algo=%s events=%zu acks=%llu recoveries=%u cwrs=%u rtos=%u mean_cwnd=%.2f final_cwnd=%u final_ssthresh=%u cwnd_hash=%016llx",
+	       algo, tr.n, (unsigned long long)c.acks, c.recoveries, c.cwrs, c.rtos,
+	       c.acks ? (double)c.cwnd_sum / c.acks : 0.0,
+	       tcp_sk(&c.sk)->snd_cwnd, tcp_sk(&c.sk)->snd_ssthresh,
+	       (unsigned long long)c.hash);
+	if (link_spec) {
+		double secs = (double)link.duration_ns / NSEC_PER_SEC;
+
+		printf(" throughput_mbps=%.3f dropped=%llu mean_queue_delay_us=%.1f max_queue_delay_us=%.1f",
+		       st.delivered * lbe_mss * 8 / secs / 1e6,
+		       (unsigned long long)st.dropped,
+		       st.delivered ? st.queue_delay_sum_ns / 1e3 / st.delivered : 0.0,
+		       st.queue_delay_max_ns / 1e3);
+	}
+
+	if (bench > 0 && c.acks) {
+		struct timespec t0, t1;
+		double ns = 0;
+
+		for (i = 0; i < bench; i++) {
+			conn_init(&c, ca, NULL);
+			clock_gettime(CLOCK_MONOTONIC, &t0);
+			replay(&c, &tr);
+			clock_gettime(CLOCK_MONOTONIC, &t1);
+			conn_release(&c);
+			ns += elapsed_ns(&t0, &t1);
+		}
+		printf(" ns_per_ack=%.2f", ns / ((double)bench * c.acks));
+	}
+	printf("\n");
+
+	if (write_path) {
+		FILE *f = fopen(write_path, "w");
+		size_t n;
+
+		if (!f) {
+			perror(write_path);
+			return 1;
+		}
+		fprintf(f, "# lbe-replay trace, HZ=%d mss=%u\n", HZ, lbe_mss);
+		for (n = 0; n < tr.n; n++)
+			trace_write_event(f, &tr.ev[n]);
+		fclose(f);
+	}
+	if (log)
+		fclose(log);
+	if (print_proc)
+		lbe_print_proc(stdout);
+
+	free(tr.ev);
+	return 0;
+}
@@ -0,0 +1,22 @@
+/*
+ * Interface between the replay driver and the kernel shim
+ */
+
+#ifndef _LBE_REPLAY_H
+#define _LBE_REPLAY_H
+
+#include <stdio.h>
+
+/* Run the module_init() of every module linked in */
+int lbe_modules_init(void);
+
+/* Set a module parameter, e.g. ("tcp_westwoodlp", "beta", "4") */
+int lbe_set_param(const char *mod, const char *name, const char *val);
+
+/* Write a sysctl, e.g. ("net/ipv4/tcp_nice/pacing", "1") */
+int lbe_set_sysctl(const char *path, const char *val);
+
+/* Print the /proc/net files the modules created */
+void lbe_print_proc(FILE *out);
+
+#endif /* _LBE_REPLAY_H */
@@ -0,0 +1,553 @@
+/*
+ * Userspace implementation of the kernel API in include/lbe_shim.h
+ */
+
+#include <errno.h>
+#include <stdarg.h>
+#include <stdio.h>
+
+#include "lbe_shim.h"
+#include "replay.h"
+#include "tcp_lbe_cache.h"
+
+u64 lbe_now_ns;
+struct net init_net = {
+	.ipv4.sysctl_tcp_reordering = 3,	/* TCP_FASTRETRANS_THRESH */
+};
+
+/* Module init functions, run by lbe_modules_init() */
+#define LBE_MAX_MODULES 16
+
+static int (*lbe_inits[LBE_MAX_MODULES])(void);
+static int lbe_nr_inits;
+
+void lbe_register_init(int (*fn)(void))
+{
+	if (lbe_nr_inits < LBE_MAX_MODULES)
+		lbe_inits[lbe_nr_inits++] = fn;
+}
+
+int lbe_modules_init(void)
+{
+	int i, ret;
+
+	for (i = 0; i < lbe_nr_inits; i++) {
+		ret = lbe_inits[i]();
+		if (ret)
+			return ret;
+	}
+	return 0;
+}
+
+/* Module parameters */
+struct lbe_param {
+	const char *mod;
+	const char *name;
+	const struct kernel_param_ops *ops;
+	struct kernel_param kp;
+	struct lbe_param *next;
+};
+
+static struct lbe_param *lbe_params;
+
+void lbe_register_param(const char *mod, const char *name,
+			const struct kernel_param_ops *ops, void *arg)
+{
+	struct lbe_param *p = calloc(1, sizeof(*p));
+
+	if (!p)
+		abort();
+	p->mod = mod;
+	p->name = name;
+	p->ops = ops;
+	p->kp.name = name;
+	p->kp.arg = arg;
+	p->next = lbe_params;
+	lbe_params = p;
+}
+
+int lbe_set_param(const char *mod, const char *name, const char *val)
+{
+	struct lbe_param *p;
+
+	for (p = lbe_params; p; p = p->next)
+		if (!strcmp(p->mod, mod) && !strcmp(p->name, name))
+			return p->ops->set(val, &p->kp);
+	return -ENOENT;
+}
+
+int kstrtoint(const char *s, unsigned int base, int *res)
+{
+	char *end;
+	long v;
+
+	errno = 0;
+	v = strtol(s, &end, base);
+	if (end == s || (*end && *end != '\n'))
+		return -EINVAL;
+	if (errno || v < INT_MIN || v > INT_MAX)
+		return -ERANGE;
+	*res = v;
+	return 0;
+}
+
+int param_set_int(const char *val, const struct kernel_param *kp)
+{
+	return kstrtoint(val, 0, kp->arg);
+}
+
+int param_get_int(char *buffer, const struct kernel_param *kp)
+{
+	return sprintf(buffer, "%d\n", *(int *)kp->arg);
+}
+
+static int param_set_uint(const char *val, const struct kernel_param *kp)
+{
+	int v, ret;
+
+	ret = kstrtoint(val, 0, &v);
+	if (ret)
+		return ret;
+	if (v < 0)
+		return -EINVAL;
+	*(unsigned int *)kp->arg = v;
+	return 0;
+}
+
+int param_get_uint(char *buffer, const struct kernel_param *kp)
+{
+	return sprintf(buffer, "%u\n", *(unsigned int *)kp->arg);
+}
+
+static int param_set_bool(const char *val, const struct kernel_param *kp)
+{
+	int v, ret;
+
+	ret = kstrtoint(val, 0, &v);
+	if (ret)
+		return ret;
+	*(bool *)kp->arg = v;
+	return 0;
+}
+
+static int param_get_bool(char *buffer, const struct kernel_param *kp)
+{
+	return sprintf(buffer, "%c\n", *(bool *)kp->arg ? 'Y' : 'N');
+}
+
+const struct kernel_param_ops param_ops_int = {
+	.set = param_set_int,
+	.get = param_get_int,
+};
+
+const struct kernel_param_ops param_ops_uint = {
+	.set = param_set_uint,
+	.get = param_get_uint,
+};
+
+const struct kernel_param_ops param_ops_bool = {
+	.set = param_set_bool,
+	.get = param_get_bool,
+};
+
+/* Network namespaces */
+#define LBE_MAX_NET_GENERIC 16
+
+static void *lbe_net_generic[LBE_MAX_NET_GENERIC];
+static unsigned int lbe_net_ids;
+
+int register_pernet_subsys(struct pernet_operations *ops)
+{
+	unsigned int id = ++lbe_net_ids;
+	int ret;
+
+	if (id >= LBE_MAX_NET_GENERIC)
+		return -ENOMEM;
+	*ops->id = id;
+	lbe_net_generic[id] = calloc(1, ops->size);
+	if (!lbe_net_generic[id])
+		return -ENOMEM;
+
+	ret = ops->init ? ops->init(&init_net) : 0;
+	if (ret) {
+		free(lbe_net_generic[id]);
+		lbe_net_generic[id] = NULL;
+	}
+	return ret;
+}
+
+void unregister_pernet_subsys(struct pernet_operations *ops)
+{
+	if (ops->exit)
+		ops->exit(&init_net);
+	free(lbe_net_generic[*ops->id]);
+	lbe_net_generic[*ops->id] = NULL;
+}
+
+void *net_generic(const struct net *net, unsigned int id)
+{
+	return lbe_net_generic[id];
+}
+
+/* Sysctls */
+static struct ctl_table_header *lbe_sysctls;
+
+struct ctl_table_header *register_net_sysctl(struct net *net, const char *path,
+					     struct ctl_table *table)
+{
+	struct ctl_table_header *h = calloc(1, sizeof(*h));
+
+	if (!h)
+		return NULL;
+	h->ctl_table_arg = table;
+	h->path = path;
+	h->next = lbe_sysctls;
+	lbe_sysctls = h;
+	return h;
+}
+
+void unregister_net_sysctl_table(struct ctl_table_header *header)
+{
+	struct ctl_table_header **p;
+
+	for (p = &lbe_sysctls; *p; p = &(*p)->next) {
+		if (*p == header) {
+			*p = header->next;
+			free(header);
+			return;
+		}
+	}
+}
+
+int proc_dointvec_minmax(struct ctl_table *table, int write,
+			 void __user *buffer, size_t *lenp, loff_t *ppos)
+{
+	int v, ret;
+
+	if (!write) {
+		*lenp = snprintf(buffer, *lenp, "%d\n", *(int *)table->data);
+		return 0;
+	}
+
+	ret = kstrtoint(buffer, 0, &v);
+	if (ret)
+		return ret;
+	if ((table->extra1 && v < *(int *)table->extra1) ||
+	    (table->extra2 && v > *(int *)table->extra2))
+		return -EINVAL;
+	*(int *)table->data = v;
+	return 0;
+}
+
+/* path is e.g. "net/ipv4/tcp_nice/fraction" */
+int lbe_set_sysctl(const char *path, const char *val)
+{
+	const char *name = strrchr(path, '/');
+	struct ctl_table_header *h;
+	struct ctl_table *t;
+
+	if (!name)
+		return -ENOENT;
+
+	for (h = lbe_sysctls; h; h = h->next) {
+		if (strlen(h->path) != (size_t)(name - path) ||
+		    strncmp(h->path, path, name - path))
+			continue;
+		for (t = h->ctl_table_arg; t->procname; t++) {
+			char buf[32];
+			size_t len;
+			loff_t pos = 0;
+
+			if (strcmp(t->procname, name + 1))
+				continue;
+			len = snprintf(buf, sizeof(buf), "%s", val);
+			return t->proc_handler(t, 1, buf, &len, &pos);
+		}
+	}
+	return -ENOENT;
+}
+
+/* /proc/net files */
+struct lbe_proc {
+	const char *name;
+	const struct file_operations *fops;
+	int (*show)(struct seq_file *seq, void *v);	/* or this */
+	void *data;
+	struct lbe_proc *next;
+};
+
+static struct lbe_proc *lbe_procs;
+
+struct proc_dir_entry *proc_create_data(const char *name, unsigned short mode,
+					struct proc_dir_entry *parent,
+					const struct file_operations *fops,
+					void *data)
+{
+	struct lbe_proc *p = calloc(1, sizeof(*p));
+
+	if (!p)
+		return NULL;
+	p->name = name;
+	p->fops = fops;
+	p->data = data;
+	p->next = lbe_procs;
+	lbe_procs = p;
+	return (struct proc_dir_entry *)p;
+}
+
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(4, 18, 0)
+struct proc_dir_entry *proc_create_single(const char *name, unsigned short mode,
+					  struct proc_dir_entry *parent,
+					  int (*show)(struct seq_file *, void *))
+{
+	struct lbe_proc *p = (struct lbe_proc *)proc_create_data(name, mode, parent,
+								 NULL, NULL);
+
+	if (p)
+		p->show = show;
+	return (struct proc_dir_entry *)p;
+}
+#endif
+
+void remove_proc_entry(const char *name, struct proc_dir_entry *parent)
+{
+	struct lbe_proc **p;
+
+	for (p = &lbe_procs; *p; p = &(*p)->next) {
+		if (!strcmp((*p)->name, name)) {
+			struct lbe_proc *dead = *p;
+
+			*p = dead->next;
+			free(dead);
+			return;
+		}
+	}
+}
+
+struct seq_file {
+	FILE *out;
+};
+
+/* Opening a file prints it: single_open() runs show() straight away */
+struct file {
+	struct seq_file seq;
+};
+
+struct inode {
+	void *data;
+};
+
+void *PDE_DATA(const struct inode *inode)
+{
+	return inode->data;
+}
+
+int seq_printf(struct seq_file *seq, const char *fmt, ...)
+{
+	va_list ap;
+	int ret;
+
+	va_start(ap, fmt);
+	ret = vfprintf(seq->out, fmt, ap);
+	va_end(ap);
+	return ret;
+}
+
+int single_open(struct file *file, int (*show)(struct seq_file *, void *),
+		void *data)
+{
+	return show(&file->seq, data);
+}
+
+int single_release(struct inode *inode, struct file *file)
+{
+	return 0;
+}
+
+long seq_read(struct file *file, char *buf, size_t len, loff_t *ppos)
+{
+	return 0;
+}
+
+loff_t seq_lseek(struct file *file, loff_t off, int whence)
+{
+	return 0;
+}
+
+void lbe_print_proc(FILE *out)
+{
+	struct lbe_proc *p;
+
+	for (p = lbe_procs; p; p = p->next) {
+		struct inode inode = { .data = p->data };
+		struct file file = { .seq = { .out = out } };
+
+		fprintf(out, "# /proc/net/%s\n", p->name);
+		if (p->show) {
+			p->show(&file.seq, NULL);
+			continue;
+		}
+		p->fops->open(&inode, &file);
+		if (p->fops->release)
+			p->fops->release(&inode, &file);
+	}
+}
+
+/* TCP, after net/ipv4/tcp_cong.c */
+static struct tcp_congestion_ops *lbe_ca_list;
+
+int tcp_register_congestion_control(struct tcp_congestion_ops *ca)
+{
+	if (!ca->ssthresh || !ca->cong_avoid)
+		return -EINVAL;
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(4, 13, 0)
+	if (!ca->undo_cwnd)
+		return -EINVAL;
+#endif
+	if (lbe_find_congestion_control(ca->name))
+		return -EEXIST;
+	ca->next = lbe_ca_list;
+	lbe_ca_list = ca;
+	return 0;
+}
+
+void tcp_unregister_congestion_control(struct tcp_congestion_ops *ca)
+{
+	struct tcp_congestion_ops **p;
+
+	for (p = &lbe_ca_list; *p; p = &(*p)->next) {
+		if (*p == ca) {
+			*p = ca->next;
+			return;
+		}
+	}
+}
+
+struct tcp_congestion_ops *lbe_find_congestion_control(const char *name)
+{
+	struct tcp_congestion_ops *ca;
+
+	for (ca = lbe_ca_list; ca; ca = ca->next)
+		if (!strcmp(ca->name, name))
+			return ca;
+	return NULL;
+}
+
+bool tcp_is_cwnd_limited(const struct sock *sk)
+{
+	const struct tcp_sock *tp = tcp_sk(sk);
+
+	/* If in slow start, ensure cwnd grows to twice what was ACKed. */
+	if (tcp_in_slow_start(tp))
+		return tp->snd_cwnd < 2 * tp->max_packets_out;
+
+	return tp->is_cwnd_limited;
+}
+
+u32 tcp_slow_start(struct tcp_sock *tp, u32 acked)
+{
+	u32 cwnd = min(tp->snd_cwnd + acked, tp->snd_ssthresh);
+
+	acked -= cwnd - tp->snd_cwnd;
+	tp->snd_cwnd = min(cwnd, tp->snd_cwnd_clamp);
+
+	return acked;
+}
+
+void tcp_cong_avoid_ai(struct tcp_sock *tp, u32 w, u32 acked)
+{
+	/* If credits accumulated at a higher w, apply them gently now. */
+	if (tp->snd_cwnd_cnt >= w) {
+		tp->snd_cwnd_cnt = 0;
+		tp->snd_cwnd++;
+	}
+
+	tp->snd_cwnd_cnt += acked;
+	if (tp->snd_cwnd_cnt >= w) {
+		u32 delta = tp->snd_cwnd_cnt / w;
+
+		tp->snd_cwnd_cnt -= delta * w;
+		tp->snd_cwnd += delta;
+	}
+	tp->snd_cwnd = min(tp->snd_cwnd, tp->snd_cwnd_clamp);
+}
+
+void tcp_reno_cong_avoid(struct sock *sk, u32 ack, u32 acked)
+{
+	struct tcp_sock *tp = tcp_sk(sk);
+
+	if (!tcp_is_cwnd_limited(sk))
+		return;
+
+	/* In "safe" area, increase. */
+	if (tcp_in_slow_start(tp)) {
+		acked = tcp_slow_start(tp, acked);
+		if (!acked)
+			return;
+	}
+	/* In dangerous area, increase slowly. */
+	tcp_cong_avoid_ai(tp, tp->snd_cwnd, acked);
+}
+
+u32 tcp_reno_ssthresh(struct sock *sk)
+{
+	const struct tcp_sock *tp = tcp_sk(sk);
+
+	return max(tp->snd_cwnd >> 1U, 2U);
+}
+
+u32 tcp_current_ssthresh(const struct sock *sk)
+{
+	const struct tcp_sock *tp = tcp_sk(sk);
+
+	if ((1 << sk->icsk_ca_state) & ((1 << TCP_CA_CWR) | (1 << TCP_CA_Recovery)))
+		return tp->snd_ssthresh;
+	return max(tp->snd_ssthresh,
+		   ((tp->snd_cwnd >> 1) + (tp->snd_cwnd >> 2)));
+}
+
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(4, 13, 0)
+u32 tcp_reno_undo_cwnd(struct sock *sk)
+{
+	const struct tcp_sock *tp = tcp_sk(sk);
+
+	return max(tp->snd_cwnd, tp->snd_ssthresh << 1);
+}
+#endif
+
+/* Plain Reno, as the baseline for the per-ACK cost of the shim itself */
+static struct tcp_congestion_ops tcp_reno = {
+	.ssthresh	= tcp_reno_ssthresh,
+	.cong_avoid	= tcp_reno_cong_avoid,
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(4, 13, 0)
+	.undo_cwnd	= tcp_reno_undo_cwnd,
+#endif
+	.name		= "reno",
+};
+
+static int __init lbe_reno_register(void)
+{
+	return tcp_register_congestion_control(&tcp_reno);
+}
+module_init(lbe_reno_register);
+
+/* tcp_lbe_cache.c is not built: a replay drives a single connection,
+ * which has no earlier connection to learn from and no other to share
+ * with, so every run starts afresh.
+ */
+bool lbe_cache_join(const struct sock *sk, struct lbe_cache_seed *seed)
+{
+	memset(seed, 0, sizeof(*seed));
+	seed->flows = 1;
+	return true;
+}
+
+void lbe_cache_leave(const struct sock *sk, bool cached)
+{
+}
+
+u8 lbe_cache_update(const struct sock *sk, const struct lbe_cache_seed *seed,
+		    u32 mask)
+{
+	return 1;
+}
@@ -0,0 +1,226 @@
+#!/bin/bash
+#
+# Performance regression benchmark for the Less-than-Best-Effort modules
+#
+# Measures every module two ways and compares the results against a
+# stored baseline:
+#   replay	lbe-replay on each link model of LBE_BENCH_LINKS: the CPU
+#		cost per ACK, and the throughput and queuing delay of a lone
+#		flow, which is the latency it imposes on foreground traffic.
+#		With perf, the cost is also counted in instructions per ACK.
+#   netns	the scenario suite of lbe-scenarios.sh on a small matrix, for
+#		the throughput, the foreground latency and the yield and
+#		reclaim times on a real stack. Needs root and the built .ko
+#		files; it is skipped otherwise.
+#
+# usage: lbe-bench.sh [MODULE_DIR]
+#
+# MODULE_DIR is the repository (default), with replay/lbe-replay built.
+# Settings, from the environment:
+#   LBE_MODULES		modules under test (ledbat apledbat ledbatpp nice westwoodlp)
+#   LBE_BENCH_LINKS	replay link models, as lbe-replay -g
+#			(50,40,1500,20 100,10,200,20,2 20,80,100,30,4)
+#   LBE_BENCH_REPEAT	replays of each run for the cost per ACK (20)
+#   LBE_BENCH_RUNS	runs of each, of which the fastest is kept (5)
+#   LBE_BENCH_NETNS	0 to skip the netns scenarios (1)
+#   LBE_BENCH_BASELINE	baseline file (scenarios/bench-baseline.txt)
+#   LBE_BENCH_TOLERANCE	regression threshold in percent (10)
+#   LBE_BENCH_TIME_TOLERANCE	the same for ns_per_ack (25)
+#   LBE_BENCH_UPDATE	1 to store this run as the baseline
+#   LBE_OUT		directory for bench.txt and the scenario logs
+# The LBE_BW, LBE_RTT, LBE_BUFFER, LBE_FG and LBE_PHASE settings of the
+# netns scenarios default to 50 Mbit/s, 40 ms, 1 BDP, cubic and 10 s.
+#
+# Each result is one line of key=value, as lbe-replay and lbe-scenarios.sh
+# print them, prefixed with source=replay or source=netns. Lines that the
+# baseline has too gain <metric>_base for every metric compared and end
+# with status=ok, or status=regression listing the metrics that got worse
+# by more than the tolerance. Lines new to the baseline end with status=new.
+# Without a baseline the benchmark fails, unless LBE_BENCH_UPDATE=1 is set
+# to store the first one.
+# The time per ACK varies with the host, so it is only compared when there
+# is no instruction count to compare instead.
+# The exit status is 1 if any result regressed.
+
+set -eu
+
+MODDIR=$(cd "${1:-$(dirname "$0")/..}" && pwd)
+MODULES=${LBE_MODULES:-"ledbat apledbat ledbatpp nice westwoodlp"}
+LINKS=${LBE_BENCH_LINKS:-"50,40,1500,20 100,10,200,20,2 20,80,100,30,4"}
+REPEAT=${LBE_BENCH_REPEAT:-20}
+RUNS=${LBE_BENCH_RUNS:-5}
+NETNS=${LBE_BENCH_NETNS:-1}
+BASELINE=${LBE_BENCH_BASELINE:-"$MODDIR/scenarios/bench-baseline.txt"}
+TOLERANCE=${LBE_BENCH_TOLERANCE:-10}
+TIME_TOLERANCE=${LBE_BENCH_TIME_TOLERANCE:-25}
+UPDATE=${LBE_BENCH_UPDATE:-0}
+OUT=${LBE_OUT:-"$MODDIR/scenarios/bench-$(date +%Y%m%d-%H%M%S)"}
+REPLAY=$MODDIR/replay/lbe-replay
+
+die() {
+	echo "$(basename "$0"): $*" >&2
+	exit 1
+}
+
+note() {
+	echo "$(basename "$0"): $*" >&2
+}
+
+# value KEY LINE
+value() {
+	echo "$2" | tr ' ' '\n' | sed -n "s/^$1=//p"
+}
+
+# instructions CMD...: instructions retired by CMD, as counted by perf
+instructions() {
+	perf stat -x, -e instructions -o "$OUT/perf.csv" -- "$@" >/dev/null 2>&1 &&
+		awk -F, '$3 ~ /^instructions/ { print $1 }' "$OUT/perf.csv"
+}
+
+# bench_replay MODULE LINK
+bench_replay() {
+	local mod=$1 link=$2 line acks ns="" insns="none" i0 i1 run
+
+	# the results but the cost are the same on every run
+	for run in $(seq $RUNS); do
+		line=$("$REPLAY" -a $mod -g $link -b $REPEAT) ||
+			die "lbe-replay -a $mod -g $link failed"
+		ns=$(awk -v a="$ns" -v b=$(value ns_per_ack "$line") \
+			'BEGIN { print (a == "" || b < a) ? b : a }')
+	done
+	acks=$(value acks "$line")
+
+	# the difference leaves out the generation of the events
+	if command -v perf >/dev/null; then
+		i0=$(instructions "$REPLAY" -a $mod -g $link)
+		i1=$(instructions "$REPLAY" -a $mod -g $link -b $REPEAT)
+		case "$i0$i1" in
+		*[!0-9]*|"") ;;
+		*) insns=$(awk -v a=$i0 -v b=$i1 -v n=$REPEAT -v k=$acks \
+			'BEGIN { printf "%.1f", (b - a) / (n * k) }') ;;
+		esac
+	fi
+
+	echo "source=replay module=$mod link=$link" \
+	     "ns_per_ack=$ns" \
+	     "insns_per_ack=$insns" \
+	     "throughput_mbps=$(value throughput_mbps "$line")" \
+	     "queue_delay_ms=$(awk -v d=$(value mean_queue_delay_us "$line") 'BEGIN { printf "%.2f", d / 1e3 }')" \
+	     "max_queue_delay_ms=$(awk -v d=$(value max_queue_delay_us "$line") 'BEGIN { printf "%.2f", d / 1e3 }')" \
+	     "cwnd_hash=$(value cwnd_hash "$line")"
+}
+
+bench_netns() {
+	local why=""
+
+	[ "$NETNS" = 0 ] && return 0
+	[ "$(id -u)" = 0 ] || why="not root"
+	for mod in $MODULES; do
+		[ -e "$MODDIR/tcp_$mod.ko" ] || why="${why:-tcp_$mod.ko not built}"
+	done
+	if [ -n "$why" ]; then
+		note "netns scenarios skipped: $why"
+		return 0
+	fi
+
+	LBE_MODULES="$MODULES" LBE_BW=${LBE_BW:-50} LBE_RTT=${LBE_RTT:-40} \
+	LBE_BUFFER=${LBE_BUFFER:-1} LBE_FG=${LBE_FG:-cubic} \
+	LBE_PHASE=${LBE_PHASE:-10} LBE_OUT="$OUT/scenarios" \
+		"$MODDIR/scenarios/lbe-scenarios.sh" "$MODDIR" >/dev/null ||
+		die "scenario suite failed, see $OUT/scenarios"
+	sed 's/^/source=netns /' "$OUT/scenarios/results.txt"
+}
+
+# compare BASELINE < RESULTS: the report. A metric regresses when it is
+# worse than in the baseline by more than TOLERANCE percent and by more
+# than its noise floor, in the metric's own unit.
+compare() {
+	awk -v tol=$TOLERANCE -v ttol=$TIME_TOLERANCE '
+	BEGIN {
+		# direction (1: higher is worse) and noise floor
+		split("ns_per_ack insns_per_ack queue_delay_ms max_queue_delay_ms " \
+		      "extra_delay_ms fg_delay_ms yield_s reclaim_s", up)
+		split("0.5 1 0.1 0.1 0.5 0.5 0.5 0.5", upfloor)
+		for (i in up) { dir[up[i]] = 1; flr[up[i]] = upfloor[i] }
+		split("throughput_mbps lbe_mbps fg_mbps", down)
+		split("0.1 0.5 0.5", downfloor)
+		for (i in down) { dir[down[i]] = -1; flr[down[i]] = downfloor[i] }
+		# what identifies a result
+		split("source module link bw_mbit rtt_ms buffer_bdp fg", idk)
+	}
+	function parse(line, kv,    n, f, i, eq) {
+		delete kv
+		n = split(line, f, " ")
+		for (i = 1; i <= n; i++) {
+			eq = index(f[i], "=")
+			if (eq) kv[substr(f[i], 1, eq - 1)] = substr(f[i], eq + 1)
+		}
+	}
+	function id(kv,    s, i) {
+		s = ""
+		for (i = 1; i in idk; i++)
+			if (idk[i] in kv) s = s " " idk[i] "=" kv[idk[i]]
+		return s
+	}
+	FILENAME == ARGV[1] {
+		if ($0 !~ /^#/ && NF) { parse($0, kv); base[id(kv)] = $0 }
+		next
+	}
+	{
+		parse($0, cur)
+		key = id(cur)
+		if (!(key in base)) { print $0, "status=new"; next }
+		parse(base[key], old)
+		line = $0; worse = ""
+		for (m in dir) {
+			if (!(m in cur) || !(m in old)) continue
+			line = line " " m "_base=" old[m]
+			if (cur[m] == "none" || old[m] == "none") {
+				# yield_s or reclaim_s that no longer happens
+				if (cur[m] == "none" && old[m] != "none" && dir[m] > 0)
+					worse = worse (worse ? "," : "") m
+				continue
+			}
+			if (m == "ns_per_ack" && cur["insns_per_ack"] != "none" &&
+			    old["insns_per_ack"] != "none")
+				continue
+			t = m == "ns_per_ack" ? ttol : tol
+			d = (cur[m] - old[m]) * dir[m]
+			if (d > flr[m] && d * 100 > t * (old[m] < 0 ? -old[m] : old[m]))
+				worse = worse (worse ? "," : "") m
+		}
+		if (worse) { print line, "status=regression regressed=" worse; bad++ }
+		else print line, "status=ok"
+	}
+	END { exit bad ? 1 : 0 }' "$1" -
+}
+
+[ -x "$REPLAY" ] || die "$REPLAY not built, run make -C replay"
+[ -e "$BASELINE" ] || [ "$UPDATE" = 1 ] ||
+	die "no baseline at $BASELINE, store one with LBE_BENCH_UPDATE=1"
+mkdir -p "$OUT"
+
+{
+	for mod in $MODULES; do
+		for link in $LINKS; do
+			bench_replay $mod $link
+		done
+	done
+	bench_netns
+} > "$OUT/results.txt"
+
+status=0
+if [ -e "$BASELINE" ]; then
+	compare "$BASELINE" < "$OUT/results.txt" > "$OUT/bench.txt" || status=1
+else
+	compare /dev/null < "$OUT/results.txt" > "$OUT/bench.txt" || status=1
+fi
+cat "$OUT/bench.txt"
+
+if [ "$UPDATE" = 1 ]; then
+	cp "$OUT/results.txt" "$BASELINE"
+	note "baseline stored in $BASELINE"
+	status=0
+fi
+[ $status = 0 ] || note "regressions against $BASELINE, see $OUT/bench.txt"
+exit $status
@@ -0,0 +1,246 @@
+#!/bin/bash
+#
+# Scenario suite for the Less-than-Best-Effort modules
+#
+# Builds a sender, a router and a receiver network namespace joined by veth
+# pairs. The router's egress towards the receiver is the bottleneck (tbf,
+# with a buffer of BUFFER times the BDP), and its egress back towards the
+# sender adds the RTT (netem). For every combination of bandwidth, RTT,
+# buffer depth and foreground congestion control, each module runs one
+# bulk flow for three phases of PHASE seconds:
+#   1. alone, to measure the capacity it takes and the queue it builds
+#   2. with a foreground flow, to measure how fast it yields
+#   3. alone again, to measure how fast it reclaims the spare capacity
+# while ping measures the latency throughout.
+#
+# usage: lbe-scenarios.sh [MODULE_DIR]
+#
+# MODULE_DIR holds the built .ko files (default: the repository); modules
+# not already loaded are inserted from there and removed again at the end.
+# Needs root, iproute2 with tc, iperf3 and ping. The matrix is set through
+# the environment, e.g. LBE_BW="10 100" LBE_FG=bbr lbe-scenarios.sh:
+#   LBE_MODULES	modules under test (ledbat apledbat ledbatpp nice westwoodlp)
+#   LBE_BW	bottleneck rates in Mbit/s (10 50)
+#   LBE_RTT	base RTTs in ms (20 80)
+#   LBE_BUFFER	buffer depths in BDPs (1 4)
+#   LBE_FG	foreground congestion controls (cubic bbr)
+#   LBE_PHASE	phase length in seconds (10)
+#   LBE_YIELD	share of the bottleneck below which the module has
+#		yielded, and above one minus which it has reclaimed (0.2)
+#   LBE_OUT	directory for the raw logs and results.txt
+#
+# Each run prints one line of key=value results. Rates are in Mbit/s and
+# delays in ms; extra_delay_ms and fg_delay_ms are the median ping RTT
+# above the base RTT in phase 1 and phase 2. yield_s and reclaim_s are
+# counted from the start of phases 2 and 3, "none" if it never happened.
+
+set -eu
+
+MODDIR=$(cd "${1:-$(dirname "$0")/..}" && pwd)
+MODULES=${LBE_MODULES:-"ledbat apledbat ledbatpp nice westwoodlp"}
+BWS=${LBE_BW:-"10 50"}
+RTTS=${LBE_RTT:-"20 80"}
+BUFFERS=${LBE_BUFFER:-"1 4"}
+FGS=${LBE_FG:-"cubic bbr"}
+PHASE=${LBE_PHASE:-10}
+YIELD=${LBE_YIELD:-0.2}
+OUT=${LBE_OUT:-"$MODDIR/scenarios/results-$(date +%Y%m%d-%H%M%S)"}
+
+SND=lbe-snd
+RTR=lbe-rtr
+RCV=lbe-rcv
+RCV_ADDR=10.201.1.2
+LBE_PORT=5201
+FG_PORT=5202
+
+inserted=""
+
+die() {
+	echo "$(basename "$0"): $*" >&2
+	exit 1
+}
+
+cleanup() {
+	local m
+
+	for ns in $SND $RTR $RCV; do
+		ip netns pids $ns 2>/dev/null | xargs -r kill 2>/dev/null || true
+		ip netns del $ns 2>/dev/null || true
+	done
+	# the last sockets may hold their module for a moment
+	sleep 1
+	for m in $inserted; do
+		rmmod $m 2>/dev/null || echo "could not remove $m" >&2
+	done
+}
+
+load_module() {
+	local m=$1
+
+	[ -d /sys/module/$m ] && return 0
+	insmod "$MODDIR/$m.ko" || die "cannot insert $MODDIR/$m.ko"
+	inserted="$m $inserted"
+}
+
+setup_topology() {
+	local ns
+
+	for ns in $SND $RTR $RCV; do
+		ip netns add $ns
+		ip -n $ns link set lo up
+	done
+	ip link add s0 netns $SND type veth peer name r0 netns $RTR
+	ip link add r1 netns $RTR type veth peer name c0 netns $RCV
+
+	ip -n $SND addr add 10.201.0.1/24 dev s0
+	ip -n $RTR addr add 10.201.0.2/24 dev r0
+	ip -n $RTR addr add 10.201.1.1/24 dev r1
+	ip -n $RCV addr add $RCV_ADDR/24 dev c0
+	for dev in "$SND s0" "$RTR r0" "$RTR r1" "$RCV c0"; do
+		set -- $dev
+		ip -n $1 link set $2 up
+		# whole segments, so that tbf and netem see what goes on a wire
+		if command -v ethtool >/dev/null; then
+			ip netns exec $1 ethtool -K $2 tso off gso off gro off \
+				>/dev/null 2>&1 || true
+		fi
+	done
+	ip -n $SND route add default via 10.201.0.2
+	ip -n $RCV route add default via 10.201.1.1
+	ip netns exec $RTR sysctl -qw net.ipv4.ip_forward=1
+
+	ip netns exec $RCV iperf3 -s -D -p $LBE_PORT
+	ip netns exec $RCV iperf3 -s -D -p $FG_PORT
+	sleep 0.5
+}
+
+# set_bottleneck RATE_MBIT RTT_MS BUFFER_BDP
+set_bottleneck() {
+	local limit burst
+
+	limit=$(awk -v r=$1 -v d=$2 -v b=$3 'BEGIN {
+		l = r * 1e6 / 8 * d / 1e3 * b; if (l < 15000) l = 15000; printf "%d", l }')
+	burst=$(awk -v r=$1 'BEGIN {
+		b = r * 1e6 / 8 / 250; if (b < 3028) b = 3028; printf "%d", b }')
+
+	ip netns exec $RTR tc qdisc replace dev r1 root tbf rate ${1}mbit \
+		burst $burst limit $limit
+	ip netns exec $RTR tc qdisc replace dev r0 root netem delay ${2}ms \
+		limit 100000
+}
+
+# interval_rates LOG: "start end mbps" for every iperf3 report interval
+interval_rates() {
+	awk '/bits\/sec/ && !/sender|receiver/ {
+		for (i = 1; i <= NF; i++)
+			if ($i == "sec") { split($(i - 1), t, "-"); break }
+		for (i = 1; i <= NF; i++)
+			if ($i == "Mbits/sec") rate = $(i - 1)
+		print t[1], t[2], rate }' "$1"
+}
+
+# mean_rate LOG FROM TO
+mean_rate() {
+	interval_rates "$1" | awk -v f=$2 -v t=$3 '
+		$1 >= f && $2 <= t { s += $3; n++ }
+		END { printf "%.2f", n ? s / n : 0 }'
+}
+
+# first_time LOG FROM below|above MBPS: seconds after FROM until the rate
+# first crosses MBPS
+first_time() {
+	interval_rates "$1" | awk -v f=$2 -v dir=$3 -v r=$4 '
+		$1 >= f && ((dir == "below" && $3 <= r) || (dir == "above" && $3 >= r)) {
+			printf "%.1f", $2 - f; found = 1; exit }
+		END { if (!found) printf "none" }'
+}
+
+# median_delay PING_LOG START FROM TO RTT_MS: median RTT above RTT_MS of
+# the pings sent between FROM and TO seconds after START
+median_delay() {
+	awk -v s=$2 -v f=$3 -v t=$4 -v base=$5 '
+		/time=/ {
+			ts = substr($1, 2, length($1) - 2) - s
+			if (ts < f || ts > t) next
+			for (i = 1; i <= NF; i++)
+				if ($i ~ /^time=/) d[n++] = substr($i, 6) - base
+		}
+		END {
+			if (!n) { printf "none"; exit }
+			for (i = 1; i < n; i++)
+				for (j = i; j > 0 && d[j - 1] > d[j]; j--) {
+					x = d[j]; d[j] = d[j - 1]; d[j - 1] = x
+				}
+			printf "%.2f", d[int(n / 2)]
+		}' "$1"
+}
+
+# run MODULE RATE_MBIT RTT_MS BUFFER_BDP FG
+run() {
+	local mod=$1 bw=$2 rtt=$3 buf=$4 fg=$5
+	local tag=$mod-$bw-$rtt-$buf-$fg
+	local total=$((3 * PHASE)) start lbe fg_pid ping_pid
+	local low high
+
+	set_bottleneck $bw $rtt $buf
+	lbe=$OUT/$tag.lbe
+	start=$(date +%s.%N)
+
+	ip netns exec $SND ping -D -i 0.05 -w $total $RCV_ADDR > $OUT/$tag.ping &
+	ping_pid=$!
+	ip netns exec $SND iperf3 -c $RCV_ADDR -p $LBE_PORT -C $mod \
+		-t $total -i 0.1 -f m --forceflush > $lbe &
+	(sleep $PHASE; ip netns exec $SND iperf3 -c $RCV_ADDR -p $FG_PORT \
+		-C $fg -t $PHASE -i 0.1 -f m --forceflush > $OUT/$tag.fg) &
+	fg_pid=$!
+	wait $fg_pid $ping_pid || true
+	wait || true
+
+	low=$(awk -v r=$bw -v y=$YIELD 'BEGIN { print r * y }')
+	high=$(awk -v r=$bw -v y=$YIELD 'BEGIN { print r * (1 - y) }')
+
+	echo "module=$mod bw_mbit=$bw rtt_ms=$rtt buffer_bdp=$buf fg=$fg" \
+	     "lbe_mbps=$(mean_rate $lbe $((PHASE / 2)) $PHASE)" \
+	     "extra_delay_ms=$(median_delay $OUT/$tag.ping $start $((PHASE / 2)) $PHASE $rtt)" \
+	     "fg_mbps=$(mean_rate $OUT/$tag.fg 0 $PHASE)" \
+	     "lbe_contended_mbps=$(mean_rate $lbe $PHASE $((2 * PHASE)))" \
+	     "fg_delay_ms=$(median_delay $OUT/$tag.ping $start $PHASE $((2 * PHASE)) $rtt)" \
+	     "yield_s=$(first_time $lbe $PHASE below $low)" \
+	     "reclaim_s=$(first_time $lbe $((2 * PHASE)) above $high)" |
+		tee -a $OUT/results.txt
+}
+
+[ "$(id -u)" = 0 ] || die "must be run as root"
+for tool in ip tc iperf3 ping; do
+	command -v $tool >/dev/null || die "$tool not found"
+done
+ip netns list | grep -q "^$SND" && die "namespace $SND exists, another run?"
+
+mkdir -p "$OUT"
+trap cleanup EXIT
+
+for mod in $MODULES; do
+	case $mod in
+	ledbat|apledbat|ledbatpp)
+		load_module tcp_ledbat_core
+		;;
+	esac
+	load_module tcp_$mod
+done
+for fg in $FGS; do
+	[ -d /sys/module/tcp_$fg ] || modprobe -q tcp_$fg || true
+done
+
+setup_topology
+
+for bw in $BWS; do
+	for rtt in $RTTS; do
+		for buf in $BUFFERS; do
+			for fg in $FGS; do
+				for mod in $MODULES; do
+					run $mod $bw $rtt $buf $fg
+				done
+			done
+		done
+	done
+done
@@ -0,0 +1,383 @@
+/*
+ * Per-destination cache of the LBE congestion controls
+ *
+ * Connections to a peer seen recently need not start from nothing: the
+ * propagation RTT, the peer's timestamp clock, the bandwidth estimate
+ * and Nice's fractional window of the last connection are good first
+ * estimates for the next one. In the spirit of the Congestion Manager
+ * (RFC3124) and of tcp_metrics, which only keeps the stack's own state,
+ * this is a hash of destinations shared by ledbat, apledbat, ledbatpp,
+ * nice and westwoodlp.
+ *
+ * Each entry also counts the LBE connections to its destination, so
+ * that with coordinate set they yield as one: n parallel connections
+ * otherwise take n times the share of a single one. With coordinate=2
+ * every LBE connection of the host counts, for hosts whose background
+ * transfers all go through one bottleneck such as their uplink. They
+ * are counted per CPU, so that connections come and go without sharing
+ * a cacheline, and summed every LBE_CACHE_HOST_INTERVAL.
+ *
+ * The hash is read under RCU and written under a spinlock, with entries
+ * added at connection start and reaped every LBE_CACHE_GC_INTERVAL once
+ * they have had no connection for lifetime seconds.
+ */
+
+#include <linux/module.h>
+#include <linux/kernel.h>
+#include <linux/atomic.h>
+#include <linux/jhash.h>
+#include <linux/percpu.h>
+#include <linux/rculist.h>
+#include <linux/slab.h>
+#include <linux/spinlock.h>
+#include <linux/workqueue.h>
+
+#include <net/inet_sock.h>
+#include <net/ipv6.h>
+#include <net/net_namespace.h>
+#include <net/tcp.h>
+
+#include "tcp_lbe_cache.h"
+
+static int lifetime __read_mostly = 600;
+module_param(lifetime, int, 0644);
+MODULE_PARM_DESC(lifetime, "seconds a destination is remembered after its last connection (0: no cache)");
+
+static int max_entries __read_mostly = 4096;
+module_param(max_entries, int, 0644);
+MODULE_PARM_DESC(max_entries, "most destinations remembered at a time");
+
+/* coordinate */
+enum {
+	LBE_COORDINATE_OFF,
+	LBE_COORDINATE_DST,		/* per destination */
+	LBE_COORDINATE_HOST,		/* all LBE connections of the host */
+};
+
+static int coordinate __read_mostly = LBE_COORDINATE_DST;
+module_param(coordinate, int, 0644);
+MODULE_PARM_DESC(coordinate, "let parallel LBE connections take the share of one: 0 off, 1 per destination, 2 host-wide");
+
+#define LBE_CACHE_HASH_BITS	8
+#define LBE_CACHE_GC_INTERVAL	(60 * HZ)
+#define LBE_CACHE_HOST_INTERVAL	(HZ / 10)
+
+/* Flows reported are capped, as the modules keep them in a u8 */
+#define LBE_CACHE_MAX_FLOWS	U8_MAX
+
+struct lbe_cache_entry {
+	struct hlist_node node;
+	struct rcu_head rcu;
+	possible_net_t net;
+	struct in6_addr daddr;		/* IPv4 as v4-mapped */
+	atomic_t flows;			/* connections counted in, -1 once reaped */
+	unsigned long stamp;		/* jiffies of the last join, update or leave */
+
+	u32 min_rtt_us;
+	u32 remote_scale;
+	u32 bw;
+	u8 fractional_cwnd;
+};
+
+static struct hlist_head lbe_cache_hash[1 << LBE_CACHE_HASH_BITS];
+static DEFINE_SPINLOCK(lbe_cache_lock);	/* hash insertions and removals */
+static atomic_t lbe_cache_entries = ATOMIC_INIT(0);
+
+static void lbe_cache_gc(struct work_struct *work);
+static DECLARE_DEFERRABLE_WORK(lbe_cache_gc_work, lbe_cache_gc);
+
+/* LBE connections of the host: joins less leaves on each CPU, so that
+ * one CPU may go negative, and their sum as of the last aggregation.
+ */
+static DEFINE_PER_CPU(int, lbe_cache_host_flows);
+static int lbe_cache_host_sum __read_mostly;
+
+static void lbe_cache_host(struct work_struct *work);
+static DECLARE_DEFERRABLE_WORK(lbe_cache_host_work, lbe_cache_host);
+
+/* lifetime in jiffies, bounded to a week as it is not range checked */
+static unsigned long lbe_cache_lifetime(void)
+{
+	return (unsigned long)clamp(READ_ONCE(lifetime), 0, 7 * 24 * 3600) * HZ;
+}
+
+static void lbe_cache_daddr(const struct sock *sk, struct in6_addr *daddr)
+{
+#if IS_ENABLED(CONFIG_IPV6)
+	if (sk->sk_family == AF_INET6 && !ipv6_addr_v4mapped(&sk->sk_v6_daddr)) {
+		*daddr = sk->sk_v6_daddr;
+		return;
+	}
+#endif
+	ipv6_addr_set_v4mapped(sk->sk_daddr, daddr);
+}
+
+static struct hlist_head *lbe_cache_bucket(const struct net *net,
+					   const struct in6_addr *daddr)
+{
+	u32 hash = jhash2(daddr->s6_addr32, 4, net_hash_mix(net));
+
+	return &lbe_cache_hash[hash >> (32 - LBE_CACHE_HASH_BITS)];
+}
+
+/* The live entry of daddr, under rcu_read_lock() or lbe_cache_lock */
+static struct lbe_cache_entry *lbe_cache_find(const struct net *net,
+					      const struct in6_addr *daddr)
+{
+	struct lbe_cache_entry *e;
+
+	hlist_for_each_entry_rcu(e, lbe_cache_bucket(net, daddr), node) {
+		if (net_eq(read_pnet(&e->net), net) &&
+		    ipv6_addr_equal(&e->daddr, daddr) &&
+		    atomic_read(&e->flows) >= 0)
+			return e;
+	}
+	return NULL;
+}
+
+/* The flows of struct lbe_cache_seed, for destination entry e if any */
+static u8 lbe_cache_flows(const struct lbe_cache_entry *e)
+{
+	int mode = READ_ONCE(coordinate);
+	int flows = 1;
+
+	if (mode == LBE_COORDINATE_OFF)
+		return 1;
+	if (e)
+		flows = atomic_read(&e->flows);
+	/* the sum lags behind, so it may not count e's flows yet */
+	if (mode == LBE_COORDINATE_HOST)
+		flows = max(flows, READ_ONCE(lbe_cache_host_sum));
+	return clamp(flows, 1, LBE_CACHE_MAX_FLOWS);
+}
+
+/* Add an entry for daddr with a first connection counted in */
+static struct lbe_cache_entry *lbe_cache_create(struct net *net,
+						const struct in6_addr *daddr)
+{
+	struct lbe_cache_entry *e;
+
+	spin_lock_bh(&lbe_cache_lock);
+	/* another connection may have added it meanwhile */
+	e = lbe_cache_find(net, daddr);
+	if (e) {
+		atomic_inc(&e->flows);
+		goto out;
+	}
+
+	if (atomic_read(&lbe_cache_entries) >= READ_ONCE(max_entries))
+		goto out;
+	e = kzalloc(sizeof(*e), GFP_ATOMIC);
+	if (!e)
+		goto out;
+
+	write_pnet(&e->net, net);
+	e->daddr = *daddr;
+	atomic_set(&e->flows, 1);
+	e->stamp = jiffies;
+	atomic_inc(&lbe_cache_entries);
+	hlist_add_head_rcu(&e->node, lbe_cache_bucket(net, daddr));
+out:
+	spin_unlock_bh(&lbe_cache_lock);
+	return e;
+}
+
+bool lbe_cache_join(const struct sock *sk, struct lbe_cache_seed *seed)
+{
+	struct net *net = sock_net(sk);
+	unsigned long life = lbe_cache_lifetime();
+	struct lbe_cache_entry *e;
+	struct in6_addr daddr;
+
+	memset(seed, 0, sizeof(*seed));
+	/* host-wide, connections count whether or not they have an entry */
+	this_cpu_inc(lbe_cache_host_flows);
+	if (!life) {
+		seed->flows = lbe_cache_flows(NULL);
+		return false;
+	}
+
+	lbe_cache_daddr(sk, &daddr);
+
+	rcu_read_lock();
+	e = lbe_cache_find(net, &daddr);
+	/* the reaper may have claimed it since, then it is added anew */
+	if (!e || !atomic_add_unless(&e->flows, 1, -1)) {
+		rcu_read_unlock();
+		e = lbe_cache_create(net, &daddr);
+		if (!e) {
+			seed->flows = lbe_cache_flows(NULL);
+			return false;
+		}
+		rcu_read_lock();
+	}
+
+	/* stale seeds of an entry not reaped yet are no better than none */
+	if (time_before(jiffies, READ_ONCE(e->stamp) + life)) {
+		seed->min_rtt_us = READ_ONCE(e->min_rtt_us);
+		seed->remote_scale = READ_ONCE(e->remote_scale);
+		seed->bw = READ_ONCE(e->bw);
+		seed->fractional_cwnd = READ_ONCE(e->fractional_cwnd);
+	}
+	seed->flows = lbe_cache_flows(e);
+	WRITE_ONCE(e->stamp, jiffies);
+	rcu_read_unlock();
+	return true;
+}
+EXPORT_SYMBOL_GPL(lbe_cache_join);
+
+void lbe_cache_leave(const struct sock *sk, bool cached)
+{
+	struct lbe_cache_entry *e;
+	struct in6_addr daddr;
+
+	this_cpu_dec(lbe_cache_host_flows);
+	if (!cached)
+		return;
+
+	lbe_cache_daddr(sk, &daddr);
+
+	rcu_read_lock();
+	e = lbe_cache_find(sock_net(sk), &daddr);
+	/* gone if its namespace went first */
+	if (e) {
+		atomic_dec_if_positive(&e->flows);
+		WRITE_ONCE(e->stamp, jiffies);
+	}
+	rcu_read_unlock();
+}
+EXPORT_SYMBOL_GPL(lbe_cache_leave);
+
+u8 lbe_cache_update(const struct sock *sk, const struct lbe_cache_seed *seed,
+		    u32 mask)
+{
+	struct lbe_cache_entry *e;
+	struct in6_addr daddr;
+	u8 flows;
+
+	lbe_cache_daddr(sk, &daddr);
+
+	rcu_read_lock();
+	e = lbe_cache_find(sock_net(sk), &daddr);
+	if (e) {
+		/* The last connection to report wins. Each one reports its
+		 * own windowed estimate, so a longer path after a route
+		 * change replaces the old minimum.
+		 */
+		if (mask & LBE_CACHE_MIN_RTT)
+			WRITE_ONCE(e->min_rtt_us, seed->min_rtt_us);
+		if (mask & LBE_CACHE_REMOTE_SCALE)
+			WRITE_ONCE(e->remote_scale, seed->remote_scale);
+		if (mask & LBE_CACHE_BW)
+			WRITE_ONCE(e->bw, seed->bw);
+		if (mask & LBE_CACHE_FWND)
+			WRITE_ONCE(e->fractional_cwnd, seed->fractional_cwnd);
+		WRITE_ONCE(e->stamp, jiffies);
+	}
+	flows = lbe_cache_flows(e);
+	rcu_read_unlock();
+	return flows;
+}
+EXPORT_SYMBOL_GPL(lbe_cache_update);
+
+static void lbe_cache_free(struct lbe_cache_entry *e)
+{
+	hlist_del_rcu(&e->node);
+	atomic_dec(&lbe_cache_entries);
+	kfree_rcu(e, rcu);
+}
+
+/* Remove the entries matching net, or those idle for lifetime if NULL */
+static void lbe_cache_flush(const struct net *net)
+{
+	unsigned long life = lbe_cache_lifetime();
+	struct lbe_cache_entry *e;
+	struct hlist_node *tmp;
+	int i;
+
+	spin_lock_bh(&lbe_cache_lock);
+	for (i = 0; i < ARRAY_SIZE(lbe_cache_hash); i++) {
+		hlist_for_each_entry_safe(e, tmp, &lbe_cache_hash[i], node) {
+			if (net) {
+				if (net_eq(read_pnet(&e->net), net))
+					lbe_cache_free(e);
+				continue;
+			}
+			/* claimed at 0 flows only, so no connection is
+			 * left counted in an entry that is gone
+			 */
+			if (time_after(jiffies, READ_ONCE(e->stamp) + life) &&
+			    atomic_cmpxchg(&e->flows, 0, -1) == 0)
+				lbe_cache_free(e);
+		}
+	}
+	spin_unlock_bh(&lbe_cache_lock);
+}
+
+static void lbe_cache_gc(struct work_struct *work)
+{
+	lbe_cache_flush(NULL);
+	schedule_delayed_work(&lbe_cache_gc_work, LBE_CACHE_GC_INTERVAL);
+}
+
+/* The periodic aggregation of the per-CPU counts. The sum is only
+ * written when it changes, so that the sockets reading it keep their
+ * copy of its cacheline while the number of connections holds.
+ */
+static void lbe_cache_host(struct work_struct *work)
+{
+	int sum = 0;
+	int cpu;
+
+	for_each_possible_cpu(cpu)
+		sum += per_cpu(lbe_cache_host_flows, cpu);
+	if (sum != READ_ONCE(lbe_cache_host_sum))
+		WRITE_ONCE(lbe_cache_host_sum, sum);
+	schedule_delayed_work(&lbe_cache_host_work, LBE_CACHE_HOST_INTERVAL);
+}
+
+static void __net_exit lbe_cache_net_exit(struct net *net)
+{
+	lbe_cache_flush(net);
+}
+
+static struct pernet_operations lbe_cache_net_ops = {
+	.exit	= lbe_cache_net_exit,
+};
+
+static int __init tcp_lbe_cache_register(void)
+{
+	int ret;
+
+	ret = register_pernet_subsys(&lbe_cache_net_ops);
+	if (ret)
+		return ret;
+
+	schedule_delayed_work(&lbe_cache_gc_work, LBE_CACHE_GC_INTERVAL);
+	schedule_delayed_work(&lbe_cache_host_work, LBE_CACHE_HOST_INTERVAL);
+	return 0;
+}
+
+static void __exit tcp_lbe_cache_unregister(void)
+{
+	struct lbe_cache_entry *e;
+	struct hlist_node *tmp;
+	int i;
+
+	cancel_delayed_work_sync(&lbe_cache_gc_work);
+	cancel_delayed_work_sync(&lbe_cache_host_work);
+	unregister_pernet_subsys(&lbe_cache_net_ops);
+
+	/* the modules using the cache are gone, and their sockets with them */
+	for (i = 0; i < ARRAY_SIZE(lbe_cache_hash); i++)
+		hlist_for_each_entry_safe(e, tmp, &lbe_cache_hash[i], node)
+			lbe_cache_free(e);
+	rcu_barrier();
+}
+
+module_init(tcp_lbe_cache_register);
+module_exit(tcp_lbe_cache_unregister);
+
+MODULE_LICENSE("GPL");
+MODULE_DESCRIPTION("TCP LBE per-destination cache");
+MODULE_VERSION("0.3");
@@ -0,0 +1,50 @@
+/*
+ * Per-destination cache of the LBE congestion controls
+ *
+ * What a connection learnt about the path to its peer, kept for the next
+ * connections to that peer, and the number of LBE connections to it now.
+ * Entries are keyed by network namespace and destination address, and
+ * outlive their last connection by the cache's lifetime.
+ */
+
+#ifndef _TCP_LBE_CACHE_H
+#define _TCP_LBE_CACHE_H
+
+#include <linux/types.h>
+
+struct sock;
+
+/* What is known of a destination. Every field but flows is 0 while unknown. */
+struct lbe_cache_seed {
+	u32 min_rtt_us;		/* propagation RTT, as baseRTT or a LEDBAT++ base delay */
+	u32 remote_scale;	/* usec per peer timestamp tick, << 16 */
+	u32 bw;			/* Westwood+LP bw_est, bytes per usec << 18 */
+	u8 fractional_cwnd;	/* Nice's window denominator, 2 when whole */
+	u8 flows;		/* LBE connections to share the bottleneck with,
+				 * this one included; 1 unless coordinate is set
+				 */
+};
+
+/* lbe_cache_update() mask */
+#define LBE_CACHE_MIN_RTT	0x1
+#define LBE_CACHE_REMOTE_SCALE	0x2
+#define LBE_CACHE_BW		0x4
+#define LBE_CACHE_FWND		0x8
+
+/* Count the connection in, host-wide and with its destination, and fill
+ * seed from what recent connections there left. Returns whether it was
+ * counted with its destination: false, with only flows in seed, if the
+ * cache is off or full, or out of memory. It is counted host-wide in any
+ * case, so every connection that joined must call lbe_cache_leave() once,
+ * passing what lbe_cache_join() returned.
+ */
+bool lbe_cache_join(const struct sock *sk, struct lbe_cache_seed *seed);
+void lbe_cache_leave(const struct sock *sk, bool cached);
+
+/* Store the fields of seed in mask for the connection's destination, if
+ * it has an entry, and return flows as in struct lbe_cache_seed.
+ */
+u8 lbe_cache_update(const struct sock *sk, const struct lbe_cache_seed *seed,
+		    u32 mask);
+
+#endif /* _TCP_LBE_CACHE_H */
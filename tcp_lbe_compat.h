@@ -0,0 +1,233 @@
+/*
+ * Kernel version compatibility for the LBE congestion controls
+ *
+ * The modules are written against the interfaces of current kernels.
+ * This header provides them, or the nearest equivalent, on older kernels
+ * back to 4.4, so that each module builds unchanged across versions.
+ */
+
+#ifndef _TCP_LBE_COMPAT_H
+#define _TCP_LBE_COMPAT_H
+
+#include <linux/version.h>
+#include <linux/proc_fs.h>
+#include <linux/seq_file.h>
+#include <linux/sysctl.h>
+#include <net/net_namespace.h>
+#include <net/tcp.h>
+
+/* tp->snd_cwnd accessors (5.19). Some stable series have them too, so
+ * the fallbacks are renamed rather than risk a second definition.
+ */
+#if LINUX_VERSION_CODE < KERNEL_VERSION(5, 19, 0)
+static inline u32 lbe_tcp_snd_cwnd(const struct tcp_sock *tp)
+{
+	return tp->snd_cwnd;
+}
+
+static inline void lbe_tcp_snd_cwnd_set(struct tcp_sock *tp, u32 val)
+{
+	tp->snd_cwnd = val;
+}
+#define tcp_snd_cwnd		lbe_tcp_snd_cwnd
+#define tcp_snd_cwnd_set	lbe_tcp_snd_cwnd_set
+#endif
+
+/* pkts_acked() takes a struct ack_sample from 4.7. The modules implement
+ * that form; before 4.7, LBE_PKTS_ACKED_COMPAT(fn) defines the wrapper
+ * with the old (sk, cnt, rtt_us) signature that LBE_PKTS_ACKED(fn) names.
+ */
+#if LINUX_VERSION_CODE < KERNEL_VERSION(4, 7, 0)
+struct ack_sample {
+	u32 pkts_acked;
+	s32 rtt_us;
+};
+
+#define LBE_PKTS_ACKED_COMPAT(fn)					\
+static void fn##_compat(struct sock *sk, u32 cnt, s32 rtt_us)		\
+{									\
+	const struct ack_sample sample = {				\
+		.pkts_acked	= cnt,					\
+		.rtt_us		= rtt_us,				\
+	};								\
+									\
+	fn(sk, &sample);						\
+}
+#define LBE_PKTS_ACKED(fn)	fn##_compat
+#else
+#define LBE_PKTS_ACKED_COMPAT(fn)
+#define LBE_PKTS_ACKED(fn)	fn
+#endif
+
+/* Rate samples and cong_control() (4.9), which gains the ACK and its
+ * flags as arguments in 6.10. As for pkts_acked(), the modules implement
+ * the current form and LBE_CONG_CONTROL(fn) names what the ops take.
+ */
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(4, 9, 0)
+#define LBE_HAVE_RATE_SAMPLE
+#endif
+
+#if LINUX_VERSION_CODE < KERNEL_VERSION(6, 10, 0)
+#define LBE_CONG_CONTROL_COMPAT(fn)					\
+static void fn##_compat(struct sock *sk, const struct rate_sample *rs)	\
+{									\
+	fn(sk, tcp_sk(sk)->snd_una, 0, rs);				\
+}
+#define LBE_CONG_CONTROL(fn)	fn##_compat
+#else
+#define LBE_CONG_CONTROL_COMPAT(fn)
+#define LBE_CONG_CONTROL(fn)	fn
+#endif
+
+#ifdef LBE_HAVE_RATE_SAMPLE
+/* What tcp_cong_control() does around cong_avoid(), left to cong_control()
+ * when a module has one. As tcp_may_raise_cwnd(), static in tcp_input.c,
+ * cwnd only grows on ACKs of new data, or of any data newly delivered when
+ * the path reorders more than net.ipv4.tcp_reordering. @data_acked stands
+ * in for FLAG_DATA_ACKED, which cong_control() is only passed from 6.10 and
+ * whose value is private; pkts_acked() sees it as a non-zero pkts_acked.
+ */
+static inline bool lbe_may_raise_cwnd(const struct sock *sk, bool data_acked,
+				      u32 acked_sacked)
+{
+	if (tcp_sk(sk)->reordering >
+	    READ_ONCE(sock_net(sk)->ipv4.sysctl_tcp_reordering))
+		return acked_sacked;
+	return data_acked;
+}
+
+/* As tcp_cwnd_reduction(), which modules cannot call: proportional rate
+ * reduction towards ssthresh. Without the ACK's flags, once no more than
+ * ssthresh is in flight this is the conservative bound of RFC 6937.
+ */
+static inline void lbe_cwnd_reduction(struct sock *sk, u32 acked_sacked)
+{
+	struct tcp_sock *tp = tcp_sk(sk);
+	int delta = tp->snd_ssthresh - tcp_packets_in_flight(tp);
+	int sndcnt;
+
+	if (!acked_sacked || !tp->prior_cwnd)
+		return;
+
+	tp->prr_delivered += acked_sacked;
+	if (delta < 0) {
+		u64 dividend = (u64)tp->snd_ssthresh * tp->prr_delivered +
+			       tp->prior_cwnd - 1;
+
+		sndcnt = div_u64(dividend, tp->prior_cwnd) - tp->prr_out;
+	} else {
+		sndcnt = min_t(int, delta, acked_sacked);
+	}
+	/* Let the fast retransmit out on the first ACK */
+	sndcnt = max(sndcnt, tp->prr_out ? 0 : 1);
+	tcp_snd_cwnd_set(tp, tcp_packets_in_flight(tp) + sndcnt);
+}
+
+/* As tcp_update_pacing_rate(): twice cwnd per RTT in slow start and 1.2
+ * times after, the defaults of net.ipv4.tcp_pacing_ss_ratio and
+ * tcp_pacing_ca_ratio.
+ */
+static inline void lbe_update_pacing_rate(struct sock *sk)
+{
+	const struct tcp_sock *tp = tcp_sk(sk);
+	u64 rate = (u64)tp->mss_cache * ((USEC_PER_SEC / 100) << 3);
+
+	rate *= max(tcp_snd_cwnd(tp), tp->packets_out);
+	rate *= tcp_snd_cwnd(tp) < tp->snd_ssthresh / 2 ? 200 : 120;
+	if (likely(tp->srtt_us))
+		rate = div_u64(rate, tp->srtt_us);
+	sk->sk_pacing_rate = min_t(u64, rate, sk->sk_max_pacing_rate);
+}
+#endif
+
+/* undo_cwnd() is mandatory from 4.13, when tcp_reno_undo_cwnd() was
+ * exported. Before, the stack did this itself when a module had none.
+ */
+#if LINUX_VERSION_CODE < KERNEL_VERSION(4, 13, 0)
+static inline u32 tcp_reno_undo_cwnd(struct sock *sk)
+{
+	const struct tcp_sock *tp = tcp_sk(sk);
+
+	return max(tcp_snd_cwnd(tp), tp->snd_ssthresh << 1);
+}
+#endif
+
+/* Rate of the local TCP timestamp clock, i.e. of rx_opt.rcv_tsecr:
+ * jiffies before 4.13, ms since, and usec on connections that negotiated
+ * usec timestamps (6.7).
+ */
+static inline u32 lbe_tcp_ts_hz(const struct tcp_sock *tp)
+{
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(6, 7, 0)
+	if (tp->tcp_usec_ts)
+		return USEC_PER_SEC;
+#endif
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(4, 13, 0)
+	return TCP_TS_HZ;
+#else
+	return HZ;
+#endif
+}
+
+/* Minimum RTT in usec over the last tcp_min_rtt_wlen seconds, tracked
+ * by the stack from 4.6; ~0U before the first sample. Older kernels do
+ * not track it, and 0 stands for unknown.
+ */
+static inline u32 lbe_tcp_min_rtt(const struct tcp_sock *tp)
+{
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(4, 6, 0)
+	return tcp_min_rtt(tp);
+#else
+	return 0;
+#endif
+}
+
+/* proc_create_single() (4.18); file_operations no longer work for proc
+ * files from 5.6, so this is the one way to create them on both sides.
+ */
+#if LINUX_VERSION_CODE < KERNEL_VERSION(4, 18, 0)
+static int lbe_single_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, PDE_DATA(inode), NULL);
+}
+
+static const struct file_operations lbe_single_fops = {
+	.owner		= THIS_MODULE,
+	.open		= lbe_single_open,
+	.read		= seq_read,
+	.llseek		= seq_lseek,
+	.release	= single_release,
+};
+
+#define proc_create_single(name, mode, parent, show)			\
+	proc_create_data(name, mode, parent, &lbe_single_fops, show)
+#endif
+
+/* proc_handler arguments: the buffer is a kernel pointer from 5.8 and
+ * the table const from 6.11.
+ */
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(6, 11, 0)
+#define LBE_CTL_TABLE		const struct ctl_table
+#else
+#define LBE_CTL_TABLE		struct ctl_table
+#endif
+
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(5, 8, 0)
+#define LBE_SYSCTL_BUFFER	void *
+#else
+#define LBE_SYSCTL_BUFFER	void __user *
+#endif
+
+/* Sysctl tables are sized rather than terminated from 6.5. The templates
+ * keep their empty terminating entry for older kernels, and the copy
+ * registered from them is one entry shorter than the template.
+ */
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(6, 5, 0)
+#define lbe_register_net_sysctl(net, path, table, template)		\
+	register_net_sysctl_sz(net, path, table, ARRAY_SIZE(template) - 1)
+#else
+#define lbe_register_net_sysctl(net, path, table, template)		\
+	register_net_sysctl(net, path, table)
+#endif
+
+#endif /* _TCP_LBE_COMPAT_H */
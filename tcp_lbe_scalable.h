@@ -0,0 +1,37 @@
+/*
+ * Scalable growth of the LBE congestion controls
+ *
+ * With the scalable option, a connection that has seen no queue for
+ * LBE_SCALABLE_RTTS RTTs grows as Scalable TCP does, by 1/LBE_SCALABLE_AI_CNT
+ * of its window per RTT, instead of by one packet per RTT. An idle path
+ * of any size is then filled in a few hundred RTTs rather than in as
+ * many RTTs as it has packets. Each module leaves the mode at its first
+ * congestion signal, be it a queue, a CE mark or a loss, and goes back to
+ * its own growth.
+ */
+
+#ifndef _TCP_LBE_SCALABLE_H
+#define _TCP_LBE_SCALABLE_H
+
+#include <net/tcp.h>
+
+#include "tcp_lbe_compat.h"
+
+#define LBE_SCALABLE_RTTS	4	/* RTTs without a queue before scaling */
+#define LBE_SCALABLE_AI_CNT	100U	/* as tcp_scalable: cwnd / 100 per RTT */
+
+/* Scalable TCP's per-ACK increase, for windows out of slow start. Below
+ * LBE_SCALABLE_AI_CNT packets it is Reno's.
+ */
+static inline void lbe_scalable_cong_avoid(struct tcp_sock *tp, u32 acked)
+{
+	tcp_cong_avoid_ai(tp, min(tcp_snd_cwnd(tp), LBE_SCALABLE_AI_CNT), acked);
+}
+
+/* The same, for controls that change cwnd once per RTT */
+static inline u32 lbe_scalable_rtt_increase(u32 cwnd)
+{
+	return max(cwnd / LBE_SCALABLE_AI_CNT, 1U);
+}
+
+#endif /* _TCP_LBE_SCALABLE_H */
@@ -12,21 +12,36 @@
 #include <linux/mm.h>
 #include <linux/skbuff.h>
 #include <linux/inet_diag.h>
+#include <net/netns/generic.h>
 #include <net/tcp.h>
 #include <linux/random.h>
 
+#include "tcp_lbe_compat.h"
+#include "tcp_lbe_scalable.h"
+#include "tcp_ledbat.h"
+#include "tcp_ledbat_trace.h"
+
 #define GAIN 1 /* GAIN MUST be set to 1 or less. */
 #define ALLOWED_INCREASE 1 /* ALLOWED_INCREASE SHOULD be 1, and it MUST be greater than 0 */
 #define MIN_CWND 2U
 
-#define HZ_WEIGHT 3
-
 static int target __read_mostly = 100;
 module_param(target, int, 0);
 MODULE_PARM_DESC(target, "TARGET is the maximum queueing delay that LEDBAT itself may introduce in the network.");
 
+/* Microsecond delay estimation, for paths whose base delay is close to
+ * or below the jiffy granularity of TCP timestamps
+ */
+static bool usec_delay __read_mostly;
+module_param(usec_delay, bool, 0);
+MODULE_PARM_DESC(usec_delay, "Measure one-way delay in microseconds and use target_us as TARGET.");
+static int target_us __read_mostly = 100000;
+module_param(target_us, int, 0);
+MODULE_PARM_DESC(target_us, "TARGET in microseconds, used when usec_delay is set.");
+
 /* Current_FILTER SHOULD be 1;
  * it MAY be tuned so that it is at least 1 and no more than cwnd/2 
+ * (capped at LEDBAT_MAX_CURRENT_FILTER)
  */
 static int current_filter __read_mostly = 2; 
 module_param(current_filter, int, 0);
@@ -34,230 +49,214 @@ MODULE_PARM_DESC(current_filter, "Maintain a list of CURRENT_FILTER last delays
 
 /* BASE_HISTORY SHOULD be 2;
  * it MUST be no less than 2 and SHOULD NOT be more than 10 
+ * (capped at LEDBAT_MAX_BASE_HISTORY)
  */
 static int base_history __read_mostly = 2;
 module_param(base_history, int, 0);
-MODULE_PARM_DESC(base_history, "Maintain BASE_HISTORY delay-minima where each minimum is measured over a period of a minute.");
+MODULE_PARM_DESC(base_history, "Maintain BASE_HISTORY delay-minima where each minimum is measured over a period of base_epoch seconds.");
 
+/* A minute in RFC6817; shorter where the path changes often */
+static int base_epoch __read_mostly = 60;
+module_param(base_epoch, int, 0);
+MODULE_PARM_DESC(base_epoch, "Length of each BASE_HISTORY period in seconds.");
 
-struct ledbat_list {
-	u32 *buffer;
-	u8 next;
-	u8 len;
-};
-   
-/* ledbat structure */
-struct ledbat {
-  u32 base_delay;
-  s32 cwnd_cnt;
-
-  struct ledbat_list current_delays;
-  struct ledbat_list base_delays; 
+/* Adaptive TARGET: a fraction of the base RTT, e.g. 50 for queues of up
+ * to half of it, within the two bounds
+ */
+static int target_ratio __read_mostly;
+module_param(target_ratio, int, 0);
+MODULE_PARM_DESC(target_ratio, "TARGET as a percentage of the base RTT, recomputed at each base history rollover; 0 for a fixed TARGET.");
+static int target_min_us __read_mostly = 1000;
+module_param(target_min_us, int, 0);
+MODULE_PARM_DESC(target_min_us, "Lower bound of the adaptive TARGET in microseconds.");
+static int target_max_us __read_mostly = 100000;
+module_param(target_max_us, int, 0);
+MODULE_PARM_DESC(target_max_us, "Upper bound of the adaptive TARGET in microseconds.");
+
+/* Scalable TCP growth while the path shows no queue, see tcp_lbe_scalable.h */
+static bool scalable __read_mostly;
+module_param(scalable, bool, 0);
+MODULE_PARM_DESC(scalable, "Grow as Scalable TCP after 4 RTTs without queuing delay, until the first delay, CE mark or loss.");
+
+/* Negotiate ECN and take CE marks as congestion that the delay has not
+ * shown yet. Read when the module registers, as it sets the ops' flags.
+ */
+static bool ecn __read_mostly;
+module_param(ecn, bool, 0444);
+MODULE_PARM_DESC(ecn, "Negotiate ECN and count CE marked packets as queuing delay above TARGET.");
 
-  u32 last_rollover; /* This is to be interpreted as time */
-  
-  u32 remote_hz;
-  u32 last_local_ts;
-  u32 last_remote_ts;
-  u32 local_time_offset;
-  u32 remote_time_offset;
-  
-};
 
+/* The parameters above are the defaults of each network namespace,
+ * which can then be tuned through net.ipv4.tcp_ledbat sysctls.
+ */
+static unsigned int ledbat_net_id __read_mostly;
 
-static void ledbat_init_list(struct ledbat_list *list, int len)
+static int __net_init ledbat_net_init(struct net *net)
 {
-	list->buffer = kmalloc( len * sizeof(u32), GFP_KERNEL);
-        if (list->buffer !=  NULL) {
-           int i;
-           for (i=0; i<len; i++)
-             list->buffer[i] = UINT_MAX;
-        }
-	list->len = len;
-	list->next = 0;
+	const struct ledbat_params defaults = {
+		.target		= target,
+		.target_us	= target_us,
+		.current_filter	= current_filter,
+		.base_history	= base_history,
+		.usec_delay	= usec_delay,
+		.base_epoch	= base_epoch,
+		.target_ratio	= target_ratio,
+		.target_min_us	= target_min_us,
+		.target_max_us	= target_max_us,
+		.scalable	= scalable,
+	};
+
+	return tcp_ledbat_core_net_init(net, ledbat_net_id, LEDBAT_RFC6817,
+					"net/ipv4/tcp_ledbat", &defaults);
 }
 
+static void __net_exit ledbat_net_exit(struct net *net)
+{
+	tcp_ledbat_core_net_exit(net_generic(net, ledbat_net_id));
+}
 
-static void tcp_ledbat_init(struct sock *sk){  
-
-  struct ledbat *ledbat = inet_csk_ca(sk);
-
-  ledbat->base_delay = UINT_MAX;
-  ledbat->cwnd_cnt = 0; 
-
-  ledbat_init_list(&ledbat->current_delays, current_filter);
-  ledbat_init_list(&ledbat->base_delays, base_history);
-
-  ledbat->last_rollover = 0;
-
-  ledbat->local_time_offset = 0;
-  ledbat->remote_time_offset = 0;
-  ledbat->last_local_ts=0;
-  ledbat->last_remote_ts=0;
-  ledbat->remote_hz = HZ;
+static struct pernet_operations ledbat_net_ops = {
+	.init	= ledbat_net_init,
+	.exit	= ledbat_net_exit,
+	.id	= &ledbat_net_id,
+	.size	= sizeof(struct ledbat_net),
+};
 
-}
 
-static void tcp_ledbat_release(struct sock *sk){
+/* RFC6817 state on top of the shared delay estimation core */
+struct ledbat_rfc {
+  struct ledbat core;
+  s32 cwnd_cnt;
+  u32 ecn_alpha;	/* fraction of CE marked packets, << LEDBAT_ECN_SHIFT */
+};
 
-  struct ledbat *ledbat = inet_csk_ca(sk);
-  kfree(ledbat->current_delays.buffer);
-  kfree(ledbat->base_delays.buffer);
+/* With the ecn option, the fraction of packets the peer echoes as CE
+ * marked is kept as DCTCP's alpha: a moving average with a gain of
+ * 1/2^LEDBAT_ECN_G per window of data. The average is updated per ACK
+ * for the packets it covers, rather than once per window, so it needs no
+ * state for the window. The stack itself still enters CWR at the first
+ * ECE and halves cwnd, within one RTT; alpha then keeps LEDBAT from
+ * growing back while marks go on, by counting as queuing delay: all
+ * packets marked count as twice TARGET, so that cwnd shrinks above half
+ * of them.
+ */
+#define LEDBAT_ECN_SHIFT 20
+#define LEDBAT_ECN_G 4
 
-}
 
-void tcp_ledbat_update_current_delay(struct sock *sk, int delay){
+static void tcp_ledbat_init(struct sock *sk){  
 
-  struct ledbat *ledbat = inet_csk_ca(sk);
+  struct ledbat_rfc *ledbat = inet_csk_ca(sk);
+  struct ledbat_net *ln = net_generic(sock_net(sk), ledbat_net_id);
 
-  /* Maintain a list of CURRENT_FILTER last delays observed. */
-  /* delete first item in current_delays list
-   * append delay to current_delays list
-   */
+  tcp_ledbat_core_init(sk, &ln->params, LEDBAT_RFC6817);
+  ledbat->cwnd_cnt = 0; 
+  ledbat->ecn_alpha = 0;
 
-  ledbat->current_delays.buffer[ledbat->current_delays.next] = delay;
-  ledbat->current_delays.next++; 
-  if (ledbat->current_delays.next == current_filter)
-     ledbat->current_delays.next=0; 
- 
 }
 
-void tcp_ledbat_update_base_delay(struct sock *sk, u32 delay) {
+static void tcp_ledbat_in_ack_event(struct sock *sk, u32 flags){
 
   struct ledbat *ledbat = inet_csk_ca(sk);
+  bool ece = flags & CA_ACK_ECE;
 
-  /* Maintain BASE_HISTORY min delays. Each represents a minute.*/
-  /* if round_to_minute(now) != round_to_minute(last_rollover)
-   *   last_rollover = now
-   *   forget the earliest of base delays
-   *   add delay to the end of base_delays
-   * else
-   *   last of base_delays = min(last of base_delays, delay)
-   */
-
-  if (get_seconds() >= ledbat->last_rollover + 60) { 
-     ledbat->last_rollover = get_seconds(); 
-     ledbat->base_delays.next++; 
-     if (ledbat->base_delays.next == base_history)
-        ledbat->base_delays.next=0; 
-     ledbat->base_delays.buffer[ledbat->base_delays.next] = delay;
-  } else {
-     ledbat->base_delays.buffer[ledbat->base_delays.next] = 
-          min(ledbat->base_delays.buffer[ledbat->base_delays.next], delay);
-  }
-
+  // stored only when it changes, which it rarely does
+  if (ece != !!(ledbat->flags & LEDBAT_F_ECE))
+    ledbat->flags ^= LEDBAT_F_ECE;
 }
 
-u32 tcp_ledbat_get_min_from_list(struct ledbat_list *list) {  
+static void tcp_ledbat_pkts_acked(struct sock *sk, const struct ack_sample *sample){
 
-  u32 min_delay = UINT_MAX;
-  int i;
-  for (i=0; i<list->len; i++) {
-     min_delay = min(list->buffer[i], min_delay);
-  }
-  return min_delay;
+  struct ledbat_rfc *ledbat = inet_csk_ca(sk);
+  bool ce = ledbat->core.flags & LEDBAT_F_ECE;
+  u32 alpha = ledbat->ecn_alpha;
+  u32 acked, window;
 
-}
+  // nothing to decay and nothing marked
+  if (!alpha && !ce)
+    return;
 
-static inline u32 time_in_ms(void)
-{
-#if HZ < 1000
-	return ktime_to_ms(ktime_get_real());
-#else
-	return jiffies_to_msecs(jiffies);
-#endif
-}
+  window = max(tcp_snd_cwnd(tcp_sk(sk)), 1U) << LEDBAT_ECN_G;
+  acked = min(sample->pkts_acked, window);
 
-/* curently not used because doesn't work correctly 
- * as you should only estimate the HZ is there is no queuing delay...
- */
-static void estimate_remote_HZ(struct sock *sk){
-
-   struct tcp_sock *tp = tcp_sk(sk);
-   struct ledbat *ledbat = inet_csk_ca(sk);
-
-   int local_delta = 1;
-   int remote_delta = 1;
- 
-    //check which one has the higher delta -> this is the fine grained clock
-    //we know our own clock granularity
-    //HZ_remote= remote_delta * HZ_local /our_delta
-   if (ledbat->last_remote_ts!=0 && tp->rx_opt.rcv_tsval != ledbat->last_remote_ts 
-	&& ledbat->last_local_ts!=0 && tp->rx_opt.rcv_tsecr != ledbat->last_local_ts){
-      remote_delta = tp->rx_opt.rcv_tsval - ledbat->last_remote_ts;
-      local_delta = tp->rx_opt.rcv_tsecr - ledbat->last_local_ts;
-
-      u32 tmp_remote_hz = HZ * (remote_delta) / (local_delta);
-
-      ledbat->remote_hz = ledbat->remote_hz - (ledbat->remote_hz >> HZ_WEIGHT) +
-                          (tmp_remote_hz >> HZ_WEIGHT);
-   }
-
-   //remember last HZ value for remote and local
-   ledbat->last_remote_ts = tp->rx_opt.rcv_tsval;
-   ledbat->last_local_ts = tp->rx_opt.rcv_tsecr;
+  // rounded up, so that alpha decays all the way to 0
+  alpha -= min_t(u64, alpha, div_u64((u64)acked * alpha + window - 1, window));
+  if (ce)
+    alpha = min_t(u64, 1U << LEDBAT_ECN_SHIFT,
+		  alpha + div_u64((u64)acked << LEDBAT_ECN_SHIFT, window));
+  ledbat->ecn_alpha = alpha;
 }
+LBE_PKTS_ACKED_COMPAT(tcp_ledbat_pkts_acked)
 
 void tcp_ledbat_cong_avoid(struct sock *sk, u32 ack, u32 acked) {
 
    struct tcp_sock *tp = tcp_sk(sk);  
-   struct ledbat *ledbat = inet_csk_ca(sk);
+   struct ledbat_rfc *ledbat = inet_csk_ca(sk);
 
-   u32 delay = 0;
    u32 queuing_delay;
+   int tgt;
    int off_target;
-   u32 cwnd;
+   s64 cwnd_cnt, thresh;
+   u32 cwnd, prior_cwnd;
    u32 max_allowed_cwnd;
 
-   //estimate the remote peers time granularity -> doesn't work and therefore not used
-   //estimate_remote_HZ(sk);
-
-   // remember first timestamp of local and remote host as base
-   if (ledbat->remote_time_offset == 0)
-     ledbat->remote_time_offset = tp->rx_opt.rcv_tsval;
-   if (ledbat->local_time_offset == 0)
-     ledbat->local_time_offset = tp->rx_opt.rcv_tsecr;
-   
-   //calculate current OWD
-   //delay * 1000 * 1/HZ; -> Result in [s]. Multiply by 1000 for [ms]
-   u32 time = (tp->rx_opt.rcv_tsval - ledbat->remote_time_offset)*1000/ledbat->remote_hz;
-   u32 remote_time = (tp->rx_opt.rcv_tsecr - ledbat->local_time_offset)*1000/HZ;
-   if (time > remote_time)
-      delay = time - remote_time;
-   
-   // update delays
-   tcp_ledbat_update_base_delay(sk, delay);
-   tcp_ledbat_update_current_delay(sk, delay);
-   ledbat->base_delay = min(ledbat->base_delay, delay);
-
-   // calculate queuing delay
-   if (ledbat->current_delays.buffer!=NULL && ledbat->base_delays.buffer!=NULL) {
-      queuing_delay = tcp_ledbat_get_min_from_list(&ledbat->current_delays) - 
-   	   tcp_ledbat_get_min_from_list(&ledbat->base_delays);
-   } else {
-      queuing_delay = delay - ledbat->base_delay;
-   }
+   /* Delay samples feed the filters whether or not cwnd is used, app
+    * limited ACKs bringing the best base delay samples of all.
+    */
+   queuing_delay = tcp_ledbat_core_update(sk);
 
    /* don't change cwnd is not cwnd-limited */
    if (!tcp_is_cwnd_limited(sk))
 	return;
 
+   tgt = ledbat->core.target;
+
+   /* CE marks as queuing delay: 2 * TARGET * alpha */
+   if (ledbat->ecn_alpha)
+      queuing_delay += ((u64)tgt * ledbat->ecn_alpha) >> (LEDBAT_ECN_SHIFT - 1);
+
    /* In "safe" area, increase exponentially. */
-   if (tp->snd_cwnd <= tp->snd_ssthresh) {
+   if (tcp_snd_cwnd(tp) <= tp->snd_ssthresh) {
 	acked = tcp_slow_start(tp, acked);
 	if (!acked)
 	   return;
    }
 
    /* LEDABT cwnd increase/decrease */
-   cwnd = tp->snd_cwnd;
-   off_target = target - queuing_delay;
-   ledbat->cwnd_cnt += GAIN * off_target * acked;
-   if (abs(ledbat->cwnd_cnt) >= tp->snd_cwnd*target) {
-      long inc =  ledbat->cwnd_cnt/((long)target)/((long)tp->snd_cwnd);
+   cwnd = prior_cwnd = tcp_snd_cwnd(tp);
+   off_target = tgt - queuing_delay;
+   // 64-bit, as cwnd*target no longer fits 32 bits with usec targets
+   thresh = (s64)tcp_snd_cwnd(tp)*tgt;
+   if (unlikely(ledbat->core.flags & LEDBAT_F_SCALING)) {
+      /* no queue for a while: Scalable TCP's increase, in cwnd_cnt's
+       * stead, which stays as it was
+       */
+      lbe_scalable_cong_avoid(tp, acked);
+      cwnd = tcp_snd_cwnd(tp);
+      cwnd_cnt = ledbat->cwnd_cnt;
+   } else if (off_target >= 0) {
+      s64 inc = (s64)GAIN * off_target * acked;
+
+      // parallel LBE flows through the bottleneck share one GAIN
+      if (unlikely(ledbat->core.flows > 1))
+	 inc = div_s64(inc, ledbat->core.flows);
+      cwnd_cnt = ledbat->cwnd_cnt + inc;
+   } else {
+      /* A stretch ACK brings one delay sample for many segments. Increases
+       * are credited for all of them, but a decrease counts at most one
+       * window of them, and at most half a packet each, so that cwnd
+       * shrinks by no more than half per RTT however the ACKs come.
+       */
+      s64 dec = max((s64)GAIN * off_target, -thresh / 2);
+
+      cwnd_cnt = ledbat->cwnd_cnt + dec * min(acked, tcp_snd_cwnd(tp));
+   }
+   if (cwnd_cnt >= thresh || cwnd_cnt <= -thresh) {
+      s64 inc = div64_s64(cwnd_cnt, thresh);
       cwnd += inc;
-      ledbat->cwnd_cnt -= inc*tp->snd_cwnd*target;
+      cwnd_cnt -= inc*thresh;
    }
+   ledbat->cwnd_cnt = clamp_t(s64, cwnd_cnt, S32_MIN, S32_MAX);
 
    // From RFC6817: max_allowed_cwnd = flightsize + ALLOWED_INCREASE * MSS
    max_allowed_cwnd = tp->packets_out + acked + ALLOWED_INCREASE;
@@ -266,11 +265,14 @@ void tcp_ledbat_cong_avoid(struct sock *sk, u32 ack, u32 acked) {
    // cwnd = max(MIN_CWND, min(cwnd, tp->snd_cwnd_clamp));
 
    // set cwnd
-   tp->snd_cwnd = max(MIN_CWND, cwnd);
+   tcp_snd_cwnd_set(tp, max(MIN_CWND, cwnd));
 
    // also adapt ssthreash if the cwnd is reduced!
-   if (tp->snd_cwnd <= tp->snd_ssthresh)
-      tp->snd_ssthresh = tp->snd_cwnd-1;
+   if (tcp_snd_cwnd(tp) <= tp->snd_ssthresh)
+      tp->snd_ssthresh = tcp_snd_cwnd(tp)-1;
+
+   trace_ledbat_cong_avoid(sk, &ledbat->core, queuing_delay, off_target,
+			   prior_cwnd);
 }
 EXPORT_SYMBOL_GPL(tcp_ledbat_cong_avoid);
 
@@ -278,18 +280,39 @@ EXPORT_SYMBOL_GPL(tcp_ledbat_cong_avoid);
 static struct tcp_congestion_ops tcp_ledbat = {
   .init = tcp_ledbat_init,
   .ssthresh = tcp_reno_ssthresh,
-  .release = tcp_ledbat_release,
+  .undo_cwnd = tcp_reno_undo_cwnd,
   .cong_avoid = tcp_ledbat_cong_avoid,
+  .get_info = tcp_ledbat_core_get_info,
+  .release = tcp_ledbat_core_release,
+  .set_state = tcp_ledbat_core_set_state,
+  .owner = THIS_MODULE,
   .name = "ledbat",
 };
   
 static int __init tcp_ledbat_register(void){
-  BUILD_BUG_ON(sizeof(struct ledbat) > ICSK_CA_PRIV_SIZE);
-  tcp_register_congestion_control(&tcp_ledbat);
+  int ret;
+
+  BUILD_BUG_ON(sizeof(struct ledbat_rfc) > ICSK_CA_PRIV_SIZE);
+
+  if (ecn) {
+    tcp_ledbat.flags |= TCP_CONG_NEEDS_ECN;
+    tcp_ledbat.in_ack_event = tcp_ledbat_in_ack_event;
+    tcp_ledbat.pkts_acked = LBE_PKTS_ACKED(tcp_ledbat_pkts_acked);
+  }
+
+  ret = register_pernet_subsys(&ledbat_net_ops);
+  if (ret)
+    return ret;
+
+  ret = tcp_register_congestion_control(&tcp_ledbat);
+  if (ret)
+    unregister_pernet_subsys(&ledbat_net_ops);
+  return ret;
 }
 
 static void __exit tcp_ledbat_unregister(void){
   tcp_unregister_congestion_control(&tcp_ledbat);
+  unregister_pernet_subsys(&ledbat_net_ops);
 }
 
 module_init(tcp_ledbat_register);
@@ -0,0 +1,147 @@
+/*
+ * LEDBAT delay estimation core
+ *
+ * One-way delay estimation and the current/base delay filters shared by
+ * the LEDBAT congestion control variants (tcp_ledbat, tcp_apledbat,
+ * tcp_ledbatpp).
+ * Each variant embeds struct ledbat as the first member of its private
+ * congestion control area and only supplies its own cwnd policy.
+ */
+
+#ifndef _TCP_LEDBAT_H
+#define _TCP_LEDBAT_H
+
+#include <linux/kernel.h>
+#include <linux/types.h>
+
+struct sock;
+struct net;
+struct ctl_table_header;
+union tcp_cc_info;
+
+/* The delay filters are kept inline in the congestion control private
+ * area, so their capacity is bounded at compile time. Larger module
+ * parameters are clamped to these bounds when a socket is initialised.
+ */
+#define LEDBAT_MAX_CURRENT_FILTER 1024
+#define LEDBAT_MAX_BASE_HISTORY 10
+
+/* Both within LEDBAT_MAX_BASE_HISTORY */
+struct ledbat_list {
+	u8 next:4,
+	   len:4;
+};
+
+/* Running minimum over a sliding window of samples (Kathleen Nichols'
+ * algorithm, as in lib/win_minmax.c). The best, 2nd best and 3rd best
+ * samples of successive sub-windows are kept, so the minimum is
+ * available in O(1) whatever the window length. Time is a 16-bit
+ * sample counter, which bounds LEDBAT_MAX_CURRENT_FILTER.
+ */
+struct ledbat_minmax {
+	u32 v[3];
+	u16 t[3];
+	u16 win;
+};
+
+/* ledbat->flags */
+#define LEDBAT_F_USEC	0x1	/* delays and target are in usec rather than ms */
+#define LEDBAT_F_OVER	0x2	/* queuing delay was above target at the last sample */
+#define LEDBAT_F_RTT	0x4	/* delays are RTT samples in usec (LEDBAT++) */
+#define LEDBAT_F_ECE	0x8	/* the ACK being processed has ECE (ecn option) */
+#define LEDBAT_F_CACHED	0x10	/* counted in with its destination by tcp_lbe_cache */
+#define LEDBAT_F_ADAPT	0x20	/* TARGET follows the base RTT, see target_ratio */
+#define LEDBAT_F_SCALABLE 0x40	/* scalable option, see tcp_lbe_scalable.h */
+#define LEDBAT_F_SCALING 0x80	/* no queue for LBE_SCALABLE_RTTS RTTs: cwnd scales */
+
+/* LEDBAT variants, for the host-wide statistics */
+enum ledbat_variant {
+	LEDBAT_RFC6817,
+	LEDBAT_APPLE,
+	LEDBAT_PLUSPLUS,
+	LEDBAT_NR_VARIANTS,
+};
+
+/* ledbat structure. Fields read on every ACK come first, so that with
+ * the variant's cwnd state they span as few cachelines as possible; of
+ * them, ACKs in steady state only write current_delays and current_seq.
+ * It takes 96 bytes, which with the variants' own state only fits the
+ * 104 byte ICSK_CA_PRIV_SIZE of 5.1 and later kernels.
+ */
+struct ledbat {
+	struct ledbat_minmax current_delays;
+	u16 current_seq;		/* sample clock of current_delays */
+	struct ledbat_list base_delays;
+	u8 flags;
+	u32 base_min;			/* minimum of base_buffer */
+	u32 target;			/* TARGET, in the unit of the delays */
+	u32 next_rollover;		/* jiffies of the next base history rollover */
+
+	u32 remote_scale;		/* usec per remote timestamp tick, << 16 */
+	u32 local_time_offset;		/* usec, our clock at remote_time_offset */
+	u32 remote_time_offset;
+	u32 hz_start;			/* jiffies at the first timestamp sample */
+	u8 hz_step:5,			/* next remote clock estimate at 2^hz_step s */
+	   variant:3;			/* enum ledbat_variant */
+	u8 flows;			/* LBE flows sharing the bottleneck, see tcp_lbe_cache.h */
+	u16 calm_stamp;			/* jiffies, low 16 bits, of the last queue seen */
+
+	u32 base_buffer[LEDBAT_MAX_BASE_HISTORY];
+};
+
+/* Tunables of a LEDBAT variant. The module parameters give the defaults,
+ * each network namespace has its own copy exposed as sysctls, and every
+ * socket caches what it needs of them in struct ledbat at init. The
+ * adaptive TARGET bounds and base_epoch are the exception: there is no
+ * room for them in struct ledbat, so they are looked up again at each
+ * rollover.
+ */
+struct ledbat_params {
+	int target;
+	int target_us;
+	int current_filter;
+	int base_history;
+	int usec_delay;
+	int base_epoch;
+	int target_ratio;		/* percent of the base RTT, 0 for a fixed TARGET */
+	int target_min_us;
+	int target_max_us;
+	int scalable;
+};
+
+struct ledbat_net {
+	struct ledbat_params params;
+	struct ctl_table_header *hdr;
+};
+
+int tcp_ledbat_core_net_init(struct net *net, unsigned int net_id,
+			     enum ledbat_variant variant, const char *path,
+			     const struct ledbat_params *defaults);
+void tcp_ledbat_core_net_exit(struct ledbat_net *ln);
+
+void tcp_ledbat_core_init(struct sock *sk, const struct ledbat_params *params,
+			  enum ledbat_variant variant);
+void tcp_ledbat_core_release(struct sock *sk);
+void tcp_ledbat_core_set_state(struct sock *sk, u8 new_state);
+u32 tcp_ledbat_core_update(struct sock *sk);
+u32 tcp_ledbat_core_update_rtt(struct sock *sk, u32 rtt_us);
+
+/* Queuing delay as of the last sample, 0 before the first one */
+static inline u32 tcp_ledbat_core_queuing_delay(const struct ledbat *ledbat)
+{
+	if (ledbat->base_min == UINT_MAX)
+		return 0;
+	return ledbat->current_delays.v[0] - ledbat->base_min;
+}
+
+/* get_info for the LEDBAT variants. The kernel has no LEDBAT specific
+ * diag attribute, so INET_DIAG_VEGASINFO is reused, all delays in usec:
+ *   tcpv_enabled	base history length << 16 | current filter length
+ *   tcpv_rttcnt	off_target, TARGET - queuing delay (signed)
+ *   tcpv_rtt		current delay (minimum of the current filter)
+ *   tcpv_minrtt	base delay (minimum of the base history)
+ */
+size_t tcp_ledbat_core_get_info(struct sock *sk, u32 ext, int *attr,
+				union tcp_cc_info *info);
+
+#endif /* _TCP_LEDBAT_H */
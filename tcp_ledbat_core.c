@@ -0,0 +1,818 @@
+/*
+ * LEDBAT delay estimation core
+ *
+ * One-way delay estimation from TCP timestamps and the current/base
+ * delay filters of RFC6817, shared by all LEDBAT variants so that each
+ * congestion control module only implements its cwnd policy.
+ *
+ * Based on the LEDBAT implementation by
+ * Stefan Fisches & Mirja Kuehlewind, Uni Stuttgart/ETH
+ */
+
+#include <linux/module.h>
+#include <linux/kernel.h>
+#include <linux/inet_diag.h>
+#include <linux/percpu.h>
+#include <linux/proc_fs.h>
+#include <linux/seq_file.h>
+#include <linux/slab.h>
+#include <linux/sysctl.h>
+
+#include <net/net_namespace.h>
+#include <net/netns/generic.h>
+#include <net/tcp.h>
+
+#include "tcp_lbe_cache.h"
+#include "tcp_lbe_compat.h"
+#include "tcp_lbe_scalable.h"
+#include "tcp_ledbat.h"
+
+#define CREATE_TRACE_POINTS
+#include "tcp_ledbat_trace.h"
+
+EXPORT_TRACEPOINT_SYMBOL_GPL(ledbat_cong_avoid);
+EXPORT_TRACEPOINT_SYMBOL_GPL(apledbat_cong_avoid);
+EXPORT_TRACEPOINT_SYMBOL_GPL(ledbatpp_cong_avoid);
+
+/* The remote timestamp clock rate is re-estimated after 1, 2, 4, ...
+ * 2^LEDBAT_HZ_MAX_STEP seconds of connection lifetime, or until the peer's
+ * ticks since the first sample reach LEDBAT_TS_REBASE, whichever is first.
+ */
+#define LEDBAT_HZ_MAX_STEP 16
+#define LEDBAT_MIN_REMOTE_HZ 16	/* keeps remote_scale within 32 bits */
+#define LEDBAT_TS_REBASE (1U << 30)	/* remote ticks before the offsets move */
+
+/* Samples between reports to the destination cache, a power of 2 */
+#define LEDBAT_CACHE_SYNC 256
+
+/* Timestamp clock rates in common use, in Hz */
+static const u32 ledbat_ts_hz[] = { 100, 250, 300, 1000, 1024, USEC_PER_SEC };
+
+/* Host-wide statistics, per variant. Per-CPU so that the ACK path never
+ * shares a cacheline with other CPUs; /proc/net/tcp_ledbat_stat sums them.
+ */
+enum {
+	LEDBAT_STAT_FILTER_CLAMPED,	/* filter lengths clamped to the inline buffers */
+	LEDBAT_STAT_ROLLOVERS,		/* base delay history rollovers */
+	LEDBAT_STAT_TARGET_OVERSHOOTS,	/* queuing delay rose above TARGET */
+	LEDBAT_STAT_MAX
+};
+
+static const char * const ledbat_stat_names[LEDBAT_STAT_MAX] = {
+	[LEDBAT_STAT_FILTER_CLAMPED]	= "filter_clamped",
+	[LEDBAT_STAT_ROLLOVERS]		= "rollovers",
+	[LEDBAT_STAT_TARGET_OVERSHOOTS]	= "target_overshoots",
+};
+
+static const char * const ledbat_variant_names[LEDBAT_NR_VARIANTS] = {
+	[LEDBAT_RFC6817]	= "ledbat",
+	[LEDBAT_APPLE]		= "apledbat",
+	[LEDBAT_PLUSPLUS]	= "ledbatpp",
+};
+
+struct ledbat_mib {
+	unsigned long mibs[LEDBAT_NR_VARIANTS][LEDBAT_STAT_MAX];
+};
+
+static DEFINE_PER_CPU(struct ledbat_mib, ledbat_stats);
+
+#define LEDBAT_STAT_INC(ledbat, field) \
+	this_cpu_inc(ledbat_stats.mibs[(ledbat)->variant][field])
+
+static int ledbat_stat_seq_show(struct seq_file *seq, void *v)
+{
+	int i, j, cpu;
+
+	for (i = 0; i < LEDBAT_NR_VARIANTS; i++) {
+		for (j = 0; j < LEDBAT_STAT_MAX; j++) {
+			unsigned long sum = 0;
+
+			for_each_possible_cpu(cpu)
+				sum += per_cpu(ledbat_stats, cpu).mibs[i][j];
+			seq_printf(seq, "%s_%s %lu\n", ledbat_variant_names[i],
+				   ledbat_stat_names[j], sum);
+		}
+	}
+	return 0;
+}
+
+static void ledbat_init_list(struct ledbat_list *list, u32 *buffer, int len)
+{
+	int i;
+
+	for (i = 0; i < len; i++)
+		buffer[i] = UINT_MAX;
+	list->len = len;
+	list->next = 0;
+}
+
+static u32 ledbat_get_min_from_list(const struct ledbat_list *list,
+				    const u32 *buffer)
+{
+	u32 min_delay = UINT_MAX;
+	int i;
+
+	for (i = 0; i < list->len; i++)
+		min_delay = min(buffer[i], min_delay);
+
+	return min_delay;
+}
+
+static void ledbat_minmax_reset(struct ledbat_minmax *m, u16 t, u32 meas)
+{
+	m->t[0] = m->t[1] = m->t[2] = t;
+	m->v[0] = m->v[1] = m->v[2] = meas;
+}
+
+static void ledbat_minmax_shift(struct ledbat_minmax *m, u16 t, u32 meas)
+{
+	m->t[0] = m->t[1];
+	m->v[0] = m->v[1];
+	m->t[1] = m->t[2];
+	m->v[1] = m->v[2];
+	m->t[2] = t;
+	m->v[2] = meas;
+}
+
+/* Add sample meas taken at time t and return the minimum of the window */
+static u32 ledbat_minmax_running_min(struct ledbat_minmax *m, u16 t, u32 meas)
+{
+	u16 dt;
+
+	/* New minimum, or nothing left in the window: start over */
+	if (unlikely(meas <= m->v[0]) || unlikely((u16)(t - m->t[2]) > m->win)) {
+		ledbat_minmax_reset(m, t, meas);
+		return meas;
+	}
+
+	if (unlikely(meas <= m->v[1])) {
+		m->t[2] = m->t[1] = t;
+		m->v[2] = m->v[1] = meas;
+	} else if (unlikely(meas <= m->v[2])) {
+		m->t[2] = t;
+		m->v[2] = meas;
+	}
+
+	/* Expire the best sample once it leaves the window, and refresh
+	 * the 2nd and 3rd best a quarter and half window in.
+	 */
+	dt = t - m->t[0];
+	if (unlikely(dt > m->win)) {
+		ledbat_minmax_shift(m, t, meas);
+		if (unlikely((u16)(t - m->t[0]) > m->win))
+			ledbat_minmax_shift(m, t, meas);
+	} else if (unlikely(m->t[1] == m->t[0]) && dt > m->win / 4) {
+		m->t[2] = m->t[1] = t;
+		m->v[2] = m->v[1] = meas;
+	} else if (unlikely(m->t[2] == m->t[1]) && dt > m->win / 2) {
+		m->t[2] = t;
+		m->v[2] = meas;
+	}
+
+	return m->v[0];
+}
+
+static int ledbat_zero;
+static int ledbat_one = 1;
+static int ledbat_two = 2;
+static int ledbat_max_current_filter = LEDBAT_MAX_CURRENT_FILTER;
+static int ledbat_max_base_history = LEDBAT_MAX_BASE_HISTORY;
+static int ledbat_hour = 3600;
+static int ledbat_max_target_ratio = 1000;
+
+/* Template for the per-namespace sysctls, in struct ledbat_params order */
+static struct ctl_table ledbat_sysctl_table[] = {
+	{
+		.procname	= "target",
+		.maxlen		= sizeof(int),
+		.mode		= 0644,
+		.proc_handler	= proc_dointvec_minmax,
+		.extra1		= &ledbat_one,
+	},
+	{
+		.procname	= "target_us",
+		.maxlen		= sizeof(int),
+		.mode		= 0644,
+		.proc_handler	= proc_dointvec_minmax,
+		.extra1		= &ledbat_one,
+	},
+	{
+		.procname	= "current_filter",
+		.maxlen		= sizeof(int),
+		.mode		= 0644,
+		.proc_handler	= proc_dointvec_minmax,
+		.extra1		= &ledbat_one,
+		.extra2		= &ledbat_max_current_filter,
+	},
+	{
+		.procname	= "base_history",
+		.maxlen		= sizeof(int),
+		.mode		= 0644,
+		.proc_handler	= proc_dointvec_minmax,
+		.extra1		= &ledbat_two,
+		.extra2		= &ledbat_max_base_history,
+	},
+	{
+		.procname	= "usec_delay",
+		.maxlen		= sizeof(int),
+		.mode		= 0644,
+		.proc_handler	= proc_dointvec_minmax,
+		.extra1		= &ledbat_zero,
+		.extra2		= &ledbat_one,
+	},
+	{
+		.procname	= "base_epoch",
+		.maxlen		= sizeof(int),
+		.mode		= 0644,
+		.proc_handler	= proc_dointvec_minmax,
+		.extra1		= &ledbat_one,
+		.extra2		= &ledbat_hour,
+	},
+	{
+		.procname	= "target_ratio",
+		.maxlen		= sizeof(int),
+		.mode		= 0644,
+		.proc_handler	= proc_dointvec_minmax,
+		.extra1		= &ledbat_zero,
+		.extra2		= &ledbat_max_target_ratio,
+	},
+	{
+		.procname	= "target_min_us",
+		.maxlen		= sizeof(int),
+		.mode		= 0644,
+		.proc_handler	= proc_dointvec_minmax,
+		.extra1		= &ledbat_one,
+	},
+	{
+		.procname	= "target_max_us",
+		.maxlen		= sizeof(int),
+		.mode		= 0644,
+		.proc_handler	= proc_dointvec_minmax,
+		.extra1		= &ledbat_one,
+	},
+	{
+		.procname	= "scalable",
+		.maxlen		= sizeof(int),
+		.mode		= 0644,
+		.proc_handler	= proc_dointvec_minmax,
+		.extra1		= &ledbat_zero,
+		.extra2		= &ledbat_one,
+	},
+	{ }
+};
+
+/* net_generic() ids of the variants, for the lookups at rollover */
+static unsigned int ledbat_net_ids[LEDBAT_NR_VARIANTS];
+
+/* Set up the tunables of a variant for a new namespace, in the
+ * struct ledbat_net of the variant's net_id, and register them under
+ * path, e.g. "net/ipv4/tcp_ledbat".
+ */
+int tcp_ledbat_core_net_init(struct net *net, unsigned int net_id,
+			     enum ledbat_variant variant, const char *path,
+			     const struct ledbat_params *defaults)
+{
+	struct ledbat_net *ln = net_generic(net, net_id);
+	struct ctl_table *table;
+
+	ledbat_net_ids[variant] = net_id;
+	ln->params = *defaults;
+
+	table = kmemdup(ledbat_sysctl_table, sizeof(ledbat_sysctl_table),
+			GFP_KERNEL);
+	if (!table)
+		return -ENOMEM;
+
+	table[0].data = &ln->params.target;
+	table[1].data = &ln->params.target_us;
+	table[2].data = &ln->params.current_filter;
+	table[3].data = &ln->params.base_history;
+	table[4].data = &ln->params.usec_delay;
+	table[5].data = &ln->params.base_epoch;
+	table[6].data = &ln->params.target_ratio;
+	table[7].data = &ln->params.target_min_us;
+	table[8].data = &ln->params.target_max_us;
+	table[9].data = &ln->params.scalable;
+
+	ln->hdr = lbe_register_net_sysctl(net, path, table, ledbat_sysctl_table);
+	if (!ln->hdr) {
+		kfree(table);
+		return -ENOMEM;
+	}
+
+	return 0;
+}
+EXPORT_SYMBOL_GPL(tcp_ledbat_core_net_init);
+
+void tcp_ledbat_core_net_exit(struct ledbat_net *ln)
+{
+	const struct ctl_table *table = ln->hdr->ctl_table_arg;
+
+	unregister_net_sysctl_table(ln->hdr);
+	kfree(table);
+}
+EXPORT_SYMBOL_GPL(tcp_ledbat_core_net_exit);
+
+/* Seeds from the destination cache. One-way delays are measured from
+ * the first sample of each connection, and the peer's timestamps start
+ * at a random offset per connection, so an OWD base delay means nothing
+ * to another one. Only the rate of the peer's clock carries over, and
+ * for LEDBAT++ the RTT base delay.
+ */
+static void tcp_ledbat_cache_join(struct sock *sk, struct ledbat *ledbat)
+{
+	struct lbe_cache_seed seed;
+
+	if (lbe_cache_join(sk, &seed))
+		ledbat->flags |= LEDBAT_F_CACHED;
+	ledbat->flows = seed.flows;
+
+	if (!(ledbat->flags & LEDBAT_F_RTT)) {
+		if (seed.remote_scale)
+			ledbat->remote_scale = seed.remote_scale;
+	} else if (seed.min_rtt_us) {
+		/* aged out by the rollovers as any other minimum */
+		ledbat->base_buffer[ledbat->base_delays.next] = seed.min_rtt_us;
+		ledbat->base_min = seed.min_rtt_us;
+	}
+}
+
+/* Report what this connection knows, and learn how many share the path */
+static void tcp_ledbat_cache_sync(struct sock *sk, struct ledbat *ledbat)
+{
+	struct lbe_cache_seed seed;
+	u32 mask = 0;
+
+	if (ledbat->flags & LEDBAT_F_RTT) {
+		seed.min_rtt_us = ledbat->base_min;
+		if (seed.min_rtt_us != UINT_MAX)
+			mask |= LBE_CACHE_MIN_RTT;
+	} else if (ledbat->hz_step) {
+		seed.remote_scale = ledbat->remote_scale;
+		mask |= LBE_CACHE_REMOTE_SCALE;
+	}
+
+	ledbat->flows = lbe_cache_update(sk, &seed, mask);
+}
+
+/* The fixed TARGET of params, in the unit of the socket's delays */
+static u32 ledbat_fixed_target(const struct ledbat *ledbat,
+			       const struct ledbat_params *params)
+{
+	/* RTT samples are always in usec; usec_delay only selects which of
+	 * the two TARGET settings applies
+	 */
+	if (ledbat->flags & LEDBAT_F_RTT)
+		return params->usec_delay ? max(params->target_us, 1) :
+		       max(params->target, 1) * USEC_PER_MSEC;
+	if (ledbat->flags & LEDBAT_F_USEC)
+		return max(params->target_us, 1);
+	return max(params->target, 1);
+}
+
+/* Adaptive TARGET: target_ratio percent of the base RTT, within
+ * target_min_us and target_max_us, so that the queue LEDBAT may build
+ * scales with the path rather than being 100 ms on LAN and satellite
+ * paths alike. It is set at init and at the first sample, and then
+ * only at rollovers, as the base history is what it follows.
+ *
+ * LEDBAT++ takes its own base delay, an RTT. The one-way delays of the
+ * other variants are relative to the first sample of the connection, so
+ * they take the stack's minimum RTT instead, which kernels before 4.6
+ * do not track: there, and while the base RTT is not known yet, TARGET
+ * stays as it is.
+ */
+static void ledbat_adapt_target(struct sock *sk, struct ledbat *ledbat,
+				const struct ledbat_params *params)
+{
+	u32 base_us, target_us;
+
+	if (!params->target_ratio) {
+		/* switched off since the socket started */
+		ledbat->target = ledbat_fixed_target(ledbat, params);
+		return;
+	}
+
+	if (ledbat->flags & LEDBAT_F_RTT)
+		base_us = ledbat->base_min;
+	else
+		base_us = lbe_tcp_min_rtt(tcp_sk(sk));
+	if (!base_us || base_us == UINT_MAX)
+		return;
+
+	target_us = clamp_t(u64, div_u64((u64)base_us * params->target_ratio, 100),
+			    params->target_min_us, params->target_max_us);
+	if (ledbat->flags & LEDBAT_F_USEC)
+		ledbat->target = max(target_us, 1U);
+	else
+		ledbat->target = max(DIV_ROUND_UP(target_us, USEC_PER_MSEC), 1U);
+}
+
+/* The tunables of the socket's namespace that struct ledbat has no room
+ * for, at rollovers
+ */
+static const struct ledbat_params *ledbat_net_params(const struct sock *sk,
+						     const struct ledbat *ledbat)
+{
+	const struct ledbat_net *ln = net_generic(sock_net(sk),
+						  ledbat_net_ids[ledbat->variant]);
+
+	return &ln->params;
+}
+
+/* Jiffies covered by each base history entry */
+static u32 ledbat_base_epoch(const struct ledbat_params *params)
+{
+	/* Module parameters are not range checked like the sysctls */
+	return clamp(params->base_epoch, 1, ledbat_hour) * HZ;
+}
+
+void tcp_ledbat_core_init(struct sock *sk, const struct ledbat_params *params,
+			  enum ledbat_variant variant)
+{
+	struct ledbat *ledbat = inet_csk_ca(sk);
+
+	BUILD_BUG_ON(LEDBAT_MAX_BASE_HISTORY > 15);	/* struct ledbat_list */
+
+	ledbat->variant = variant;
+	if (params->current_filter > LEDBAT_MAX_CURRENT_FILTER ||
+	    params->base_history > LEDBAT_MAX_BASE_HISTORY)
+		LEDBAT_STAT_INC(ledbat, LEDBAT_STAT_FILTER_CLAMPED);
+
+	/* The window is CURRENT_FILTER samples, i.e. the current one and
+	 * CURRENT_FILTER-1 before it.
+	 */
+	ledbat->current_seq = 0;
+	ledbat->current_delays.win =
+		clamp(params->current_filter, 1, LEDBAT_MAX_CURRENT_FILTER) - 1;
+	ledbat_minmax_reset(&ledbat->current_delays, 0, UINT_MAX);
+
+	ledbat_init_list(&ledbat->base_delays, ledbat->base_buffer,
+			 clamp(params->base_history, 2, LEDBAT_MAX_BASE_HISTORY));
+	ledbat->base_min = UINT_MAX;
+
+	ledbat->next_rollover = jiffies + ledbat_base_epoch(params);
+	ledbat->calm_stamp = jiffies;
+
+	ledbat->local_time_offset = 0;
+	ledbat->remote_time_offset = 0;
+	ledbat->hz_start = 0;
+	ledbat->hz_step = 0;
+	/* until it is estimated, the peer's clock is assumed to run as ours */
+	ledbat->remote_scale = div_u64((u64)USEC_PER_SEC << 16,
+				       lbe_tcp_ts_hz(tcp_sk(sk)));
+	if (variant == LEDBAT_PLUSPLUS)
+		ledbat->flags = LEDBAT_F_USEC | LEDBAT_F_RTT;
+	else if (params->usec_delay)
+		ledbat->flags = LEDBAT_F_USEC;
+	else
+		ledbat->flags = 0;
+	if (params->scalable)
+		ledbat->flags |= LEDBAT_F_SCALABLE;
+	ledbat->target = ledbat_fixed_target(ledbat, params);
+
+	tcp_ledbat_cache_join(sk, ledbat);
+
+	if (params->target_ratio) {
+		ledbat->flags |= LEDBAT_F_ADAPT;
+		ledbat_adapt_target(sk, ledbat, params);
+	}
+}
+EXPORT_SYMBOL_GPL(tcp_ledbat_core_init);
+
+/* Returns the minimum of the current delay filter after adding delay. */
+static u32 tcp_ledbat_update_current_delay(struct ledbat *ledbat, u32 delay)
+{
+	/* Maintain a list of CURRENT_FILTER last delays observed. */
+	/* delete first item in current_delays list
+	 * append delay to current_delays list
+	 */
+	ledbat->current_seq++;
+	return ledbat_minmax_running_min(&ledbat->current_delays,
+					 ledbat->current_seq, delay);
+}
+
+/* Returns the minimum of the base delay history after adding delay. */
+static u32 tcp_ledbat_update_base_delay(struct sock *sk, struct ledbat *ledbat,
+					u32 delay)
+{
+	/* Maintain BASE_HISTORY min delays. Each represents base_epoch
+	 * seconds (a minute by default), timed with jiffies.
+	 */
+	/* if now reached next_rollover
+	 *   next_rollover = now + base_epoch
+	 *   forget the earliest of base delays
+	 *   add delay to the end of base_delays
+	 * else
+	 *   last of base_delays = min(last of base_delays, delay)
+	 */
+	u32 now = jiffies;
+
+	if (unlikely((s32)(now - ledbat->next_rollover) >= 0)) {
+		const struct ledbat_params *params = ledbat_net_params(sk, ledbat);
+
+		ledbat->next_rollover = now + ledbat_base_epoch(params);
+		ledbat->base_delays.next++;
+		if (ledbat->base_delays.next == ledbat->base_delays.len)
+			ledbat->base_delays.next = 0;
+		ledbat->base_buffer[ledbat->base_delays.next] = delay;
+		LEDBAT_STAT_INC(ledbat, LEDBAT_STAT_ROLLOVERS);
+		/* the forgotten minute may have held the minimum: rescan, but
+		 * only once per rollover
+		 */
+		ledbat->base_min = ledbat_get_min_from_list(&ledbat->base_delays,
+							    ledbat->base_buffer);
+		if (ledbat->flags & LEDBAT_F_ADAPT)
+			ledbat_adapt_target(sk, ledbat, params);
+	} else if (unlikely(delay < ledbat->base_buffer[ledbat->base_delays.next])) {
+		/* Stored only when lower, which steady state samples are
+		 * not. base_min is the minimum of all the entries, so it
+		 * cannot be lower than this one.
+		 */
+		ledbat->base_buffer[ledbat->base_delays.next] = delay;
+		if (delay < ledbat->base_min) {
+			bool first = ledbat->base_min == UINT_MAX;
+
+			ledbat->base_min = delay;
+			if (unlikely(first) && (ledbat->flags & LEDBAT_F_ADAPT))
+				ledbat_adapt_target(sk, ledbat,
+						    ledbat_net_params(sk, ledbat));
+		}
+	}
+
+	return ledbat->base_min;
+}
+
+/* With the scalable option, set LEDBAT_F_SCALING once the queuing delay
+ * has stayed within 1/2^LEDBAT_CALM_SHIFT of TARGET, and no CE mark has
+ * come, for LBE_SCALABLE_RTTS RTTs, and clear it at the first sample
+ * that breaks either. calm_stamp keeps the last such sample, in 16 bits
+ * of jiffies; the wait is capped to fit.
+ */
+#define LEDBAT_CALM_SHIFT 4
+
+static void ledbat_update_scalable(struct sock *sk, struct ledbat *ledbat,
+				   u32 queuing_delay)
+{
+	u16 now = jiffies;
+	u32 wait;
+
+	if (queuing_delay > ledbat->target >> LEDBAT_CALM_SHIFT ||
+	    (ledbat->flags & LEDBAT_F_ECE)) {
+		if (ledbat->calm_stamp != now)
+			ledbat->calm_stamp = now;
+		if (ledbat->flags & LEDBAT_F_SCALING)
+			ledbat->flags &= ~LEDBAT_F_SCALING;
+		return;
+	}
+
+	if (ledbat->flags & LEDBAT_F_SCALING)
+		return;
+	wait = LBE_SCALABLE_RTTS *
+	       max_t(u32, usecs_to_jiffies(tcp_sk(sk)->srtt_us >> 3), 1);
+	if ((u16)(now - ledbat->calm_stamp) >= min_t(u32, wait, U16_MAX))
+		ledbat->flags |= LEDBAT_F_SCALING;
+}
+
+/* Feed a delay sample to the filters and return the queuing delay */
+static u32 tcp_ledbat_add_sample(struct sock *sk, struct ledbat *ledbat, u32 delay)
+{
+	u32 base_delay;
+	u32 queuing_delay;
+
+	// update delays and calculate queuing delay
+	base_delay = tcp_ledbat_update_base_delay(sk, ledbat, delay);
+	queuing_delay = tcp_ledbat_update_current_delay(ledbat, delay) - base_delay;
+
+	if (queuing_delay <= ledbat->target) {
+		if (unlikely(ledbat->flags & LEDBAT_F_OVER))
+			ledbat->flags &= ~LEDBAT_F_OVER;
+	} else if (!(ledbat->flags & LEDBAT_F_OVER)) {
+		ledbat->flags |= LEDBAT_F_OVER;
+		LEDBAT_STAT_INC(ledbat, LEDBAT_STAT_TARGET_OVERSHOOTS);
+	}
+
+	if (ledbat->flags & LEDBAT_F_SCALABLE)
+		ledbat_update_scalable(sk, ledbat, queuing_delay);
+
+	return queuing_delay;
+}
+
+/* Local clock for microsecond delay samples */
+static inline u32 ledbat_clock_us(void)
+{
+	return div_u64(ktime_get_ns(), NSEC_PER_USEC);
+}
+
+/* Estimate the rate of the peer's timestamp clock.
+ *
+ * Comparing consecutive timestamps against our own clock does not work,
+ * as every change in queuing delay shows up as a change in rate. Instead
+ * the peer's ticks since the first sample are compared against the
+ * jiffies elapsed since then, so the error from queuing delay variation
+ * shrinks as the connection ages. Estimates within 1/32 of a common
+ * timestamp clock rate are snapped to it, which also keeps slow clock
+ * skew out of the estimate; that is left to the base delay history.
+ */
+static void ledbat_estimate_remote_hz(struct ledbat *ledbat, u32 tsval)
+{
+	u32 elapsed = (u32)jiffies - ledbat->hz_start;
+	u32 remote_hz;
+	int i;
+
+	if (elapsed < (HZ << ledbat->hz_step))
+		return;
+	ledbat->hz_step++;
+
+	remote_hz = div_u64((u64)(tsval - ledbat->remote_time_offset) * HZ, elapsed);
+	for (i = 0; i < ARRAY_SIZE(ledbat_ts_hz); i++) {
+		if (abs((s32)(remote_hz - ledbat_ts_hz[i])) <= ledbat_ts_hz[i] >> 5) {
+			remote_hz = ledbat_ts_hz[i];
+			break;
+		}
+	}
+
+	if (remote_hz >= LEDBAT_MIN_REMOTE_HZ)
+		ledbat->remote_scale = div_u64((u64)USEC_PER_SEC << 16, remote_hz);
+}
+
+/* Take a one-way delay sample from the timestamps of the current ACK,
+ * feed it to the delay filters and return the resulting queuing delay.
+ *
+ * By default delays are in ms, from the peer's timestamp and the echoed
+ * local one. With LEDBAT_F_USEC the local side of the sample is our own
+ * microsecond clock at ACK processing time instead of the echoed jiffies
+ * value; the peer's timestamp remains coarse but the min filters pick the
+ * samples taken just after a remote tick.
+ */
+u32 tcp_ledbat_core_update(struct sock *sk)
+{
+	struct tcp_sock *tp = tcp_sk(sk);
+	struct ledbat *ledbat = inet_csk_ca(sk);
+
+	u32 delay = 0;
+	u32 queuing_delay, ticks;
+	u64 remote_us;
+
+	// remember first timestamp of local and remote host as base
+	if (unlikely(!ledbat->remote_time_offset || !ledbat->local_time_offset)) {
+		if (ledbat->remote_time_offset == 0) {
+			ledbat->remote_time_offset = tp->rx_opt.rcv_tsval;
+			ledbat->hz_start = jiffies;
+		}
+		if (ledbat->local_time_offset == 0) {
+			if (ledbat->flags & LEDBAT_F_USEC)
+				ledbat->local_time_offset = ledbat_clock_us();
+			else
+				ledbat->local_time_offset = tp->rx_opt.rcv_tsecr *
+					(USEC_PER_SEC / lbe_tcp_ts_hz(tp));
+		}
+	}
+
+	//estimate the remote peers time granularity, until it is settled
+	if (ledbat->hz_step <= LEDBAT_HZ_MAX_STEP)
+		ledbat_estimate_remote_hz(ledbat, tp->rx_opt.rcv_tsval);
+
+	/* The peer's ticks since the first sample are a u32 difference, which
+	 * wraps after 2^32 ticks (71 minutes for a 1 MHz clock). Long before
+	 * it can, move the remote offset on by 2^29 ticks and the local one
+	 * by the same scale << 13 us, so the owd below does not change; from
+	 * 2^31 on the difference is taken as a late, reordered tsval. The rate
+	 * estimate needs the ticks since hz_start, so it stops here.
+	 */
+	ticks = tp->rx_opt.rcv_tsval - ledbat->remote_time_offset;
+	if (unlikely(ticks >= LEDBAT_TS_REBASE && ticks < LEDBAT_TS_REBASE << 1)) {
+		ledbat->remote_time_offset += LEDBAT_TS_REBASE >> 1;
+		ledbat->local_time_offset += (u32)((u64)ledbat->remote_scale << 13);
+		ledbat->hz_step = LEDBAT_HZ_MAX_STEP + 1;
+	}
+
+	//calculate current OWD
+	remote_us = ((u64)(tp->rx_opt.rcv_tsval - ledbat->remote_time_offset) *
+		     ledbat->remote_scale) >> 16;
+	if (ledbat->flags & LEDBAT_F_USEC) {
+		/* u32 modular difference, so the usec clocks may wrap */
+		s32 owd = ledbat_clock_us() - ledbat->local_time_offset - (u32)remote_us;
+
+		if (owd > 0)
+			delay = owd;
+	} else {
+		//echoed ticks of our timestamp clock -> [us], modular as above
+		u32 local_us = tp->rx_opt.rcv_tsecr * (USEC_PER_SEC / lbe_tcp_ts_hz(tp));
+		s32 owd = (u32)remote_us - (local_us - ledbat->local_time_offset);
+
+		if (owd > 0)
+			delay = owd / USEC_PER_MSEC;
+	}
+
+	queuing_delay = tcp_ledbat_add_sample(sk, ledbat, delay);
+	if (unlikely(!(ledbat->current_seq & (LEDBAT_CACHE_SYNC - 1))) &&
+	    (ledbat->flags & LEDBAT_F_CACHED))
+		tcp_ledbat_cache_sync(sk, ledbat);
+	return queuing_delay;
+}
+EXPORT_SYMBOL_GPL(tcp_ledbat_core_update);
+
+/* LEDBAT++ measures round-trip rather than one-way delay, which needs
+ * neither timestamps nor an estimate of the peer's clock: the RTT sample
+ * of the ACK goes straight into the filters.
+ */
+u32 tcp_ledbat_core_update_rtt(struct sock *sk, u32 rtt_us)
+{
+	struct ledbat *ledbat = inet_csk_ca(sk);
+	u32 queuing_delay = tcp_ledbat_add_sample(sk, ledbat, rtt_us);
+
+	if (unlikely(!(ledbat->current_seq & (LEDBAT_CACHE_SYNC - 1))) &&
+	    (ledbat->flags & LEDBAT_F_CACHED))
+		tcp_ledbat_cache_sync(sk, ledbat);
+	return queuing_delay;
+}
+EXPORT_SYMBOL_GPL(tcp_ledbat_core_update_rtt);
+
+/* release for the LEDBAT variants */
+void tcp_ledbat_core_release(struct sock *sk)
+{
+	struct ledbat *ledbat = inet_csk_ca(sk);
+	bool cached = ledbat->flags & LEDBAT_F_CACHED;
+
+	/* flows is 0 only if init never joined the cache */
+	if (!ledbat->flows)
+		return;
+
+	if (cached)
+		tcp_ledbat_cache_sync(sk, ledbat);
+	lbe_cache_leave(sk, cached);
+}
+EXPORT_SYMBOL_GPL(tcp_ledbat_core_release);
+
+/* set_state for the LEDBAT variants: a loss or CE mark ends scaling, and
+ * the RTTs without a queue start over once it is recovered from
+ */
+void tcp_ledbat_core_set_state(struct sock *sk, u8 new_state)
+{
+	struct ledbat *ledbat = inet_csk_ca(sk);
+
+	if (new_state < TCP_CA_CWR || !(ledbat->flags & LEDBAT_F_SCALABLE))
+		return;
+
+	ledbat->flags &= ~LEDBAT_F_SCALING;
+	ledbat->calm_stamp = jiffies;
+}
+EXPORT_SYMBOL_GPL(tcp_ledbat_core_set_state);
+
+/* Delays in usec whatever the unit of the socket, 0 if not measured yet */
+static u32 ledbat_delay_us(const struct ledbat *ledbat, u32 delay)
+{
+	if (delay == UINT_MAX)
+		return 0;
+	if (ledbat->flags & LEDBAT_F_USEC)
+		return delay;
+	return delay * USEC_PER_MSEC;
+}
+
+/* Extract info for Tcp socket info provided via netlink, in the
+ * tcpvegas_info layout (see tcp_ledbat.h for the mapping).
+ */
+size_t tcp_ledbat_core_get_info(struct sock *sk, u32 ext, int *attr,
+				union tcp_cc_info *info)
+{
+	const struct ledbat *ledbat = inet_csk_ca(sk);
+
+	if (ext & (1 << (INET_DIAG_VEGASINFO - 1))) {
+		u32 base = ledbat_delay_us(ledbat, ledbat->base_min);
+		u32 current = ledbat_delay_us(ledbat, ledbat->current_delays.v[0]);
+		u32 target = ledbat_delay_us(ledbat, ledbat->target);
+
+		info->vegas.tcpv_enabled = (ledbat->base_delays.len << 16) |
+					   (ledbat->current_delays.win + 1);
+		info->vegas.tcpv_rttcnt = target - (current - base);
+		info->vegas.tcpv_rtt = current;
+		info->vegas.tcpv_minrtt = base;
+
+		*attr = INET_DIAG_VEGASINFO;
+		return sizeof(struct tcpvegas_info);
+	}
+	return 0;
+}
+EXPORT_SYMBOL_GPL(tcp_ledbat_core_get_info);
+
+static int __init tcp_ledbat_core_register(void)
+{
+	if (!proc_create_single("tcp_ledbat_stat", 0444, init_net.proc_net,
+				ledbat_stat_seq_show))
+		return -ENOMEM;
+	return 0;
+}
+
+static void __exit tcp_ledbat_core_unregister(void)
+{
+	remove_proc_entry("tcp_ledbat_stat", init_net.proc_net);
+}
+
+module_init(tcp_ledbat_core_register);
+module_exit(tcp_ledbat_core_unregister);
+
+MODULE_AUTHOR("Mirja Kuehlewind");
+MODULE_LICENSE("GPL");
+MODULE_DESCRIPTION("TCP LEDBAT delay estimation core");
+MODULE_VERSION("0.3");
@@ -0,0 +1,100 @@
+/*
+ * Tracepoints of the LEDBAT variants
+ *
+ * They are defined in tcp_ledbat_core and fire at every cwnd update, e.g.
+ *   perf record -e tcp_ledbat:ledbat_cong_avoid
+ *   bpftrace -e 'tracepoint:tcp_ledbat:* { @[args->queuing_delay] = count(); }'
+ * Delays are in the unit of the socket: usec if usec_delay was set at
+ * init or for ledbatpp, whose delays are RTTs, ms otherwise.
+ */
+
+#undef TRACE_SYSTEM
+#define TRACE_SYSTEM tcp_ledbat
+
+#if !defined(_TCP_LEDBAT_TRACE_H) || defined(TRACE_HEADER_MULTI_READ)
+#define _TCP_LEDBAT_TRACE_H
+
+#include <linux/tracepoint.h>
+#include <net/inet_sock.h>
+#include <net/tcp.h>
+
+#include "tcp_lbe_compat.h"
+#include "tcp_ledbat.h"
+
+DECLARE_EVENT_CLASS(ledbat_cwnd,
+
+	TP_PROTO(const struct sock *sk, const struct ledbat *ledbat,
+		 u32 queuing_delay, s32 off_target, u32 prior_cwnd),
+
+	TP_ARGS(sk, ledbat, queuing_delay, off_target, prior_cwnd),
+
+	TP_STRUCT__entry(
+		__field(const void *, skaddr)
+		__field(__u16, sport)
+		__field(__u16, dport)
+		__field(__u32, base_delay)
+		__field(__u32, current_delay)
+		__field(__u32, queuing_delay)
+		__field(__u32, target)
+		__field(__s32, off_target)
+		__field(__u32, prior_cwnd)
+		__field(__u32, snd_cwnd)
+		__field(__u32, ssthresh)
+	),
+
+	TP_fast_assign(
+		__entry->skaddr = sk;
+		__entry->sport = ntohs(inet_sk(sk)->inet_sport);
+		__entry->dport = ntohs(inet_sk(sk)->inet_dport);
+		__entry->base_delay = ledbat->base_min;
+		__entry->current_delay = ledbat->current_delays.v[0];
+		__entry->queuing_delay = queuing_delay;
+		__entry->target = ledbat->target;
+		__entry->off_target = off_target;
+		__entry->prior_cwnd = prior_cwnd;
+		__entry->snd_cwnd = tcp_snd_cwnd(tcp_sk(sk));
+		__entry->ssthresh = tcp_sk(sk)->snd_ssthresh;
+	),
+
+	TP_printk("sport=%hu dport=%hu base=%u current=%u queuing=%u target=%u off_target=%d cwnd=%u->%u (%s) ssthresh=%u skaddr=%p",
+		  __entry->sport, __entry->dport, __entry->base_delay,
+		  __entry->current_delay, __entry->queuing_delay,
+		  __entry->target, __entry->off_target,
+		  __entry->prior_cwnd, __entry->snd_cwnd,
+		  __entry->snd_cwnd > __entry->prior_cwnd ? "increase" :
+		  __entry->snd_cwnd < __entry->prior_cwnd ? "decrease" : "hold",
+		  __entry->ssthresh, __entry->skaddr)
+);
+
+DEFINE_EVENT(ledbat_cwnd, ledbat_cong_avoid,
+
+	TP_PROTO(const struct sock *sk, const struct ledbat *ledbat,
+		 u32 queuing_delay, s32 off_target, u32 prior_cwnd),
+
+	TP_ARGS(sk, ledbat, queuing_delay, off_target, prior_cwnd)
+);
+
+DEFINE_EVENT(ledbat_cwnd, apledbat_cong_avoid,
+
+	TP_PROTO(const struct sock *sk, const struct ledbat *ledbat,
+		 u32 queuing_delay, s32 off_target, u32 prior_cwnd),
+
+	TP_ARGS(sk, ledbat, queuing_delay, off_target, prior_cwnd)
+);
+
+DEFINE_EVENT(ledbat_cwnd, ledbatpp_cong_avoid,
+
+	TP_PROTO(const struct sock *sk, const struct ledbat *ledbat,
+		 u32 queuing_delay, s32 off_target, u32 prior_cwnd),
+
+	TP_ARGS(sk, ledbat, queuing_delay, off_target, prior_cwnd)
+);
+
+#endif /* _TCP_LEDBAT_TRACE_H */
+
+/* This part must be outside protection */
+#undef TRACE_INCLUDE_PATH
+#define TRACE_INCLUDE_PATH .
+#undef TRACE_INCLUDE_FILE
+#define TRACE_INCLUDE_FILE tcp_ledbat_trace
+#include <trace/define_trace.h>
@@ -0,0 +1,325 @@
+/*
+ * LEDBAT++ Congestion Control
+ *
+ * LEDBAT with the changes of draft-irtf-iccrg-ledbat-plus-plus, which fix
+ * the latecomer unfairness and the slow ramp-up of RFC6817:
+ *  - round-trip instead of one-way delay
+ *  - GAIN reduced on short paths, to 1/min(16, ceil(2*TARGET/base delay))
+ *  - slow start at GAIN packets per ACK, left once the queuing delay
+ *    exceeds 3/4 of TARGET
+ *  - above TARGET, a decrease proportional to the queuing delay, of
+ *    cwnd * (delay/TARGET - 1) per RTT but at most half the window
+ *  - periodic slowdowns to cwnd 2 for two RTTs, so that the flows sharing
+ *    a bottleneck all see an empty queue and agree on the base delay
+ *
+ * Built on the delay filters of tcp_ledbat_core.
+ */
+
+#include <linux/module.h>
+#include <linux/kernel.h>
+#include <linux/init.h>
+#include <linux/inet_diag.h>
+#include <net/netns/generic.h>
+#include <net/tcp.h>
+
+#include "tcp_lbe_compat.h"
+#include "tcp_lbe_scalable.h"
+#include "tcp_ledbat.h"
+#include "tcp_ledbat_trace.h"
+
+#define MIN_CWND 2U
+#define LEDBATPP_MAX_GAIN_DIV 16	/* GAIN is at least 1/16 */
+#define LEDBATPP_SLOWDOWN_RTTS 2	/* cwnd is held at MIN_CWND for 2 RTTs */
+#define LEDBATPP_SLOWDOWN_SPACING 9	/* ... then not again for 9 times as long
+					 * as the slowdown lasted */
+#define LEDBATPP_SHIFT 10		/* fixed point of delay / TARGET */
+
+static int target __read_mostly = 60;
+module_param(target, int, 0);
+MODULE_PARM_DESC(target, "TARGET is the maximum queueing delay that LEDBAT++ itself may introduce in the network, in ms.");
+
+static bool usec_delay __read_mostly;
+module_param(usec_delay, bool, 0);
+MODULE_PARM_DESC(usec_delay, "Use target_us instead of target as TARGET.");
+static int target_us __read_mostly = 60000;
+module_param(target_us, int, 0);
+MODULE_PARM_DESC(target_us, "TARGET in microseconds, used when usec_delay is set.");
+
+/* RTT samples are noisier than one-way delays from the same ACKs, so
+ * the current delay is the minimum of a few of them
+ * (capped at LEDBAT_MAX_CURRENT_FILTER)
+ */
+static int current_filter __read_mostly = 4;
+module_param(current_filter, int, 0);
+MODULE_PARM_DESC(current_filter, "Maintain a list of CURRENT_FILTER last delays observed.");
+
+/* (capped at LEDBAT_MAX_BASE_HISTORY) */
+static int base_history __read_mostly = 2;
+module_param(base_history, int, 0);
+MODULE_PARM_DESC(base_history, "Maintain BASE_HISTORY delay-minima where each minimum is measured over a period of base_epoch seconds.");
+
+/* A minute in RFC6817; shorter where the path changes often */
+static int base_epoch __read_mostly = 60;
+module_param(base_epoch, int, 0);
+MODULE_PARM_DESC(base_epoch, "Length of each BASE_HISTORY period in seconds.");
+
+/* Adaptive TARGET: a fraction of the base RTT, e.g. 50 for queues of up
+ * to half of it, within the two bounds
+ */
+static int target_ratio __read_mostly;
+module_param(target_ratio, int, 0);
+MODULE_PARM_DESC(target_ratio, "TARGET as a percentage of the base RTT, recomputed at each base history rollover; 0 for a fixed TARGET.");
+static int target_min_us __read_mostly = 1000;
+module_param(target_min_us, int, 0);
+MODULE_PARM_DESC(target_min_us, "Lower bound of the adaptive TARGET in microseconds.");
+static int target_max_us __read_mostly = 60000;
+module_param(target_max_us, int, 0);
+MODULE_PARM_DESC(target_max_us, "Upper bound of the adaptive TARGET in microseconds.");
+
+/* Scalable TCP growth while the path shows no queue, see tcp_lbe_scalable.h */
+static bool scalable __read_mostly;
+module_param(scalable, bool, 0);
+MODULE_PARM_DESC(scalable, "Grow as Scalable TCP after 4 RTTs without queuing delay, until the first delay, CE mark or loss.");
+
+
+/* The parameters above are the defaults of each network namespace,
+ * which can then be tuned through net.ipv4.tcp_ledbatpp sysctls.
+ */
+static unsigned int ledbat_net_id __read_mostly;
+
+static int __net_init ledbat_net_init(struct net *net)
+{
+	const struct ledbat_params defaults = {
+		.target		= target,
+		.target_us	= target_us,
+		.current_filter	= current_filter,
+		.base_history	= base_history,
+		.usec_delay	= usec_delay,
+		.base_epoch	= base_epoch,
+		.target_ratio	= target_ratio,
+		.target_min_us	= target_min_us,
+		.target_max_us	= target_max_us,
+		.scalable	= scalable,
+	};
+
+	return tcp_ledbat_core_net_init(net, ledbat_net_id, LEDBAT_PLUSPLUS,
+					"net/ipv4/tcp_ledbatpp", &defaults);
+}
+
+static void __net_exit ledbat_net_exit(struct net *net)
+{
+	tcp_ledbat_core_net_exit(net_generic(net, ledbat_net_id));
+}
+
+static struct pernet_operations ledbat_net_ops = {
+	.init	= ledbat_net_init,
+	.exit	= ledbat_net_exit,
+	.id	= &ledbat_net_id,
+	.size	= sizeof(struct ledbat_net),
+};
+
+
+enum ledbatpp_phase {
+	LEDBATPP_INITIAL_SS,	/* initial slow start */
+	LEDBATPP_CA,		/* next slowdown at slowdown_stamp */
+	LEDBATPP_SLOWDOWN,	/* cwnd held at MIN_CWND since slowdown_stamp */
+	LEDBATPP_RAMP,		/* slow start back to ssthresh after the
+				 * slowdown begun at slowdown_stamp */
+};
+
+/* LEDBAT++ state on top of the shared delay estimation core. The
+ * fractional window, which may be negative, is kept in snd_cwnd_cnt.
+ */
+struct ledbatpp {
+	struct ledbat core;
+	u32 slowdown_stamp;	/* jiffies, see enum ledbatpp_phase */
+	u8 phase;
+};
+
+static void tcp_ledbatpp_init(struct sock *sk)
+{
+	struct ledbatpp *pp = inet_csk_ca(sk);
+	struct ledbat_net *ln = net_generic(sock_net(sk), ledbat_net_id);
+
+	tcp_ledbat_core_init(sk, &ln->params, LEDBAT_PLUSPLUS);
+	pp->phase = LEDBATPP_INITIAL_SS;
+	pp->slowdown_stamp = 0;
+	tcp_sk(sk)->snd_cwnd_cnt = 0;
+}
+
+static void tcp_ledbatpp_pkts_acked(struct sock *sk,
+				    const struct ack_sample *sample)
+{
+	if (sample->rtt_us > 0)
+		tcp_ledbat_core_update_rtt(sk, sample->rtt_us);
+}
+LBE_PKTS_ACKED_COMPAT(tcp_ledbatpp_pkts_acked)
+
+/* 1/GAIN = min(16, ceil(2 * TARGET / base delay)) */
+static u32 ledbatpp_gain_div(const struct ledbat *ledbat)
+{
+	u32 base = ledbat->base_min;
+
+	if (!base || base == UINT_MAX)
+		return LEDBATPP_MAX_GAIN_DIV;
+	return clamp_t(u32, div_u64(2ULL * ledbat->target + base - 1, base),
+		       1, LEDBATPP_MAX_GAIN_DIV);
+}
+
+static u32 ledbatpp_rtt_jiffies(const struct tcp_sock *tp)
+{
+	return max_t(u32, usecs_to_jiffies(tp->srtt_us >> 3), 1);
+}
+
+/* Move through the slowdown cycle. Returns true while cwnd is held. */
+static bool ledbatpp_slowdown(struct sock *sk, struct ledbatpp *pp)
+{
+	struct tcp_sock *tp = tcp_sk(sk);
+	u32 now = jiffies;
+
+	switch (pp->phase) {
+	case LEDBATPP_INITIAL_SS:
+		if (tcp_snd_cwnd(tp) < tp->snd_ssthresh)
+			return false;
+		/* the first slowdown comes two RTTs after slow start */
+		pp->slowdown_stamp = now + 2 * ledbatpp_rtt_jiffies(tp);
+		pp->phase = LEDBATPP_CA;
+		return false;
+
+	case LEDBATPP_CA:
+		if ((s32)(now - pp->slowdown_stamp) < 0)
+			return false;
+		/* ssthresh keeps the window to come back to */
+		tp->snd_ssthresh = max(tcp_snd_cwnd(tp), MIN_CWND);
+		tcp_snd_cwnd_set(tp, MIN_CWND);
+		tp->snd_cwnd_cnt = 0;
+		pp->slowdown_stamp = now;
+		pp->phase = LEDBATPP_SLOWDOWN;
+		return true;
+
+	case LEDBATPP_SLOWDOWN:
+		if (now - pp->slowdown_stamp <
+		    LEDBATPP_SLOWDOWN_RTTS * ledbatpp_rtt_jiffies(tp))
+			return true;
+		pp->phase = LEDBATPP_RAMP;
+		return false;
+
+	case LEDBATPP_RAMP:
+		if (tcp_snd_cwnd(tp) < tp->snd_ssthresh)
+			return false;
+		pp->slowdown_stamp = now + LEDBATPP_SLOWDOWN_SPACING *
+					   (now - pp->slowdown_stamp);
+		pp->phase = LEDBATPP_CA;
+		return false;
+	}
+	return false;
+}
+
+void tcp_ledbatpp_cong_avoid(struct sock *sk, u32 ack, u32 acked)
+{
+	struct tcp_sock *tp = tcp_sk(sk);
+	struct ledbatpp *pp = inet_csk_ca(sk);
+	u32 tgt = pp->core.target;
+	u32 queuing_delay = tcp_ledbat_core_queuing_delay(&pp->core);
+	s32 off_target = tgt - queuing_delay;
+	u32 prior_cwnd = tcp_snd_cwnd(tp);
+	s64 cnt, unit;
+	u32 gain_div;
+
+	if (ledbatpp_slowdown(sk, pp))
+		goto out;
+
+	/* don't change cwnd is not cwnd-limited */
+	if (!tcp_is_cwnd_limited(sk))
+		return;
+
+	/* The window grows by fractions of a packet, so cnt counts in
+	 * units of 1 / (gain_div * cwnd << LEDBATPP_SHIFT) packet: GAIN/cwnd
+	 * per ACKed packet is 1 << LEDBATPP_SHIFT.
+	 */
+	/* parallel LBE flows through the bottleneck share one GAIN */
+	gain_div = ledbatpp_gain_div(&pp->core) * pp->core.flows;
+	unit = (s64)gain_div * tcp_snd_cwnd(tp) << LEDBATPP_SHIFT;
+	cnt = (s32)tp->snd_cwnd_cnt;
+
+	if (tcp_snd_cwnd(tp) < tp->snd_ssthresh) {
+		/* GAIN per ACKed packet, until 3/4 of TARGET */
+		if (queuing_delay > tgt / 4 * 3)
+			tp->snd_ssthresh = tcp_snd_cwnd(tp);
+		else
+			cnt += ((s64)acked * tcp_snd_cwnd(tp)) << LEDBATPP_SHIFT;
+	} else if (unlikely(pp->core.flags & LEDBAT_F_SCALING)) {
+		/* no queue for a while: Scalable TCP's increase instead */
+		cnt += div_u64((u64)acked * unit,
+			       min(tcp_snd_cwnd(tp), LBE_SCALABLE_AI_CNT));
+	} else if (queuing_delay <= tgt) {
+		cnt += (s64)acked << LEDBATPP_SHIFT;
+	} else {
+		/* GAIN/cwnd - (delay/TARGET - 1) per ACKed packet, and no
+		 * more than half a packet, so at most cwnd/2 per RTT
+		 */
+		s64 over = div_u64((u64)(queuing_delay - tgt) << LEDBATPP_SHIFT, tgt);
+		s64 delta = (1 << LEDBATPP_SHIFT) - over * gain_div * tcp_snd_cwnd(tp);
+
+		cnt += max(delta, -unit / 2) * acked;
+	}
+
+	if (cnt >= unit || cnt <= -unit) {
+		s64 inc = div64_s64(cnt, unit);
+		s64 cwnd = tcp_snd_cwnd(tp) + inc;
+
+		cnt -= inc * unit;
+		if (prior_cwnd < tp->snd_ssthresh)
+			cwnd = min_t(s64, cwnd, tp->snd_ssthresh);
+		tcp_snd_cwnd_set(tp, clamp_t(s64, cwnd, MIN_CWND, tp->snd_cwnd_clamp));
+	}
+	tp->snd_cwnd_cnt = (u32)clamp_t(s64, cnt, S32_MIN, S32_MAX);
+
+out:
+	trace_ledbatpp_cong_avoid(sk, &pp->core, queuing_delay, off_target,
+				  prior_cwnd);
+}
+EXPORT_SYMBOL_GPL(tcp_ledbatpp_cong_avoid);
+
+
+static struct tcp_congestion_ops tcp_ledbatpp = {
+	.init		= tcp_ledbatpp_init,
+	.ssthresh	= tcp_reno_ssthresh,
+	.undo_cwnd	= tcp_reno_undo_cwnd,
+	.cong_avoid	= tcp_ledbatpp_cong_avoid,
+	.pkts_acked	= LBE_PKTS_ACKED(tcp_ledbatpp_pkts_acked),
+	.get_info	= tcp_ledbat_core_get_info,
+	.release	= tcp_ledbat_core_release,
+	.set_state	= tcp_ledbat_core_set_state,
+	.owner		= THIS_MODULE,
+	.name		= "ledbatpp",
+};
+
+static int __init tcp_ledbatpp_register(void)
+{
+	int ret;
+
+	BUILD_BUG_ON(sizeof(struct ledbatpp) > ICSK_CA_PRIV_SIZE);
+
+	ret = register_pernet_subsys(&ledbat_net_ops);
+	if (ret)
+		return ret;
+
+	ret = tcp_register_congestion_control(&tcp_ledbatpp);
+	if (ret)
+		unregister_pernet_subsys(&ledbat_net_ops);
+	return ret;
+}
+
+static void __exit tcp_ledbatpp_unregister(void)
+{
+	tcp_unregister_congestion_control(&tcp_ledbatpp);
+	unregister_pernet_subsys(&ledbat_net_ops);
+}
+
+module_init(tcp_ledbatpp_register);
+module_exit(tcp_ledbatpp_unregister);
+
+MODULE_LICENSE("GPL");
+MODULE_DESCRIPTION("TCP LEDBAT++");
+MODULE_VERSION("0.3");
@@ -17,48 +17,401 @@
 #include <linux/module.h>
 #include <linux/skbuff.h>
 #include <linux/inet_diag.h>
+#include <linux/percpu.h>
+#include <linux/proc_fs.h>
+#include <linux/seq_file.h>
+#include <linux/slab.h>
+#include <linux/sysctl.h>
 
+#include <net/net_namespace.h>
+#include <net/netns/generic.h>
 #include <net/tcp.h>
 
-static int alpha = 1;
-static int beta  = 3;
-static int gamma = 1;
+#include "tcp_lbe_cache.h"
+#include "tcp_lbe_compat.h"
+#include "tcp_lbe_scalable.h"
 
-static int fraction = 50;
-static int threshold = 20;
+/* Tunables. The module parameters are those of init_net; every other
+ * network namespace starts from a copy of them. All of them can be tuned
+ * per namespace through net.ipv4.tcp_nice sysctls, and each socket caches
+ * its own copy at init so the ACK path never reads them.
+ */
+struct nice_params {
+	int alpha;
+	int beta;
+	int gamma;
+	int fraction;
+	int threshold;
+	int max_fwnd;
+	int base_rtt_win;
+	int pacing;
+	int max_samples;
+	int scalable;
+
+	/* 100 / fraction, recomputed whenever fraction is set */
+	int fraction_divisor;
+};
+
+static struct nice_params nice_init_params = {
+	.alpha		= 1,
+	.beta		= 3,
+	.gamma		= 1,
+	.fraction	= 50,
+	.threshold	= 20,
+	.max_fwnd	= 96,
+	.base_rtt_win	= 10,
+	.pacing		= 0,
+	.max_samples	= 0,
+	.scalable	= 0,
+	.fraction_divisor = 2,
+};
+
+static void nice_set_fraction_divisor(struct nice_params *p)
+{
+	WRITE_ONCE(p->fraction_divisor, 100 / p->fraction);
+}
+
+/* Reject fractions outside 1..100 and keep the divisor in step */
+static int nice_param_set_fraction(const char *val, const struct kernel_param *kp)
+{
+	int fraction;
+	int ret;
+
+	ret = kstrtoint(val, 0, &fraction);
+	if (ret)
+		return ret;
+	if (fraction < 1 || fraction > 100)
+		return -EINVAL;
 
-static int fraction_divisor = 0;
+	nice_init_params.fraction = fraction;
+	nice_set_fraction_divisor(&nice_init_params);
+	return 0;
+}
 
-static int max_fwnd = 96;
+static const struct kernel_param_ops nice_fraction_ops = {
+	.set	= nice_param_set_fraction,
+	.get	= param_get_int,
+};
 
-module_param(alpha, int, 0644);
+module_param_named(alpha, nice_init_params.alpha, int, 0644);
 MODULE_PARM_DESC(alpha, "lower bound of packets in network");
-module_param(beta, int, 0644);
+module_param_named(beta, nice_init_params.beta, int, 0644);
 MODULE_PARM_DESC(beta, "upper bound of packets in network");
-module_param(gamma, int, 0644);
+module_param_named(gamma, nice_init_params.gamma, int, 0644);
 MODULE_PARM_DESC(gamma, "limit on increase (scale by 2)");
-module_param(fraction, int, 0644);
+module_param_cb(fraction, &nice_fraction_ops, &nice_init_params.fraction, 0644);
 MODULE_PARM_DESC(fraction, "fraction of cwnd to experience congestion before multiplicative decrease");
-module_param(threshold, int, 0644);
+module_param_named(threshold, nice_init_params.threshold, int, 0644);
 MODULE_PARM_DESC(threshold, "delay threshold for congestion detector");
-module_param(max_fwnd, int, 0644);
+module_param_named(max_fwnd, nice_init_params.max_fwnd, int, 0644);
 MODULE_PARM_DESC(max_fwnd, "highest permitted value of fractional_cwnd");
+module_param_named(base_rtt_win, nice_init_params.base_rtt_win, int, 0644);
+MODULE_PARM_DESC(base_rtt_win, "seconds without a new minimum before baseRTT is re-probed (0: never)");
+module_param_named(pacing, nice_init_params.pacing, int, 0644);
+MODULE_PARM_DESC(pacing, "pace fractional windows instead of toggling cwnd between 0 and 2");
+module_param_named(max_samples, nice_init_params.max_samples, int, 0644);
+MODULE_PARM_DESC(max_samples, "RTT samples taken per RTT, about, with large windows (0: every ACK)");
+module_param_named(scalable, nice_init_params.scalable, int, 0644);
+MODULE_PARM_DESC(scalable, "grow as Scalable TCP after 4 RTTs with diff below alpha and no congestion event");
+
+/* Read when the module registers, as it sets the ops' flags */
+static bool ecn __read_mostly;
+module_param(ecn, bool, 0444);
+MODULE_PARM_DESC(ecn, "negotiate ECN and count CE marked ACKs as congestion events");
+
+struct nice_net {
+	struct nice_params *params;	/* nice_init_params or own */
+	struct nice_params own;
+	struct ctl_table_header *hdr;
+};
+
+static unsigned int nice_net_id __read_mostly;
+
+static int nice_zero;
+static int nice_one = 1;
+static int nice_two = 2;
+static int nice_hundred = 100;
+static int nice_u8_max = U8_MAX;
+static int nice_hour = 3600;
+
+static int nice_proc_fraction(LBE_CTL_TABLE *table, int write,
+			      LBE_SYSCTL_BUFFER buffer, size_t *lenp, loff_t *ppos)
+{
+	struct nice_params *p = container_of(table->data, struct nice_params,
+					     fraction);
+	int ret;
+
+	ret = proc_dointvec_minmax(table, write, buffer, lenp, ppos);
+	if (write && !ret)
+		nice_set_fraction_divisor(p);
+	return ret;
+}
+
+/* Template for the per-namespace sysctls, in struct nice_params order */
+static struct ctl_table nice_sysctl_table[] = {
+	{
+		.procname	= "alpha",
+		.maxlen		= sizeof(int),
+		.mode		= 0644,
+		.proc_handler	= proc_dointvec_minmax,
+		.extra1		= &nice_zero,
+		.extra2		= &nice_u8_max,
+	},
+	{
+		.procname	= "beta",
+		.maxlen		= sizeof(int),
+		.mode		= 0644,
+		.proc_handler	= proc_dointvec_minmax,
+		.extra1		= &nice_zero,
+		.extra2		= &nice_u8_max,
+	},
+	{
+		.procname	= "gamma",
+		.maxlen		= sizeof(int),
+		.mode		= 0644,
+		.proc_handler	= proc_dointvec_minmax,
+		.extra1		= &nice_zero,
+		.extra2		= &nice_u8_max,
+	},
+	{
+		.procname	= "fraction",
+		.maxlen		= sizeof(int),
+		.mode		= 0644,
+		.proc_handler	= nice_proc_fraction,
+		.extra1		= &nice_one,
+		.extra2		= &nice_hundred,
+	},
+	{
+		.procname	= "threshold",
+		.maxlen		= sizeof(int),
+		.mode		= 0644,
+		.proc_handler	= proc_dointvec_minmax,
+		.extra1		= &nice_zero,
+		.extra2		= &nice_hundred,
+	},
+	{
+		.procname	= "max_fwnd",
+		.maxlen		= sizeof(int),
+		.mode		= 0644,
+		.proc_handler	= proc_dointvec_minmax,
+		.extra1		= &nice_two,
+		.extra2		= &nice_u8_max,
+	},
+	{
+		.procname	= "base_rtt_win",
+		.maxlen		= sizeof(int),
+		.mode		= 0644,
+		.proc_handler	= proc_dointvec_minmax,
+		.extra1		= &nice_zero,
+		.extra2		= &nice_hour,
+	},
+	{
+		.procname	= "pacing",
+		.maxlen		= sizeof(int),
+		.mode		= 0644,
+		.proc_handler	= proc_dointvec_minmax,
+		.extra1		= &nice_zero,
+		.extra2		= &nice_one,
+	},
+	{
+		.procname	= "max_samples",
+		.maxlen		= sizeof(int),
+		.mode		= 0644,
+		.proc_handler	= proc_dointvec_minmax,
+		.extra1		= &nice_zero,
+		.extra2		= &nice_u8_max,
+	},
+	{
+		.procname	= "scalable",
+		.maxlen		= sizeof(int),
+		.mode		= 0644,
+		.proc_handler	= proc_dointvec_minmax,
+		.extra1		= &nice_zero,
+		.extra2		= &nice_one,
+	},
+	{ }
+};
+
+static int __net_init nice_net_init(struct net *net)
+{
+	struct nice_net *nn = net_generic(net, nice_net_id);
+	struct ctl_table *table;
+
+	if (net_eq(net, &init_net)) {
+		nn->params = &nice_init_params;
+	} else {
+		nn->own = nice_init_params;
+		nn->params = &nn->own;
+	}
+
+	table = kmemdup(nice_sysctl_table, sizeof(nice_sysctl_table), GFP_KERNEL);
+	if (!table)
+		return -ENOMEM;
+
+	table[0].data = &nn->params->alpha;
+	table[1].data = &nn->params->beta;
+	table[2].data = &nn->params->gamma;
+	table[3].data = &nn->params->fraction;
+	table[4].data = &nn->params->threshold;
+	table[5].data = &nn->params->max_fwnd;
+	table[6].data = &nn->params->base_rtt_win;
+	table[7].data = &nn->params->pacing;
+	table[8].data = &nn->params->max_samples;
+	table[9].data = &nn->params->scalable;
+
+	nn->hdr = lbe_register_net_sysctl(net, "net/ipv4/tcp_nice", table,
+					  nice_sysctl_table);
+	if (!nn->hdr) {
+		kfree(table);
+		return -ENOMEM;
+	}
+
+	return 0;
+}
+
+static void __net_exit nice_net_exit(struct net *net)
+{
+	struct nice_net *nn = net_generic(net, nice_net_id);
+	const struct ctl_table *table = nn->hdr->ctl_table_arg;
+
+	unregister_net_sysctl_table(nn->hdr);
+	kfree(table);
+}
+
+static struct pernet_operations nice_net_ops = {
+	.init	= nice_net_init,
+	.exit	= nice_net_exit,
+	.id	= &nice_net_id,
+	.size	= sizeof(struct nice_net),
+};
+
+/* Host-wide statistics. Per-CPU so that the ACK path never shares a
+ * cacheline with other CPUs; /proc/net/tcp_nice_stat sums them.
+ */
+enum {
+	NICE_STAT_MD,			/* multiplicative decreases */
+	NICE_STAT_FRACTIONAL,		/* entries into a fractional window */
+	NICE_STAT_MAX
+};
+
+static const char * const nice_stat_names[NICE_STAT_MAX] = {
+	[NICE_STAT_MD]		= "multiplicative_decreases",
+	[NICE_STAT_FRACTIONAL]	= "fractional_entries",
+};
+
+struct nice_mib {
+	unsigned long mibs[NICE_STAT_MAX];
+};
+
+static DEFINE_PER_CPU(struct nice_mib, nice_stats);
+
+#define NICE_STAT_INC(field)	this_cpu_inc(nice_stats.mibs[field])
+
+static int nice_stat_seq_show(struct seq_file *seq, void *v)
+{
+	int i, cpu;
+
+	for (i = 0; i < NICE_STAT_MAX; i++) {
+		unsigned long sum = 0;
 
-/* Nice variables */
+		for_each_possible_cpu(cpu)
+			sum += per_cpu(nice_stats, cpu).mibs[i];
+		seq_printf(seq, "%s %lu\n", nice_stat_names[i], sum);
+	}
+	return 0;
+}
+
+
+/* Nice variables. Packed to fit the 64 bytes of ICSK_CA_PRIV_SIZE
+ * before 4.9: the 32-bit fields first, then the 16 and 8-bit ones, and
+ * the flags in one byte.
+ */
 struct nice {
 	u32	beg_snd_nxt;	/* right edge during last RTT */
 	u32	beg_snd_una;	/* left edge  during last RTT */
-	u32	beg_snd_cwnd;	/* saves the size of the cwnd */
-	u8	doing_nice_now;/* if true, do nice for this RTT */
-	u16	cntRTT;		/* # of RTTs measured within last RTT */
+	u32	beg_snd_cwnd;	/* saves the size of the cwnd (while probing baseRTT) */
 	u32	minRTT;		/* min of RTTs measured within last RTT (in usec) */
 	u32 maxRTT;		/* max of RTTs measured within last RTT (in usec) */
-	u32	baseRTT;	/* the min of all nice RTT measurements seen (in usec) */
+	u32	congRTT;	/* RTTs above are congestion events, see nice_cong_rtt() */
+	u32	baseRTT;	/* the min of nice RTT measurements over base_rtt_win (in usec) */
+	u32	baseRTT_stamp;	/* jiffies when baseRTT was last reached, or probing began */
+	u32	probeRTT;	/* min RTT while probing baseRTT (in usec) */
+	u16	cntRTT;		/* # of RTTs measured within last RTT */
+	u16	acks;		/* ACKs with an RTT, counted while sampling */
+	u8	sample_shift;	/* one in 2^sample_shift of them is sampled */
 	u8  numCong;	/* number of congestion events detected by nice */
 	u8	fractional_cwnd; /* denominator of the cwnd */
 	u8	nice_timer;	/* keeps time for the fractional cwnd */
+	u8	doing_nice_now:1,/* if true, do nice for this RTT */
+		probing:1,	/* if true, cwnd is held down to re-measure baseRTT */
+		data_acked:1,	/* the ACK being processed acks new data */
+		ece:1,		/* the ACK being processed has ECE (ecn option) */
+		cached:1;	/* counted in with its destination by tcp_lbe_cache */
+	u8	calm_rtts;	/* RTTs in a row with diff < alpha, see scalable */
+	u8	flows;		/* LBE flows sharing the bottleneck, see tcp_lbe_cache.h */
+
+	/* per-socket copy of the namespace tunables */
+	u8	alpha;
+	u8	beta;
+	u8	gamma;
+	u8	threshold;
+	u8	max_fwnd;
+	u8	fraction_divisor;
+	u8	max_samples;	/* 0, or at least NICE_MIN_SAMPLES */
+	u8	pacing:1,
+		scalable:1;
+	u32	base_rtt_win;	/* in jiffies */
 };
 
+/* Minimum time cwnd is held down when probing baseRTT, as in BBR */
+#define NICE_PROBE_RTT_TIME	(HZ / 5)
+
+/* Fewer samples would leave the Vegas calculation to chance */
+#define NICE_MIN_SAMPLES	8
+#define NICE_MAX_SAMPLE_SHIFT	15
+
+#define CREATE_TRACE_POINTS
+#include "tcp_nice_trace.h"
+
+/*
+ * In pacing mode a fractional window of 2/fractional_cwnd of the
+ * 2-packet minimum is sent as a rate instead: cwnd stays at 2 and the
+ * pacing rate lets two packets out every fractional_cwnd/2 RTTs. The
+ * flow keeps getting ACKs to react to, and never stalls with cwnd 0.
+ *
+ * The stack recomputes sk_pacing_rate from cwnd after every ACK, unless
+ * the congestion control has cong_control(), so pacing mode needs 4.9.
+ * The rate is set in sk_pacing_rate and stays under sk_max_pacing_rate,
+ * the cap the application may have set with SO_MAX_PACING_RATE.
+ */
+static void nice_pace_fractional(struct sock *sk)
+{
+	const struct nice *nice = inet_csk_ca(sk);
+
+	if (nice->fractional_cwnd > 2)
+		tcp_snd_cwnd_set(tcp_sk(sk), 2);
+}
+
+#ifdef LBE_HAVE_RATE_SAMPLE
+static void nice_update_pacing_rate(struct sock *sk)
+{
+	const struct tcp_sock *tp = tcp_sk(sk);
+	const struct nice *nice = inet_csk_ca(sk);
+	u32 srtt = tp->srtt_us >> 3;
+	u64 rate;
+
+	if (!nice->pacing || nice->fractional_cwnd <= 2 || !srtt) {
+		lbe_update_pacing_rate(sk);
+		return;
+	}
+
+	/* 2 * mss bytes every fractional_cwnd / 2 RTTs */
+	rate = (u64)tp->mss_cache * 4 * USEC_PER_SEC;
+	rate = div64_u64(rate, (u64)nice->fractional_cwnd * srtt);
+	sk->sk_pacing_rate = min_t(u64, rate, sk->sk_max_pacing_rate);
+}
+#endif
+
 /* There are several situations when we must "re-start" Vegas:
  *
  *  o when a connection is established
@@ -98,68 +451,235 @@ static inline void nice_disable(struct sock *sk)
 	nice->doing_nice_now = 0;
 }
 
+/* Per-socket copy of the namespace tunables, taken once at init */
+static void nice_copy_params(struct sock *sk)
+{
+	struct nice *nice = inet_csk_ca(sk);
+	struct nice_net *nn = net_generic(sock_net(sk), nice_net_id);
+	const struct nice_params *p = nn->params;
+
+	nice->alpha = clamp_val(p->alpha, 0, U8_MAX);
+	nice->beta = clamp_val(p->beta, 0, U8_MAX);
+	nice->gamma = clamp_val(p->gamma, 0, U8_MAX);
+	nice->threshold = clamp_val(p->threshold, 0, 100);
+	nice->max_fwnd = clamp_val(p->max_fwnd, 2, U8_MAX);
+	nice->fraction_divisor = READ_ONCE(p->fraction_divisor);
+	nice->base_rtt_win = clamp_val(p->base_rtt_win, 0, 3600) * HZ;
+#ifdef LBE_HAVE_RATE_SAMPLE
+	nice->pacing = !!p->pacing;
+#else
+	nice->pacing = 0;	/* see nice_pace_fractional() */
+#endif
+	nice->max_samples = p->max_samples ?
+			    clamp_val(p->max_samples, NICE_MIN_SAMPLES, U8_MAX) : 0;
+	nice->scalable = !!p->scalable;
+
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(4, 13, 0)
+	/* Without the fq qdisc, ask TCP to pace internally */
+	if (nice->pacing)
+		cmpxchg(&sk->sk_pacing_status, SK_PACING_NONE, SK_PACING_NEEDED);
+#endif
+}
+
+/*
+ * Restart the Vegas sampling, at init and when transmission restarts.
+ * baseRTT, which has its own window, and the fractional window, which
+ * the restart does not invalidate, are left as they are.
+ */
+static void nice_reset(struct sock *sk)
+{
+	struct nice *nice = inet_csk_ca(sk);
+
+	nice->sample_shift = 0;
+	nice->acks = 0;
+	nice->calm_rtts = 0;
+	nice->congRTT = 0x7fffffff;
+	nice->ece = 0;
+	nice_enable(sk);
+}
+
+/* Report baseRTT and the fractional window to the destination cache */
+static void nice_cache_sync(struct sock *sk)
+{
+	struct nice *nice = inet_csk_ca(sk);
+	struct lbe_cache_seed seed;
+	u32 mask = LBE_CACHE_FWND;
+
+	seed.fractional_cwnd = nice->fractional_cwnd;
+	if (nice->baseRTT != 0x7fffffff) {
+		seed.min_rtt_us = nice->baseRTT - 1;
+		mask |= LBE_CACHE_MIN_RTT;
+	}
+
+	nice->flows = lbe_cache_update(sk, &seed, mask);
+}
+
+/*
+ * A new connection starts from what the last ones to the destination
+ * left in the cache: their baseRTT, and their fractional window if they
+ * ended with one, as the foreground traffic that made them yield that
+ * far is likely still there.
+ */
 void tcp_nice_init(struct sock *sk)
 {
+	struct tcp_sock *tp = tcp_sk(sk);
 	struct nice *nice = inet_csk_ca(sk);
+	struct lbe_cache_seed seed;
 
-	fraction_divisor = 100 / fraction; 
+	nice_copy_params(sk);
 
 	/* Initialise the CWND denominator */
-	nice->fractional_cwnd = 2; 
+	nice->fractional_cwnd = 2;
 	nice->nice_timer = 0;
 
 	nice->baseRTT = 0x7fffffff;
-	nice_enable(sk);
+	nice->baseRTT_stamp = jiffies;
+	nice->probing = 0;
+	nice_reset(sk);
+
+	nice->cached = lbe_cache_join(sk, &seed);
+	nice->flows = seed.flows;
+	if (seed.min_rtt_us)
+		nice->baseRTT = seed.min_rtt_us + 1;
+	if (seed.fractional_cwnd > 2) {
+		nice->fractional_cwnd = min(seed.fractional_cwnd, nice->max_fwnd);
+		tcp_snd_cwnd_set(tp, 2);
+		tp->snd_ssthresh = 2;
+	}
 }
 EXPORT_SYMBOL_GPL(tcp_nice_init);
 
+void tcp_nice_release(struct sock *sk)
+{
+	struct nice *nice = inet_csk_ca(sk);
+
+	/* flows is 0 only if init never joined the cache */
+	if (!nice->flows)
+		return;
+
+	if (nice->cached)
+		nice_cache_sync(sk);
+	lbe_cache_leave(sk, nice->cached);
+}
+EXPORT_SYMBOL_GPL(tcp_nice_release);
+
+/*
+ * The delay threshold of the congestion detector, threshold percent of
+ * the way from baseRTT to maxRTT. It only changes with them, which new
+ * samples rarely move once the first ones of an RTT are in, so it is
+ * recomputed then rather than on every ACK.
+ */
+static u32 nice_cong_rtt(const struct nice *nice)
+{
+	return div_u64((u64)(100 - nice->threshold) * nice->baseRTT +
+		       (u64)nice->threshold * nice->maxRTT, 100);
+}
+
+/*
+ * With max_samples set, one ACK in 2^sample_shift is sampled, so that
+ * about max_samples of them are per RTT whatever the window. The shift
+ * is set once per RTT, and congestion events are scaled up by it.
+ */
+static u8 nice_sample_shift(const struct nice *nice, u32 cwnd)
+{
+	if (!nice->max_samples || cwnd <= nice->max_samples)
+		return 0;
+	return min_t(u32, ilog2(cwnd / nice->max_samples), NICE_MAX_SAMPLE_SHIFT);
+}
+
 /* Do RTT sampling needed for Vegas.
  * Basically we:
  *   o min-filter RTT samples from within an RTT to get the current
  *     propagation delay + queuing delay (we are min-filtering to try to
  *     avoid the effects of delayed ACKs)
- *   o min-filter RTT samples from a much longer window (forever for now)
+ *   o min-filter RTT samples from a much longer window (base_rtt_win)
  *     to find the propagation delay (baseRTT)
  */
-void tcp_nice_pkts_acked(struct sock *sk, u32 cnt, s32 rtt_us)
+void tcp_nice_pkts_acked(struct sock *sk, const struct ack_sample *sample)
 {
 	struct nice *nice = inet_csk_ca(sk);
+	bool moved = false;
 	u32 vrtt;
 
-	if (rtt_us < 0)
+	nice->data_acked = sample->pkts_acked > 0;
+	if (sample->rtt_us < 0)
+		return;
+
+	if (unlikely(nice->sample_shift) &&
+	    (++nice->acks & ((1U << nice->sample_shift) - 1)))
 		return;
 
 	/* Never allow zero rtt or baseRTT */
-	vrtt = rtt_us + 1;
+	vrtt = sample->rtt_us + 1;
 
 	/* Filter to find propagation delay: */
-	if (vrtt < nice->baseRTT)
+	if (vrtt <= nice->baseRTT) {
+		moved = vrtt < nice->baseRTT;
 		nice->baseRTT = vrtt;
+		if (!nice->probing)
+			nice->baseRTT_stamp = jiffies;
+	}
+	if (nice->probing)
+		nice->probeRTT = min(nice->probeRTT, vrtt);
 
 	/* Initialise maxRTT to 2*minRTT */	
-	if (nice->cntRTT == 0)
+	if (nice->cntRTT == 0) {
 		nice->maxRTT = nice->baseRTT * 2;
+		moved = true;
+	}
 
 	/* Find the min RTT during the last RTT to find
 	 * the current prop. delay + queuing delay:
 	 */
-	nice->minRTT = min(nice->minRTT, vrtt);
-	nice->maxRTT = max(nice->maxRTT, vrtt);
+	if (vrtt < nice->minRTT)
+		nice->minRTT = vrtt;
+	if (vrtt > nice->maxRTT) {
+		nice->maxRTT = vrtt;
+		moved = true;
+	}
 	nice->cntRTT++;
 
-	if (vrtt > ((100UL - threshold) * nice->baseRTT + threshold * 
-			nice->maxRTT) / 100UL) {
+	if (unlikely(moved))
+		nice->congRTT = nice_cong_rtt(nice);
+
+	/* With the ecn option, a CE mark echoed by the peer is a congestion
+	 * event whatever the RTT: a shallow marking threshold marks before
+	 * the queue shows in the RTT.
+	 */
+	if (nice->ece || vrtt > nice->congRTT)
 		nice->numCong++;
-	}
 }
 EXPORT_SYMBOL_GPL(tcp_nice_pkts_acked);
+LBE_PKTS_ACKED_COMPAT(tcp_nice_pkts_acked)
+
+/*
+ * With the ecn option, note whether the ACK echoes CE for pkts_acked.
+ * The first ECE also makes the stack enter CWR and halve cwnd, within
+ * one RTT; the marks counted as congestion events then trigger Nice's
+ * multiplicative decrease once they reach fraction of the window, as
+ * DCTCP does with the fraction of marked packets, alpha.
+ */
+static void tcp_nice_in_ack_event(struct sock *sk, u32 flags)
+{
+	struct nice *nice = inet_csk_ca(sk);
+	u8 ece = !!(flags & CA_ACK_ECE);
+
+	if (nice->ece != ece)
+		nice->ece = ece;
+}
 
 void tcp_nice_state(struct sock *sk, u8 ca_state)
 {
+	struct nice *nice = inet_csk_ca(sk);
+
 	if (ca_state == TCP_CA_Open)
 		nice_enable(sk);
 	else
 		nice_disable(sk);
+
+	/* A loss or mark ends scaling */
+	if (ca_state >= TCP_CA_CWR && nice->calm_rtts)
+		nice->calm_rtts = 0;
 }
 EXPORT_SYMBOL_GPL(tcp_nice_state);
 
@@ -170,19 +690,21 @@ EXPORT_SYMBOL_GPL(tcp_nice_state);
  * restart, we reset our Vegas state to a clean
  * slate. After we get acks for this flight of
  * packets, _then_ we can make Vegas calculations
- * again.
+ * again. The stack also raises TX_START on the first
+ * data segment, so this keeps what init took from
+ * the destination cache.
  */
 void tcp_nice_cwnd_event(struct sock *sk, enum tcp_ca_event event)
 {
 	if (event == CA_EVENT_CWND_RESTART ||
 	    event == CA_EVENT_TX_START)
-		tcp_nice_init(sk);
+		nice_reset(sk);
 }
 EXPORT_SYMBOL_GPL(tcp_nice_cwnd_event);
 
 static inline u32 tcp_nice_ssthresh(struct tcp_sock *tp)
 {
-	return  min(tp->snd_ssthresh, tp->snd_cwnd-1);
+	return  min(tp->snd_ssthresh, tcp_snd_cwnd(tp)-1);
 }
 
 static void tcp_reno_fractional_ca(struct sock *sk, u32 ack, u32 acked)
@@ -192,12 +714,12 @@ static void tcp_reno_fractional_ca(struct sock *sk, u32 ack, u32 acked)
 	struct nice *nice = inet_csk_ca(sk);
 		
 	int16_t cwnd_change;
-	u32 cur_cwnd = tp->snd_cwnd;
+	u32 cur_cwnd = tcp_snd_cwnd(tp);
 	u32 cur_cwnd_cnt = tp->snd_cwnd_cnt;
 
 	tcp_reno_cong_avoid(sk, ack, acked);
 
-	cwnd_change = 2 * (tp->snd_cwnd - cur_cwnd);
+	cwnd_change = 2 * (tcp_snd_cwnd(tp) - cur_cwnd);
 
 	if (cwnd_change != 0) {
 			nice->fractional_cwnd -= cwnd_change;
@@ -205,7 +727,7 @@ static void tcp_reno_fractional_ca(struct sock *sk, u32 ack, u32 acked)
 
 	/* Restore previous CWND and let Nice continue */
 	if (nice->fractional_cwnd > 2) {
-		tp->snd_cwnd = cur_cwnd;
+		tcp_snd_cwnd_set(tp, cur_cwnd);
 		tp->snd_cwnd_cnt = cur_cwnd_cnt;
 	}
 	else {
@@ -213,33 +735,115 @@ static void tcp_reno_fractional_ca(struct sock *sk, u32 ack, u32 acked)
 	}
 }
 
+/*
+ * baseRTT is the minimum RTT over base_rtt_win. If no sample has reached
+ * it for that long the path may have changed, so hold cwnd at 2 for at
+ * least an RTT and NICE_PROBE_RTT_TIME to drain our own queue, and then
+ * take baseRTT afresh from the RTTs seen meanwhile. Without this, a
+ * longer path after a route change looks like permanent congestion.
+ * Returns true while probing.
+ */
+static bool nice_probe_base_rtt(struct sock *sk, u32 ack)
+{
+	struct tcp_sock *tp = tcp_sk(sk);
+	struct nice *nice = inet_csk_ca(sk);
+	u32 elapsed = (u32)jiffies - nice->baseRTT_stamp;
+	u32 prior_cwnd;
+
+	if (!nice->probing) {
+		if (!nice->base_rtt_win || elapsed <= nice->base_rtt_win)
+			return false;
+
+		nice->probing = 1;
+		nice->probeRTT = 0x7fffffff;
+		nice->beg_snd_cwnd = tcp_snd_cwnd(tp);
+		nice->beg_snd_nxt = tp->snd_nxt;
+		tcp_snd_cwnd_set(tp, 2);
+		/* with the age of baseRTT that started the probe */
+		trace_nice_update(sk, nice, NICE_ACT_PROBE, 0, 0,
+				  nice->beg_snd_cwnd, nice->fractional_cwnd);
+		nice->baseRTT_stamp = jiffies;
+		return true;
+	}
+
+	if (!after(ack, nice->beg_snd_nxt) || elapsed < NICE_PROBE_RTT_TIME)
+		return true;
+
+	nice->probing = 0;
+	if (nice->probeRTT != 0x7fffffff)
+		nice->baseRTT = nice->probeRTT;
+	nice->baseRTT_stamp = jiffies;
+	prior_cwnd = tcp_snd_cwnd(tp);
+	tcp_snd_cwnd_set(tp, max(prior_cwnd, nice->beg_snd_cwnd));
+	trace_nice_update(sk, nice, NICE_ACT_PROBE_END, 0, 0, prior_cwnd,
+			  nice->fractional_cwnd);
+
+	/* The samples of the probe say nothing about the restored cwnd */
+	nice->beg_snd_nxt = tp->snd_nxt;
+	nice->cntRTT = 0;
+	nice->minRTT = 0x7fffffff;
+	nice->maxRTT = 0;
+	nice->numCong = 0;
+	return true;
+}
+
+/* Count the RTTs in a row that increased cwnd with neither a queue of
+ * alpha packets nor a congestion event, up to LBE_SCALABLE_RTTS, from
+ * which on cwnd scales
+ */
+static void nice_update_calm(struct nice *nice, int action)
+{
+	if ((action == NICE_ACT_INCREASE || action == NICE_ACT_SCALABLE) &&
+	    !nice->numCong) {
+		if (nice->calm_rtts < LBE_SCALABLE_RTTS)
+			nice->calm_rtts++;
+	} else if (nice->calm_rtts) {
+		nice->calm_rtts = 0;
+	}
+}
+
 static void tcp_nice_cong_avoid(struct sock *sk, u32 ack, u32 acked)
 {
 	struct tcp_sock *tp = tcp_sk(sk);
 	struct nice *nice = inet_csk_ca(sk);
 
-	if (nice->fractional_cwnd > 2 && nice->nice_timer == nice->fractional_cwnd) {
+	if (nice_probe_base_rtt(sk, ack))
+		return;
+
+	if (nice->pacing) {
+		/* cwnd stays at 2; the fractional part is a pacing rate */
+	} else if (nice->fractional_cwnd > 2 && nice->nice_timer == nice->fractional_cwnd) {
 		/* Send two packets in this RTT then reset the timer */
-		tp->snd_cwnd = 2;
+		tcp_snd_cwnd_set(tp, 2);
 		nice->nice_timer = 1;
 	} else if (nice->fractional_cwnd > 2) {
-		/* Waiting to send packets */
+		/* Waiting to send packets. Written directly, as
+		 * tcp_snd_cwnd_set() warns about a zero window.
+		 */
 		tp->snd_cwnd = 0;
 		nice->nice_timer++;
 	}
 
 	if (!nice->doing_nice_now) {
-		if (tp->snd_cwnd <= 2 && nice->fractional_cwnd >= 2 && nice->fractional_cwnd
-				<= max_fwnd) {
+		if (tcp_snd_cwnd(tp) <= 2 && nice->fractional_cwnd >= 2 && nice->fractional_cwnd
+				<= nice->max_fwnd) {
 			tcp_reno_fractional_ca(sk, ack, acked);
 		} else {
 			/* Just do Reno */
 			tcp_reno_cong_avoid(sk, ack, acked);
 		}
+		if (nice->pacing)
+			nice_pace_fractional(sk);
 		return;
 	}
 
 	if (after(ack, nice->beg_snd_nxt)) {
+		u32 prior_cwnd = tcp_snd_cwnd(tp);
+		u8 prior_fwnd = nice->fractional_cwnd;
+		u8 num_cong = nice->numCong;
+		u32 diff = 0;
+		int action;
+
 		/* Do the Vegas once-per-RTT cwnd adjustment. */
 
 		/* Save the extent of the current window so we can use this
@@ -260,15 +864,16 @@ static void tcp_nice_cong_avoid(struct sock *sk, u32 ack, u32 acked)
 			/* We don't have enough RTT samples to do the Vegas
 			 * calculation, so we'll behave like Reno.
 			 */
- 			if (tp->snd_cwnd <= 2 && nice->fractional_cwnd >= 2 && nice->fractional_cwnd
- 					<= max_fwnd) {
+			action = NICE_ACT_RENO;
+ 			if (tcp_snd_cwnd(tp) <= 2 && nice->fractional_cwnd >= 2 && nice->fractional_cwnd
+ 					<= nice->max_fwnd) {
  				tcp_reno_fractional_ca(sk, ack, acked);
  			} else {
  				/* Just do Reno */
  				tcp_reno_cong_avoid(sk, ack, acked);
  			}
 		} else {
-			u32 rtt, diff;
+			u32 rtt;
 			u64 target_cwnd;
 
 			/* We have enough RTT samples, so, using the Vegas
@@ -290,16 +895,22 @@ static void tcp_nice_cong_avoid(struct sock *sk, u32 ack, u32 acked)
 			 * This is:
 			 *     (actual rate in segments) * baseRTT
 			 */
-			target_cwnd = (u64)tp->snd_cwnd * nice->baseRTT;
+			target_cwnd = (u64)tcp_snd_cwnd(tp) * nice->baseRTT;
 			do_div(target_cwnd, rtt);
 
 			/* Calculate the difference between the window we had,
 			 * and the window we would like to have. This quantity
 			 * is the "Diff" from the Arizona Vegas papers.
 			 */
-			diff = tp->snd_cwnd * (rtt-nice->baseRTT) / nice->baseRTT;
+			diff = tcp_snd_cwnd(tp) * (rtt-nice->baseRTT) / nice->baseRTT;
 
-			if (diff > gamma && tcp_in_slow_start(tp)) {
+			/* Parallel LBE flows through the bottleneck each
+			 * queue about as much, so their backlog is kept
+			 * within the bounds rather than each one's.
+			 */
+			diff *= nice->flows;
+
+			if (diff > nice->gamma && tcp_in_slow_start(tp)) {
 				/* Going too fast. Time to slow down
 				 * and switch to congestion avoidance.
 				 */
@@ -311,20 +922,26 @@ static void tcp_nice_cong_avoid(struct sock *sk, u32 ack, u32 acked)
 				 * truncation robs us of full link
 				 * utilization.
 				 */
-				tp->snd_cwnd = min(tp->snd_cwnd, (u32)target_cwnd+1);
+				tcp_snd_cwnd_set(tp, min(tcp_snd_cwnd(tp), (u32)target_cwnd+1));
 				tp->snd_ssthresh = tcp_nice_ssthresh(tp);
 				nice->numCong = 0;
+				action = NICE_ACT_SS_EXIT;
 
 			} else if (tcp_in_slow_start(tp)) {
 				/* Slow start.  */
 				tcp_slow_start(tp, acked);
-			} else if (nice->numCong > tp->snd_cwnd / fraction_divisor) {
+				action = NICE_ACT_SLOW_START;
+			} else if (tcp_snd_cwnd(tp) < ((u32)nice->numCong << nice->sample_shift) *
+				   nice->fraction_divisor) {
 				/* Nice detected too many congestion events
+				 * (numCong > snd_cwnd / fraction_divisor)
 				 * perform multiplicative window reduction.
 				 */
-				if (tp->snd_cwnd > 2 && nice->fractional_cwnd == 2) {
-					tp->snd_cwnd = tp->snd_cwnd / 2;
-				} else if (nice->fractional_cwnd <= max_fwnd) {
+				action = NICE_ACT_MD;
+				NICE_STAT_INC(NICE_STAT_MD);
+				if (tcp_snd_cwnd(tp) > 2 && nice->fractional_cwnd == 2) {
+					tcp_snd_cwnd_set(tp, tcp_snd_cwnd(tp) / 2);
+				} else if (nice->fractional_cwnd <= nice->max_fwnd) {
 					nice->fractional_cwnd *= 4; 
 				}
 				
@@ -335,52 +952,100 @@ static void tcp_nice_cong_avoid(struct sock *sk, u32 ack, u32 acked)
 				/* Figure out where we would like cwnd
 				 * to be.
 				 */
-				if (diff > beta) {
+				if (diff > nice->beta) {
 					/* The old window was too fast, so
 					 * we slow down.
 					 */
-					if (tp->snd_cwnd > 2 && nice->fractional_cwnd == 2) {
-						tp->snd_cwnd--;
-					} else if (nice->fractional_cwnd <= max_fwnd) {
+					action = NICE_ACT_DECREASE;
+					if (tcp_snd_cwnd(tp) > 2 && nice->fractional_cwnd == 2) {
+						tcp_snd_cwnd_set(tp, tcp_snd_cwnd(tp) - 1);
+					} else if (nice->fractional_cwnd <= nice->max_fwnd) {
 						nice->fractional_cwnd+=2;
 					}
 
 					tp->snd_ssthresh
 						= tcp_nice_ssthresh(tp);
-				} else if (diff < alpha) {
+				} else if (diff < nice->alpha) {
 					/* We don't have enough extra packets
 					 * in the network, so speed up.
 					 */
-					if (tp->snd_cwnd >= 2 && nice->fractional_cwnd == 2) {
-						tp->snd_cwnd++;
-					} else if (nice->fractional_cwnd <= max_fwnd) {
+					action = NICE_ACT_INCREASE;
+					if (tcp_snd_cwnd(tp) >= 2 && nice->fractional_cwnd == 2) {
+						u32 inc = 1;
+
+						if (nice->calm_rtts >= LBE_SCALABLE_RTTS) {
+							inc = lbe_scalable_rtt_increase(tcp_snd_cwnd(tp));
+							action = NICE_ACT_SCALABLE;
+						}
+						tcp_snd_cwnd_set(tp, tcp_snd_cwnd(tp) + inc);
+					} else if (nice->fractional_cwnd <= nice->max_fwnd) {
 						nice->fractional_cwnd-=2;
 					}
 				} else {
 					/* Sending just as fast as we
 					 * should be.
 					 */
+					action = NICE_ACT_HOLD;
 				}
 			}
 
-			if (tp->snd_cwnd < 2 && nice->fractional_cwnd == 2)
-				tp->snd_cwnd = 2;
-			else if (tp->snd_cwnd > tp->snd_cwnd_clamp)
-				tp->snd_cwnd = tp->snd_cwnd_clamp;
+			if (tcp_snd_cwnd(tp) < 2 && nice->fractional_cwnd == 2)
+				tcp_snd_cwnd_set(tp, 2);
+			else if (tcp_snd_cwnd(tp) > tp->snd_cwnd_clamp)
+				tcp_snd_cwnd_set(tp, tp->snd_cwnd_clamp);
 
 			tp->snd_ssthresh = tcp_current_ssthresh(sk);
 		}
 
+		if (prior_fwnd <= 2 && nice->fractional_cwnd > 2)
+			NICE_STAT_INC(NICE_STAT_FRACTIONAL);
+
+		if (nice->scalable)
+			nice_update_calm(nice, action);
+
+		trace_nice_update(sk, nice, action, diff, num_cong, prior_cwnd,
+				  prior_fwnd);
+
+		if (nice->cached)
+			nice_cache_sync(sk);
+
 		/* Wipe the slate clean for the next RTT. */
 		nice->cntRTT = 0;
 		nice->minRTT = 0x7fffffff;
 		nice->maxRTT = 0;
 		nice->numCong = 0;
+		nice->sample_shift = nice_sample_shift(nice, tcp_snd_cwnd(tp));
 	}
 	/* Use normal slow start */
 	else if (tcp_in_slow_start(tp))
 		tcp_slow_start(tp, acked);
+
+	if (nice->pacing)
+		nice_pace_fractional(sk);
+}
+
+#ifdef LBE_HAVE_RATE_SAMPLE
+/*
+ * Takes over from the stack after each ACK only so that the pacing
+ * rate of a fractional window is not overwritten; cwnd is updated as
+ * tcp_cong_control() would, but for PRR's conservative bound.
+ */
+static void tcp_nice_cong_control(struct sock *sk, u32 ack, int flag,
+				  const struct rate_sample *rs)
+{
+	struct nice *nice = inet_csk_ca(sk);
+	bool data_acked = nice->data_acked;
+
+	nice->data_acked = 0;
+	if (tcp_in_cwnd_reduction(sk))
+		lbe_cwnd_reduction(sk, rs->acked_sacked);
+	else if (lbe_may_raise_cwnd(sk, data_acked, rs->acked_sacked))
+		tcp_nice_cong_avoid(sk, ack, rs->acked_sacked);
+
+	nice_update_pacing_rate(sk);
 }
+LBE_CONG_CONTROL_COMPAT(tcp_nice_cong_control)
+#endif
 
 /* Extract info for Tcp socket info provided via netlink. */
 size_t tcp_nice_get_info(struct sock *sk, u32 ext, int *attr,
@@ -404,11 +1069,16 @@ EXPORT_SYMBOL_GPL(tcp_nice_get_info);
 static struct tcp_congestion_ops tcp_nice __read_mostly = {
 	.init		= tcp_nice_init,
 	.ssthresh	= tcp_reno_ssthresh,
+	.undo_cwnd	= tcp_reno_undo_cwnd,
 	.cong_avoid	= tcp_nice_cong_avoid,
-	.pkts_acked	= tcp_nice_pkts_acked,
+#ifdef LBE_HAVE_RATE_SAMPLE
+	.cong_control	= LBE_CONG_CONTROL(tcp_nice_cong_control),
+#endif
+	.pkts_acked	= LBE_PKTS_ACKED(tcp_nice_pkts_acked),
 	.set_state	= tcp_nice_state,
 	.cwnd_event	= tcp_nice_cwnd_event,
 	.get_info	= tcp_nice_get_info,
+	.release	= tcp_nice_release,
 
 	.owner		= THIS_MODULE,
 	.name		= "nice",
@@ -416,14 +1086,42 @@ static struct tcp_congestion_ops tcp_nice __read_mostly = {
 
 static int __init tcp_nice_register(void)
 {
+	int ret;
+
 	BUILD_BUG_ON(sizeof(struct nice) > ICSK_CA_PRIV_SIZE);
-	tcp_register_congestion_control(&tcp_nice);
+
+	if (ecn) {
+		tcp_nice.flags |= TCP_CONG_NEEDS_ECN;
+		tcp_nice.in_ack_event = tcp_nice_in_ack_event;
+	}
+
+	ret = register_pernet_subsys(&nice_net_ops);
+	if (ret)
+		return ret;
+
+	if (!proc_create_single("tcp_nice_stat", 0444, init_net.proc_net,
+				nice_stat_seq_show)) {
+		ret = -ENOMEM;
+		goto err_pernet;
+	}
+
+	ret = tcp_register_congestion_control(&tcp_nice);
+	if (ret)
+		goto err_proc;
 	return 0;
+
+err_proc:
+	remove_proc_entry("tcp_nice_stat", init_net.proc_net);
+err_pernet:
+	unregister_pernet_subsys(&nice_net_ops);
+	return ret;
 }
 
 static void __exit tcp_nice_unregister(void)
 {
 	tcp_unregister_congestion_control(&tcp_nice);
+	remove_proc_entry("tcp_nice_stat", init_net.proc_net);
+	unregister_pernet_subsys(&nice_net_ops);
 }
 
 module_init(tcp_nice_register);
@@ -0,0 +1,109 @@
+/*
+ * Tracepoints of TCP Nice
+ *
+ * nice_update fires once per RTT with the inputs and outcome of the
+ * Vegas/Nice cwnd decision, and when a re-probe of baseRTT starts and
+ * ends, e.g.
+ *   perf record -e tcp_nice:nice_update
+ * RTTs are in usec, the age of baseRTT in ms. It reads struct nice, so tcp_nice.c includes this
+ * header after the structure is defined.
+ */
+
+#undef TRACE_SYSTEM
+#define TRACE_SYSTEM tcp_nice
+
+#if !defined(_TCP_NICE_TRACE_H) || defined(TRACE_HEADER_MULTI_READ)
+#define _TCP_NICE_TRACE_H
+
+#include <linux/tracepoint.h>
+#include <net/inet_sock.h>
+#include <net/tcp.h>
+
+#include "tcp_lbe_compat.h"
+
+/* Decisions of the per-RTT update */
+#define NICE_ACT_RENO		0	/* too few RTT samples, Reno */
+#define NICE_ACT_SS_EXIT	1	/* diff > gamma, leave slow start */
+#define NICE_ACT_SLOW_START	2
+#define NICE_ACT_MD		3	/* numCong over fraction, halve the window */
+#define NICE_ACT_DECREASE	4	/* diff > beta */
+#define NICE_ACT_INCREASE	5	/* diff < alpha */
+#define NICE_ACT_HOLD		6
+#define NICE_ACT_SCALABLE	7	/* diff < alpha for a while, scale */
+#define NICE_ACT_PROBE		8	/* baseRTT too old, hold cwnd at 2 */
+#define NICE_ACT_PROBE_END	9	/* baseRTT re-measured, cwnd restored */
+
+TRACE_EVENT(nice_update,
+
+	TP_PROTO(const struct sock *sk, const struct nice *nice, int action,
+		 u32 diff, u8 num_cong, u32 prior_cwnd, u8 prior_fwnd),
+
+	TP_ARGS(sk, nice, action, diff, num_cong, prior_cwnd, prior_fwnd),
+
+	TP_STRUCT__entry(
+		__field(const void *, skaddr)
+		__field(__u16, sport)
+		__field(__u16, dport)
+		__field(int, action)
+		__field(__u32, base_rtt)
+		__field(__u32, base_rtt_age)
+		__field(__u32, min_rtt)
+		__field(__u32, max_rtt)
+		__field(__u16, cnt_rtt)
+		__field(__u8, num_cong)
+		__field(__u32, diff)
+		__field(__u32, prior_cwnd)
+		__field(__u32, snd_cwnd)
+		__field(__u32, ssthresh)
+		__field(__u8, prior_fwnd)
+		__field(__u8, fractional_cwnd)
+	),
+
+	TP_fast_assign(
+		__entry->skaddr = sk;
+		__entry->sport = ntohs(inet_sk(sk)->inet_sport);
+		__entry->dport = ntohs(inet_sk(sk)->inet_dport);
+		__entry->action = action;
+		__entry->base_rtt = nice->baseRTT;
+		__entry->base_rtt_age =
+			jiffies_to_msecs((u32)jiffies - nice->baseRTT_stamp);
+		__entry->min_rtt = nice->minRTT;
+		__entry->max_rtt = nice->maxRTT;
+		__entry->cnt_rtt = nice->cntRTT;
+		__entry->num_cong = num_cong;
+		__entry->diff = diff;
+		__entry->prior_cwnd = prior_cwnd;
+		__entry->snd_cwnd = tcp_snd_cwnd(tcp_sk(sk));
+		__entry->ssthresh = tcp_sk(sk)->snd_ssthresh;
+		__entry->prior_fwnd = prior_fwnd;
+		__entry->fractional_cwnd = nice->fractional_cwnd;
+	),
+
+	TP_printk("sport=%hu dport=%hu %s base_rtt=%u base_rtt_age=%u min_rtt=%u max_rtt=%u cnt_rtt=%hu num_cong=%u diff=%u cwnd=%u->%u fractional_cwnd=%u->%u ssthresh=%u skaddr=%p",
+		  __entry->sport, __entry->dport,
+		  __print_symbolic(__entry->action,
+				   { NICE_ACT_RENO, "reno" },
+				   { NICE_ACT_SS_EXIT, "slow_start_exit" },
+				   { NICE_ACT_SLOW_START, "slow_start" },
+				   { NICE_ACT_MD, "multiplicative_decrease" },
+				   { NICE_ACT_DECREASE, "decrease" },
+				   { NICE_ACT_INCREASE, "increase" },
+				   { NICE_ACT_HOLD, "hold" },
+				   { NICE_ACT_SCALABLE, "scalable" },
+				   { NICE_ACT_PROBE, "probe_base_rtt" },
+				   { NICE_ACT_PROBE_END, "probe_base_rtt_end" }),
+		  __entry->base_rtt, __entry->base_rtt_age, __entry->min_rtt, __entry->max_rtt,
+		  __entry->cnt_rtt, __entry->num_cong, __entry->diff,
+		  __entry->prior_cwnd, __entry->snd_cwnd,
+		  __entry->prior_fwnd, __entry->fractional_cwnd,
+		  __entry->ssthresh, __entry->skaddr)
+);
+
+#endif /* _TCP_NICE_TRACE_H */
+
+/* This part must be outside protection */
+#undef TRACE_INCLUDE_PATH
+#define TRACE_INCLUDE_PATH .
+#undef TRACE_INCLUDE_FILE
+#define TRACE_INCLUDE_FILE tcp_nice_trace
+#include <trace/define_trace.h>
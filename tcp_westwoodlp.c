@@ -22,36 +22,189 @@
 #include <linux/module.h>
 #include <linux/skbuff.h>
 #include <linux/inet_diag.h>
+#include <linux/ktime.h>
+#include <linux/math64.h>
+#include <linux/percpu.h>
+#include <linux/proc_fs.h>
+#include <linux/seq_file.h>
 #include <net/tcp.h>
 
+#include "tcp_lbe_cache.h"
+#include "tcp_lbe_compat.h"
+#include "tcp_lbe_scalable.h"
+
 static int beta = 3;
 
 module_param(beta, int, 0644);
 MODULE_PARM_DESC(beta, "upper bound of early window reduction queue threshold");
 
+/* Scalable TCP growth while the path shows no queue, see tcp_lbe_scalable.h */
+static bool scalable __read_mostly;
+module_param(scalable, bool, 0644);
+MODULE_PARM_DESC(scalable, "grow as Scalable TCP after 4 RTT windows without a queue, until the first queue or loss");
+
+/* Kernels from 4.9 hand the congestion control a rate sample (delivered
+ * packets over an interval, measured per skb with SACK, retransmissions
+ * and application-limited periods accounted for), which is a better
+ * bandwidth sample than counting snd_una advances.
+ */
+#ifdef LBE_HAVE_RATE_SAMPLE
+static bool rate_sample __read_mostly = true;
+module_param(rate_sample, bool, 0444);
+MODULE_PARM_DESC(rate_sample, "estimate bandwidth from the kernel's rate samples (cong_control) instead of counting ACKed bytes");
+#endif
+
+/* Bandwidth is kept in 32 bits as bytes per usec << WESTWOOD_BW_SCALE,
+ * which resolves 4 bytes per second and holds up to 130 Gbit/s, so that
+ * struct westwood fits the 64 bytes of ICSK_CA_PRIV_SIZE before 4.9.
+ * For the same reason bk, the bytes ACKed in an RTT window, saturates at
+ * 4 GiB: windows longer than 260 ms at 130 Gbit/s, or 1 s at 34 Gbit/s,
+ * then underestimate rather than wrap. All times (RTTs, delays and the
+ * RTT window) are in usec.
+ */
+#define WESTWOOD_BW_SCALE	18
+
+/* add acked bytes to bk, saturated as above */
+static inline u32 westwood_bk_add(u32 bk, u32 acked)
+{
+	return min_t(u64, (u64)bk + acked, U32_MAX);
+}
+
+/* bytes over interval_us in the unit of bw_est, saturated */
+static inline u32 westwood_bw_sample(u64 bytes, u32 interval_us)
+{
+	return min_t(u64, div_u64(bytes << WESTWOOD_BW_SCALE, interval_us),
+		     U32_MAX);
+}
+
+/* Host-wide statistics. Per-CPU so that the ACK path never shares a
+ * cacheline with other CPUs; /proc/net/tcp_westwoodlp_stat sums them.
+ */
+enum {
+	WESTWOOD_STAT_EWR,		/* early window reductions */
+	WESTWOOD_STAT_LOSS,		/* ssthresh reset to the BDP on loss */
+	WESTWOOD_STAT_MAX
+};
+
+static const char * const westwood_stat_names[WESTWOOD_STAT_MAX] = {
+	[WESTWOOD_STAT_EWR]	= "ewr_events",
+	[WESTWOOD_STAT_LOSS]	= "loss_ssthresh_resets",
+};
+
+struct westwood_mib {
+	unsigned long mibs[WESTWOOD_STAT_MAX];
+};
+
+static DEFINE_PER_CPU(struct westwood_mib, westwood_stats);
+
+#define WESTWOOD_STAT_INC(field)	this_cpu_inc(westwood_stats.mibs[field])
+
+static int westwood_stat_seq_show(struct seq_file *seq, void *v)
+{
+	int i, cpu;
+
+	for (i = 0; i < WESTWOOD_STAT_MAX; i++) {
+		unsigned long sum = 0;
+
+		for_each_possible_cpu(cpu)
+			sum += per_cpu(westwood_stats, cpu).mibs[i];
+		seq_printf(seq, "%s %lu\n", westwood_stat_names[i], sum);
+	}
+	return 0;
+}
+
+
 /* TCP Westwood structure */
 struct westwood {
 	u32    bw_ns_est;        /* first bandwidth estimation..not too smoothed 8) */
 	u32    bw_est;           /* bandwidth estimate */
+	union {
+		u32    bk;       /* bytes acked in the current RTT window */
+		u32    rs_bw;    /* or with rate samples, the last one in it */
+	};
 	u32    rtt_win_sx;       /* here starts a new evaluation... */
-	u32    bk;
 	u32    snd_una;          /* used for evaluating the number of acked bytes */
-	u32    cumul_ack;
 	u32    accounted;
 	u32    rtt;
 	u32    rtt_min;          /* minimum observed RTT */
-	u8     first_ack;        /* flag which infers that this is the first ack */
-	u8     reset_rtt_min;    /* Reset RTT min to next RTT sample*/
+	u8     first_ack:1,      /* flag which infers that this is the first ack */
+	       reset_rtt_min:1,  /* Reset RTT min to next RTT sample*/
+	       ewr_mode:2,       /* which delays ewr_base was taken from */
+	       cached:1,         /* counted in with its destination by tcp_lbe_cache */
+	       scalable:1,       /* scalable option, read at init */
+	       data_acked:1;     /* the ACK being processed acks new data */
+	u8     flows;            /* LBE flows sharing the bottleneck, see tcp_lbe_cache.h */
+	u8     calm_rtts;        /* RTT windows ended since the last queue seen */
 	u32	   delay_min;	     /* minimum RTT observed within an EWR window */
 	u32	   delay_max;		 /* maximum RTT observed within an EWR window */
 	u32	   dmin_avg;		 /* weighted average of minimum RTT observed during a connection */
 	u32	   dmax_avg;	     /* weighted average of maximum RTT observed during a connection */
 	u32	   delay_loss;		 /* weighted average of RTT observed when packet loss occurs */
+	u32    bdp;              /* bw_est * rtt_min in advmss packets */
+	u32    ewr_base;         /* beta * (100 - 100 * dmin / dmax) */
+};
+
+/* w->ewr_mode */
+enum {
+	WESTWOOD_EWR_OFF,        /* no delay range yet, EWR disabled */
+	WESTWOOD_EWR_AVG,        /* from dmin_avg and dmax_avg */
+	WESTWOOD_EWR_WINDOW,     /* from delay_min and delay_max, outside slow start */
 };
 
 /* TCP Westwood functions and constants */
-#define TCP_WESTWOOD_RTT_MIN   (HZ/20)	/* 50ms */
-#define TCP_WESTWOOD_INIT_RTT  (20*HZ)	/* maybe too conservative?! */
+#define TCP_WESTWOOD_RTT_MIN   (50 * USEC_PER_MSEC)	/* 50ms */
+#define TCP_WESTWOOD_INIT_RTT  (20 * USEC_PER_SEC)	/* maybe too conservative?! */
+#define WESTWOOD_EWR_MIN_QUEUE 3	/* packets the RTT must show queued */
+
+static inline u32 westwood_clock_us(void)
+{
+	return div_u64(ktime_get_ns(), NSEC_PER_USEC);
+}
+
+#define CREATE_TRACE_POINTS
+#include "tcp_westwoodlp_trace.h"
+
+/*
+ * @westwood_cache_join
+ * A connection to a destination seen recently starts from the RTT and
+ * bandwidth of the last connections there rather than from
+ * TCP_WESTWOOD_INIT_RTT and no estimate. The first samples then refine
+ * them through the filter as they would their own.
+ */
+static void westwood_cache_join(struct sock *sk)
+{
+	struct westwood *w = inet_csk_ca(sk);
+	struct lbe_cache_seed seed;
+
+	w->cached = lbe_cache_join(sk, &seed);
+	w->flows = seed.flows;
+	if (seed.min_rtt_us) {
+		w->rtt_min = w->rtt = seed.min_rtt_us;
+		w->reset_rtt_min = 0;
+	}
+	/* bdp follows at the end of the first RTT window */
+	if (seed.bw)
+		w->bw_ns_est = w->bw_est = seed.bw;
+}
+
+/*
+ * @westwood_cache_sync
+ * Report rtt_min and bw_est to the destination cache, once per RTT window.
+ */
+static void westwood_cache_sync(struct sock *sk)
+{
+	struct westwood *w = inet_csk_ca(sk);
+	struct lbe_cache_seed seed;
+	u32 mask = LBE_CACHE_BW;
+
+	seed.bw = w->bw_est;
+	if (w->rtt_min != TCP_WESTWOOD_INIT_RTT) {
+		seed.min_rtt_us = w->rtt_min;
+		mask |= LBE_CACHE_MIN_RTT;
+	}
+
+	w->flows = lbe_cache_update(sk, &seed, mask);
+}
 
 /*
  * @tcp_westwood_create
@@ -72,15 +225,34 @@ static void tcp_westwood_init(struct sock *sk)
 	w->bw_ns_est = 0;
 	w->bw_est = 0;
 	w->accounted = 0;
-	w->cumul_ack = 0;
 	w->reset_rtt_min = 1;
 	w->rtt_min = w->rtt = TCP_WESTWOOD_INIT_RTT;
-	w->rtt_win_sx = tcp_time_stamp;
+	w->rtt_win_sx = westwood_clock_us();
 	w->snd_una = tcp_sk(sk)->snd_una;
 	w->first_ack = 1;
 	w->delay_max = w->delay_min = 0;
 	w->dmin_avg = w->dmax_avg = 0;
 	w->delay_loss = 1;
+	w->bdp = 0;
+	w->ewr_base = 0;
+	w->ewr_mode = WESTWOOD_EWR_OFF;
+	w->scalable = READ_ONCE(scalable);
+	w->calm_rtts = 0;
+
+	westwood_cache_join(sk);
+}
+
+static void tcp_westwood_release(struct sock *sk)
+{
+	struct westwood *w = inet_csk_ca(sk);
+
+	/* flows is 0 only if init never joined the cache */
+	if (!w->flows)
+		return;
+
+	if (w->cached)
+		westwood_cache_sync(sk);
+	lbe_cache_leave(sk, w->cached);
 }
 
 /*
@@ -89,32 +261,73 @@ static void tcp_westwood_init(struct sock *sk)
  */
 static inline u32 westwood_do_filter(u32 a, u32 b)
 {
-	return ((7 * a) + b) >> 3;
+	return ((7 * (u64)a) + b) >> 3;
 }
 
-static void westwood_filter(struct westwood *w, u32 delta)
+static void westwood_filter(struct westwood *w, u32 sample)
 {
 	/* If the filter is empty fill it with the first sample of bandwidth  */
 	if (w->bw_ns_est == 0 && w->bw_est == 0) {
-		w->bw_ns_est = w->bk / delta;
+		w->bw_ns_est = sample;
 		w->bw_est = w->bw_ns_est;
 	} else {
-		w->bw_ns_est = westwood_do_filter(w->bw_ns_est, w->bk / delta);
+		w->bw_ns_est = westwood_do_filter(w->bw_ns_est, sample);
 		w->bw_est = westwood_do_filter(w->bw_est, w->bw_ns_est);
 	}
 }
 
+/*
+ * @westwood_bdp
+ * Bandwidth-delay product Bw estimation*RTTmin in packets of mss bytes.
+ * The product is taken with a 96-bit intermediate so that it cannot
+ * overflow whatever the rate and RTT.
+ */
+static u32 westwood_bdp(const struct westwood *w, u32 mss)
+{
+	u64 bytes = mul_u64_u32_shr(w->bw_est, w->rtt_min, WESTWOOD_BW_SCALE);
+
+	if (!mss)
+		return 0;
+	return min_t(u64, div_u64(bytes, mss), U32_MAX);
+}
+
+/*
+ * @westwood_update_bdp
+ * The BDP in advmss packets only changes with bw_est and rtt_min, so
+ * it is cached for the EWR queue length when either of them changes.
+ */
+static void westwood_update_bdp(struct sock *sk)
+{
+	struct westwood *w = inet_csk_ca(sk);
+
+	w->bdp = westwood_bdp(w, tcp_sk(sk)->advmss);
+}
+
 /*
  * @westwood_pkts_acked
  * Called after processing group of packets.
  * but all westwood needs is the last sample of srtt.
  */
-static void tcp_westwood_pkts_acked(struct sock *sk, u32 cnt, s32 rtt)
+static void tcp_westwood_pkts_acked(struct sock *sk,
+				    const struct ack_sample *sample)
 {
 	struct westwood *w = inet_csk_ca(sk);
 
-	if (rtt > 0)
-		w->rtt = usecs_to_jiffies(rtt);
+	w->data_acked = sample->pkts_acked > 0;
+	if (sample->rtt_us > 0)
+		w->rtt = sample->rtt_us;
+}
+LBE_PKTS_ACKED_COMPAT(tcp_westwood_pkts_acked)
+
+/*
+ * @westwood_count_calm
+ * With the scalable option, count the RTT windows since the RTT last
+ * showed a queue, up to LBE_SCALABLE_RTTS, from which on cwnd scales.
+ */
+static inline void westwood_count_calm(struct westwood *w)
+{
+	if (w->scalable && w->calm_rtts < LBE_SCALABLE_RTTS)
+		w->calm_rtts++;
 }
 
 /*
@@ -125,7 +338,8 @@ static void tcp_westwood_pkts_acked(struct sock *sk, u32 cnt, s32 rtt)
 static void westwood_update_window(struct sock *sk)
 {
 	struct westwood *w = inet_csk_ca(sk);
-	s32 delta = tcp_time_stamp - w->rtt_win_sx;
+	u32 now = westwood_clock_us();
+	u32 delta = now - w->rtt_win_sx;
 
 	/* Initialize w->snd_una with the first acked sequence number in order
 	 * to fix mismatch between tp->snd_una and w->snd_una for the first
@@ -146,10 +360,14 @@ static void westwood_update_window(struct sock *sk)
 	 * right_bound = left_bound + WESTWOOD_RTT_MIN
 	 */
 	if (w->rtt && delta > max_t(u32, w->rtt, TCP_WESTWOOD_RTT_MIN)) {
-		westwood_filter(w, delta);
+		westwood_filter(w, westwood_bw_sample(w->bk, delta));
+		westwood_update_bdp(sk);
+		if (w->cached)
+			westwood_cache_sync(sk);
+		westwood_count_calm(w);
 
 		w->bk = 0;
-		w->rtt_win_sx = tcp_time_stamp;
+		w->rtt_win_sx = now;
 	}
 }
 
@@ -165,13 +383,19 @@ static u32 westwood_update_delay(u32 rtt, u32 rtt_avg)
 	return rtt_avg;
 }
 
-static inline void update_rtt_min(struct westwood *w)
+static inline void update_rtt_min(struct sock *sk)
 {
+	struct westwood *w = inet_csk_ca(sk);
+
 	if (w->reset_rtt_min) {
 		w->rtt_min = w->rtt;
 		w->reset_rtt_min = 0;
-	} else
-		w->rtt_min = min(w->rtt, w->rtt_min);
+	} else if (w->rtt < w->rtt_min) {
+		w->rtt_min = w->rtt;
+	} else {
+		return;
+	}
+	westwood_update_bdp(sk);
 }
 
 /*
@@ -187,9 +411,9 @@ static inline void westwood_fast_bw(struct sock *sk)
 
 	westwood_update_window(sk);
 
-	w->bk += tp->snd_una - w->snd_una;
+	w->bk = westwood_bk_add(w->bk, tp->snd_una - w->snd_una);
 	w->snd_una = tp->snd_una;
-	update_rtt_min(w);
+	update_rtt_min(sk);
 }
 
 /*
@@ -201,37 +425,36 @@ static inline u32 westwood_acked_count(struct sock *sk)
 {
 	const struct tcp_sock *tp = tcp_sk(sk);
 	struct westwood *w = inet_csk_ca(sk);
-
-	w->cumul_ack = tp->snd_una - w->snd_una;
+	u32 cumul_ack = tp->snd_una - w->snd_una;
 
 	/* If cumul_ack is 0 this is a dupack since it's not moving
 	 * tp->snd_una.
 	 */
-	if (!w->cumul_ack) {
+	if (!cumul_ack) {
 		w->accounted += tp->mss_cache;
-		w->cumul_ack = tp->mss_cache;
+		return tp->mss_cache;
 	}
 
-	if (w->cumul_ack > tp->mss_cache) {
+	if (cumul_ack > tp->mss_cache && w->accounted) {
 		/* Partial or delayed ack */
-		if (w->accounted >= w->cumul_ack) {
-			w->accounted -= w->cumul_ack;
-			w->cumul_ack = tp->mss_cache;
+		if (w->accounted >= cumul_ack) {
+			w->accounted -= cumul_ack;
+			cumul_ack = tp->mss_cache;
 		} else {
-			w->cumul_ack -= w->accounted;
+			cumul_ack -= w->accounted;
 			w->accounted = 0;
 		}
 	}
 
 	w->snd_una = tp->snd_una;
 
-	return w->cumul_ack;
+	return cumul_ack;
 }
 
 /*
  * TCP Westwood
  * Here limit is evaluated as Bw estimation*RTTmin (for obtaining it
- * in packets we use mss_cache). Rttmin is guaranteed to be >= 2
+ * in packets we use mss_cache). The result is at least 2
  * so avoids ever returning 0.
  */
 static u32 tcp_westwood_bw_rttmin(const struct sock *sk)
@@ -239,63 +462,199 @@ static u32 tcp_westwood_bw_rttmin(const struct sock *sk)
 	const struct tcp_sock *tp = tcp_sk(sk);
 	const struct westwood *w = inet_csk_ca(sk);
 
-	return max_t(u32, (w->bw_est * w->rtt_min) / tp->mss_cache, 2);
+	return max_t(u32, westwood_bdp(w, tp->mss_cache), 2);
 }
 
-static void tcp_westwood_ack(struct sock *sk, u32 ack_flags)
+/* 100 * num / den, without overflowing for usec delays */
+static inline u32 westwood_pct(u32 num, u32 den)
 {
-	if (ack_flags & CA_ACK_SLOWPATH) {
-		struct westwood *w = inet_csk_ca(sk);
+	return div_u64((u64)100 * num, den);
+}
 
-		westwood_update_window(sk);
-		w->bk += westwood_acked_count(sk);
+/*
+ * @westwood_update_ewr
+ * The EWR threshold is
+ *   beta * (1 - 4 * rtt / delay_loss) * (1 - dmin / dmax)
+ * in packets, with dmin/dmax the delay averages once there has been an
+ * EWR event and the extremes of the current EWR window before. All but
+ * the rtt term only change at EWR events and when the window extremes
+ * move, so beta * (100 - 100 * dmin / dmax) is cached here then and
+ * the per-ACK check can do without divisions.
+ */
+static void westwood_update_ewr(struct westwood *w)
+{
+	u32 dmin, dmax;
+
+	if (w->dmin_avg != w->dmax_avg && w->dmax_avg != 0) {
+		w->ewr_mode = WESTWOOD_EWR_AVG;
+		dmin = w->dmin_avg;
+		dmax = w->dmax_avg;
+	} else if (w->delay_min != w->delay_max && w->delay_max != 0) {
+		w->ewr_mode = WESTWOOD_EWR_WINDOW;
+		dmin = w->delay_min;
+		dmax = w->delay_max;
+	} else {
+		w->ewr_mode = WESTWOOD_EWR_OFF;
+		return;
+	}
 
-		update_rtt_min(w);
+	/* The averages are not ordered for sure, so dmin may exceed dmax */
+	if (dmin > dmax) {
+		w->ewr_mode = WESTWOOD_EWR_OFF;
+		return;
+	}
 
-		/* Initialise delay_min and delay_max to rtt on first estimate */
-		if (w->delay_min == 0 && w->delay_max == 0 && w->rtt != TCP_WESTWOOD_INIT_RTT) {
-			w->delay_min = w->delay_max = w->rtt;
-		}
+	w->ewr_base = clamp_val(beta, 0, U8_MAX) * (100 - westwood_pct(dmin, dmax));
+}
 
-		/* Update delay_min and delay_max as appropriate */
-		if (w->rtt > w->delay_max) {
-			w->delay_max = w->rtt;
-		} else if (w->rtt < w->delay_min) {
-			w->delay_min = w->rtt;
-		}
+/*
+ * @westwood_update_delay_range
+ * Track the extremes of the RTT within the current EWR window. Every
+ * ACK takes part, fast path or slow, so that the range is that of the
+ * whole window rather than of its loss periods: nearly all of them fall
+ * within the range, which costs a single compare.
+ */
+static inline void westwood_update_delay_range(struct westwood *w)
+{
+	u32 rtt = w->rtt;
+
+	/* delay_min <= rtt <= delay_max, as delay_min <= delay_max */
+	if (likely(rtt - w->delay_min <= w->delay_max - w->delay_min))
+		return;
+
+	/* No RTT sample yet */
+	if (rtt == TCP_WESTWOOD_INIT_RTT)
+		return;
 
+	/* Initialise delay_min and delay_max to rtt on first estimate */
+	if (w->delay_max == 0) {
+		w->delay_min = w->delay_max = rtt;
 		return;
 	}
 
-	westwood_fast_bw(sk);
+	if (rtt > w->delay_max)
+		w->delay_max = rtt;
+	else
+		w->delay_min = rtt;
+
+	if (w->ewr_mode != WESTWOOD_EWR_AVG)
+		westwood_update_ewr(w);
 }
 
-static void tcp_westwood_cong_avoid(struct sock *sk, u32 ack, u32 acked)
+static void tcp_westwood_ack(struct sock *sk, u32 ack_flags)
 {
-	struct tcp_sock *tp = tcp_sk(sk);
 	struct westwood *w = inet_csk_ca(sk);
 
-	u32 ewr_thresh = 0;
-	u32 queue_length = 0;
-	u32 rtt = 0;
+	if (ack_flags & CA_ACK_SLOWPATH) {
+		westwood_update_window(sk);
+		w->bk = westwood_bk_add(w->bk, westwood_acked_count(sk));
 
-	/* Negate RTT as a factor if delay_loss has no value */
-	if (w->delay_loss > 1) {
-		rtt = w->rtt;
+		update_rtt_min(sk);
+	} else {
+		westwood_fast_bw(sk);
 	}
+	westwood_update_delay_range(w);
+}
+
+/*
+ * @westwood_rtt_queued
+ * Whether the RTT shows a queue, cwnd * (rtt - rtt_min) / rtt packets,
+ * of at least pkts. Delayed and stretched ACKs alone make it worth a
+ * packet or two.
+ */
+static inline bool westwood_rtt_queued(const struct westwood *w, u32 cwnd,
+				       u32 pkts)
+{
+	return w->rtt > w->rtt_min &&
+	       (u64)cwnd * (w->rtt - w->rtt_min) >= (u64)pkts * w->rtt;
+}
+
+static inline u32 westwood_rtt4(const struct westwood *w)
+{
+	/* Negate RTT as a factor if delay_loss has no value */
+	return w->delay_loss > 1 ? w->rtt << 2 : 0;
+}
+
+/*
+ * @westwood_ewr_exceeded
+ * Whether the queue we keep, cwnd - BDP, is above the EWR threshold
+ *   ewr_base / 100 * (1 - rtt4 / delay_loss)
+ * with rtt4 = 4 * rtt, or 0 while delay_loss has no value. This is
+ *   queue * 100 * delay_loss > ewr_base * (delay_loss - rtt4)
+ * and the threshold is 0 once the RTT reaches the average loss delay.
+ * A queue above ewr_base / 100 exceeds any threshold, which also keeps
+ * the products within 64 bits.
+ */
+static bool westwood_ewr_exceeded(const struct westwood *w, u32 cwnd)
+{
+	u64 queue_length;
+	u32 rtt4;
+
+	if (cwnd <= w->bdp)
+		return false;
+	/* Each of the parallel LBE flows through the bottleneck queues
+	 * about as much, and bdp is this one's share: the threshold is on
+	 * the aggregate queue.
+	 */
+	queue_length = (u64)(cwnd - w->bdp) * w->flows;
+
+	if (queue_length * 100 > w->ewr_base)
+		return true;
+
+	rtt4 = westwood_rtt4(w);
+	if (rtt4 >= w->delay_loss)
+		return true;
+
+	return queue_length * 100 * w->delay_loss >
+	       (u64)w->ewr_base * (w->delay_loss - rtt4);
+}
+
+/* The EWR threshold in packets, for tracing only as it divides */
+static u32 westwood_ewr_thresh(const struct westwood *w)
+{
+	u32 rtt4 = westwood_rtt4(w);
+
+	if (rtt4 >= w->delay_loss)
+		return 0;
+	return div64_u64((u64)w->ewr_base * (w->delay_loss - rtt4),
+			 (u64)100 * w->delay_loss);
+}
+
+static void tcp_westwood_cong_avoid(struct sock *sk, u32 ack, u32 acked)
+{
+	struct tcp_sock *tp = tcp_sk(sk);
+	struct westwood *w = inet_csk_ca(sk);
+	bool ewr = false, queued;
+
+	/* Whether the RTT shows a queue, for EWR and for the scalable mode.
+	 * cwnd - bdp is a queue only when bw_est is the bottleneck's. Below
+	 * it, bw_est follows cwnd and the difference is whatever the RTT
+	 * holds above rtt_min, so EWR needs the RTT to show a queue too. The
+	 * RTT of an ACK for acked segments includes the wait for all but the
+	 * first, acked - 1 packets at the sending rate, which is no queue.
+	 */
+	queued = westwood_rtt_queued(w, tcp_snd_cwnd(tp),
+				     WESTWOOD_EWR_MIN_QUEUE + acked);
 
-	/* Check that we have an RTT estimate before computing EWR threshold */
+	/* Check that we have an RTT estimate before checking EWR threshold */
 	/* Use delay_min and delay_max until the first EWR event */
-	if (w->dmin_avg != w->dmax_avg && w->dmax_avg != 0) {
-		queue_length = tp->snd_cwnd - w->bw_est * w->rtt_min / tp->advmss;
-		ewr_thresh = (beta * (100 - 100 * (rtt << 2) / w->delay_loss) / 100) * (100 - 100 * w->dmin_avg / w->dmax_avg) / 100;
-	} else if (w->delay_min != w->delay_max && w->delay_max != 0 && !tcp_in_slow_start(tp)) {
-		queue_length = tp->snd_cwnd - w->bw_est * w->rtt_min / tp->advmss;
-		ewr_thresh = (beta * (100 - 100 * (rtt << 2) / w->delay_loss) / 100) * (100 - 100 * w->delay_min / w->delay_max) / 100;		
-	}
+	if (queued && (w->ewr_mode == WESTWOOD_EWR_AVG ||
+		       (w->ewr_mode == WESTWOOD_EWR_WINDOW && !tcp_in_slow_start(tp))))
+		ewr = westwood_ewr_exceeded(w, tcp_snd_cwnd(tp));
+
+	/* Any queue starts the count of RTT windows without one over */
+	if (w->calm_rtts && queued)
+		w->calm_rtts = 0;
+
+	if (ewr) {
+		u32 cwnd = tcp_westwood_bw_rttmin(sk);
 
-	if (queue_length > ewr_thresh) {
-		tp->snd_cwnd = tp->snd_ssthresh = tcp_westwood_bw_rttmin(sk);
+		if (trace_westwoodlp_ewr_enabled())
+			trace_westwoodlp_ewr(sk, w, cwnd, westwood_ewr_thresh(w));
+
+		tp->snd_ssthresh = cwnd;
+		tcp_snd_cwnd_set(tp, cwnd);
+		WESTWOOD_STAT_INC(WESTWOOD_STAT_EWR);
 
 		/* Update min and max delay averages with values from this EWR window */
 		w->dmin_avg = westwood_update_delay(w->delay_min, w->dmin_avg);
@@ -303,6 +662,10 @@ static void tcp_westwood_cong_avoid(struct sock *sk, u32 ack, u32 acked)
 
 		/* Current RTT becomes lowest and highest RTT observed */
 		w->delay_max = w->delay_min = w->rtt;
+		westwood_update_ewr(w);
+	} else if (w->calm_rtts >= LBE_SCALABLE_RTTS &&
+		   !tcp_in_slow_start(tp) && tcp_is_cwnd_limited(sk)) {
+		lbe_scalable_cong_avoid(tp, acked);
 	} else {
 		tcp_reno_cong_avoid(sk, ack, acked);		
 	}
@@ -316,10 +679,15 @@ static void tcp_westwood_event(struct sock *sk, enum tcp_ca_event event)
 
 	switch (event) {
 	case CA_EVENT_COMPLETE_CWR:
-		tp->snd_cwnd = tp->snd_ssthresh = tcp_westwood_bw_rttmin(sk);
+		tp->snd_ssthresh = tcp_westwood_bw_rttmin(sk);
+		tcp_snd_cwnd_set(tp, tp->snd_ssthresh);
+		/* a loss or mark ends scaling */
+		w->calm_rtts = 0;
 		break;
 	case CA_EVENT_LOSS:
 		tp->snd_ssthresh = tcp_westwood_bw_rttmin(sk);
+		w->calm_rtts = 0;
+		WESTWOOD_STAT_INC(WESTWOOD_STAT_LOSS);
 		w->delay_loss = westwood_update_delay(w->rtt, w->delay_loss);
 		/* Update RTT_min when next ack arrives */
 		w->reset_rtt_min = 1;
@@ -330,6 +698,89 @@ static void tcp_westwood_event(struct sock *sk, enum tcp_ca_event event)
 	}
 }
 
+#ifdef LBE_HAVE_RATE_SAMPLE
+/*
+ * @westwood_rs_update_window
+ * With rate samples each one already covers about an RTT, so the filter
+ * takes the last sample of every RTT window instead of the bytes acked
+ * over it. Windows without a sample, e.g. while idle, are skipped.
+ */
+static void westwood_rs_update_window(struct sock *sk)
+{
+	struct westwood *w = inet_csk_ca(sk);
+	u32 now = westwood_clock_us();
+	u32 delta = now - w->rtt_win_sx;
+
+	if (delta > max_t(u32, w->rtt, TCP_WESTWOOD_RTT_MIN)) {
+		if (w->rs_bw) {
+			westwood_filter(w, w->rs_bw);
+			westwood_update_bdp(sk);
+			if (w->cached)
+				westwood_cache_sync(sk);
+		}
+		westwood_count_calm(w);
+		w->rs_bw = 0;
+		w->rtt_win_sx = now;
+	}
+}
+
+/*
+ * @westwood_rs_sample
+ * Delivery rate of the sample, in the unit of bw_est. As in
+ * tcp_rate_gen(), an application-limited sample only counts when it
+ * shows more bandwidth than the estimate.
+ */
+static void westwood_rs_sample(struct sock *sk, const struct rate_sample *rs)
+{
+	struct westwood *w = inet_csk_ca(sk);
+	u32 bw;
+
+	if (rs->delivered <= 0 || rs->interval_us <= 0)
+		return;
+
+	bw = westwood_bw_sample((u64)rs->delivered * tcp_sk(sk)->mss_cache,
+				rs->interval_us);
+	if (!rs->is_app_limited || bw > w->bw_est)
+		w->rs_bw = bw;
+}
+
+/* ACK processing with rate samples: only the RTT is tracked here */
+static void tcp_westwood_rs_ack(struct sock *sk, u32 ack_flags)
+{
+	struct westwood *w = inet_csk_ca(sk);
+
+	update_rtt_min(sk);
+	westwood_update_delay_range(w);
+}
+
+/*
+ * @tcp_westwood_cong_control
+ * Replaces the stack's cwnd update when rate samples are used, as
+ * tcp_cong_control() does it: PRR in CWR and Recovery, and growth only
+ * on the ACKs tcp_may_raise_cwnd() allows, so that duplicate ACKs in
+ * Disorder do not raise cwnd. On completion tcp_westwood_event() still
+ * sets cwnd to the BDP.
+ */
+static void tcp_westwood_cong_control(struct sock *sk, u32 ack, int flag,
+				      const struct rate_sample *rs)
+{
+	struct westwood *w = inet_csk_ca(sk);
+	bool data_acked = w->data_acked;
+
+	w->data_acked = 0;
+	westwood_rs_sample(sk, rs);
+	westwood_rs_update_window(sk);
+
+	if (tcp_in_cwnd_reduction(sk))
+		lbe_cwnd_reduction(sk, rs->acked_sacked);
+	else if (lbe_may_raise_cwnd(sk, data_acked, rs->acked_sacked))
+		tcp_westwood_cong_avoid(sk, ack, rs->acked_sacked);
+
+	lbe_update_pacing_rate(sk);
+}
+LBE_CONG_CONTROL_COMPAT(tcp_westwood_cong_control)
+#endif
+
 /* Extract info for Tcp socket info provided via netlink. */
 static size_t tcp_westwood_info(struct sock *sk, u32 ext, int *attr,
 				union tcp_cc_info *info)
@@ -339,8 +790,8 @@ static size_t tcp_westwood_info(struct sock *sk, u32 ext, int *attr,
 	if (ext & (1 << (INET_DIAG_VEGASINFO - 1))) {
 		info->vegas.tcpv_enabled = 1;
 		info->vegas.tcpv_rttcnt	= 0;
-		info->vegas.tcpv_rtt	= jiffies_to_usecs(ca->rtt),
-		info->vegas.tcpv_minrtt	= jiffies_to_usecs(ca->rtt_min),
+		info->vegas.tcpv_rtt	= ca->rtt,
+		info->vegas.tcpv_minrtt	= ca->rtt_min,
 
 		*attr = INET_DIAG_VEGASINFO;
 		return sizeof(struct tcpvegas_info);
@@ -351,11 +802,13 @@ static size_t tcp_westwood_info(struct sock *sk, u32 ext, int *attr,
 static struct tcp_congestion_ops tcp_westwoodlp __read_mostly = {
 	.init		= tcp_westwood_init,
 	.ssthresh	= tcp_reno_ssthresh,
+	.undo_cwnd	= tcp_reno_undo_cwnd,
 	.cong_avoid	= tcp_westwood_cong_avoid,
 	.cwnd_event	= tcp_westwood_event,
 	.in_ack_event	= tcp_westwood_ack,
 	.get_info	= tcp_westwood_info,
-	.pkts_acked	= tcp_westwood_pkts_acked,
+	.pkts_acked	= LBE_PKTS_ACKED(tcp_westwood_pkts_acked),
+	.release	= tcp_westwood_release,
 
 	.owner		= THIS_MODULE,
 	.name		= "westwoodlp"
@@ -363,13 +816,32 @@ static struct tcp_congestion_ops tcp_westwoodlp __read_mostly = {
 
 static int __init tcp_westwoodlp_register(void)
 {
+	int ret;
+
 	BUILD_BUG_ON(sizeof(struct westwood) > ICSK_CA_PRIV_SIZE);
-	return tcp_register_congestion_control(&tcp_westwoodlp);
+
+#ifdef LBE_HAVE_RATE_SAMPLE
+	if (rate_sample) {
+		tcp_westwoodlp.cong_control =
+			LBE_CONG_CONTROL(tcp_westwood_cong_control);
+		tcp_westwoodlp.in_ack_event = tcp_westwood_rs_ack;
+	}
+#endif
+
+	if (!proc_create_single("tcp_westwoodlp_stat", 0444, init_net.proc_net,
+				westwood_stat_seq_show))
+		return -ENOMEM;
+
+	ret = tcp_register_congestion_control(&tcp_westwoodlp);
+	if (ret)
+		remove_proc_entry("tcp_westwoodlp_stat", init_net.proc_net);
+	return ret;
 }
 
 static void __exit tcp_westwoodlp_unregister(void)
 {
 	tcp_unregister_congestion_control(&tcp_westwoodlp);
+	remove_proc_entry("tcp_westwoodlp_stat", init_net.proc_net);
 }
 
 module_init(tcp_westwoodlp_register);
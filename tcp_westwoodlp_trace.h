@@ -0,0 +1,81 @@
+/*
+ * Tracepoints of TCP Westwood+LP
+ *
+ * westwoodlp_ewr fires on every early window reduction, with the queue
+ * and threshold that triggered it, e.g.
+ *   perf record -e tcp_westwoodlp:westwoodlp_ewr
+ * Times are in usec, with delay_loss and the delay averages scaled by 4
+ * as they are kept. It reads struct westwood, so tcp_westwoodlp.c
+ * includes this header after the structure is defined.
+ */
+
+#undef TRACE_SYSTEM
+#define TRACE_SYSTEM tcp_westwoodlp
+
+#if !defined(_TCP_WESTWOODLP_TRACE_H) || defined(TRACE_HEADER_MULTI_READ)
+#define _TCP_WESTWOODLP_TRACE_H
+
+#include <linux/tracepoint.h>
+#include <net/inet_sock.h>
+#include <net/tcp.h>
+
+#include "tcp_lbe_compat.h"
+
+TRACE_EVENT(westwoodlp_ewr,
+
+	TP_PROTO(const struct sock *sk, const struct westwood *w, u32 cwnd,
+		 u32 ewr_thresh),
+
+	TP_ARGS(sk, w, cwnd, ewr_thresh),
+
+	TP_STRUCT__entry(
+		__field(const void *, skaddr)
+		__field(__u16, sport)
+		__field(__u16, dport)
+		__field(__u32, prior_cwnd)
+		__field(__u32, snd_cwnd)
+		__field(__u32, queue_length)
+		__field(__u32, ewr_thresh)
+		__field(__u32, bdp)
+		__field(__u32, rtt)
+		__field(__u32, rtt_min)
+		__field(__u32, delay_loss)
+		__field(__u32, dmin)
+		__field(__u32, dmax)
+		__field(__u8, from_avg)
+	),
+
+	TP_fast_assign(
+		__entry->skaddr = sk;
+		__entry->sport = ntohs(inet_sk(sk)->inet_sport);
+		__entry->dport = ntohs(inet_sk(sk)->inet_dport);
+		__entry->prior_cwnd = tcp_snd_cwnd(tcp_sk(sk));
+		__entry->snd_cwnd = cwnd;
+		__entry->queue_length = tcp_snd_cwnd(tcp_sk(sk)) - w->bdp;
+		__entry->ewr_thresh = ewr_thresh;
+		__entry->bdp = w->bdp;
+		__entry->rtt = w->rtt;
+		__entry->rtt_min = w->rtt_min;
+		__entry->delay_loss = w->delay_loss;
+		__entry->from_avg = w->ewr_mode == WESTWOOD_EWR_AVG;
+		__entry->dmin = __entry->from_avg ? w->dmin_avg : w->delay_min;
+		__entry->dmax = __entry->from_avg ? w->dmax_avg : w->delay_max;
+	),
+
+	TP_printk("sport=%hu dport=%hu cwnd=%u->%u queue_length=%u ewr_thresh=%u bdp=%u rtt=%u rtt_min=%u delay_loss=%u %s=%u/%u skaddr=%p",
+		  __entry->sport, __entry->dport,
+		  __entry->prior_cwnd, __entry->snd_cwnd,
+		  __entry->queue_length, __entry->ewr_thresh, __entry->bdp,
+		  __entry->rtt, __entry->rtt_min, __entry->delay_loss,
+		  __entry->from_avg ? "dmin_avg/dmax_avg" : "delay_min/delay_max",
+		  __entry->dmin, __entry->dmax, __entry->skaddr)
+);
+
+#endif /* _TCP_WESTWOODLP_TRACE_H */
+
+/* This part must be outside protection */
+#undef TRACE_INCLUDE_PATH
+#define TRACE_INCLUDE_PATH .
+#undef TRACE_INCLUDE_FILE
+#define TRACE_INCLUDE_FILE tcp_westwoodlp_trace
+#include <trace/define_trace.h>